@@ -0,0 +1,181 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <kpass.h>
+
+#include "config.h"
+#include "db.h"
+
+/* Writes a synthetic KeePass 1.x database of the requested shape, for the
+ * benchmarks to load.  Apart from timestamps the contents only depend on
+ * the options. */
+
+static gint n_groups = 500;
+static gint depth = 4;
+static gint n_entries = 100;
+static gint field_length = 16;
+static gint rounds = 10000;
+static gint seed = 1;
+static gchar *password = "bench";
+
+static GOptionEntry options[] =
+{
+  { "groups", 'g', 0, G_OPTION_ARG_INT, &n_groups,
+    "Number of groups (default: 500)", "N" },
+  { "depth", 'd', 0, G_OPTION_ARG_INT, &depth,
+    "Deepest group nesting (default: 4)", "N" },
+  { "entries", 'e', 0, G_OPTION_ARG_INT, &n_entries,
+    "Entries in each group (default: 100)", "N" },
+  { "field-length", 'l', 0, G_OPTION_ARG_INT, &field_length,
+    "Length of each text field (default: 16)", "N" },
+  { "rounds", 'r', 0, G_OPTION_ARG_INT, &rounds,
+    "Key transform rounds (default: 10000)", "N" },
+  { "seed", 0, 0, G_OPTION_ARG_INT, &seed,
+    "Random seed (default: 1)", "N" },
+  { "password", 'p', 0, G_OPTION_ARG_STRING, &password,
+    "Master password (default: bench)", "PASS" },
+  { NULL }
+};
+
+static char *random_field(GRand *rand) {
+	char *s;
+	int i;
+
+	s = malloc(field_length + 1);
+	for(i = 0; i < field_length; i++)
+		s[i] = 'a' + g_rand_int_range(rand, 0, 26);
+	s[field_length] = '\0';
+	return s;
+}
+
+static void random_bytes(GRand *rand, uint8_t *buf, int len) {
+	int i;
+
+	for(i = 0; i < len; i++)
+		buf[i] = g_rand_int_range(rand, 0, 256);
+}
+
+int main(int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	GRand *rand;
+	kpass_db db;
+	kpass_group *group;
+	kpass_entry *entry;
+	uint8_t pw_hash[PW_HASH_LEN], now[5], *buf;
+	struct tm tms;
+	time_t t;
+	FILE *out;
+	int i, j, len;
+
+	context = g_option_context_new("OUTPUT");
+	g_option_context_add_main_entries(context, options, NULL);
+	if(!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 2;
+	}
+	g_option_context_free(context);
+
+	if(argc != 2 || n_groups < 1 || depth < 1 || n_entries < 0 ||
+			field_length < 0 || rounds < 1) {
+		fprintf(stderr, "usage: %s [OPTION...] OUTPUT\n",
+				g_get_prgname());
+		return 2;
+	}
+
+	rand = g_rand_new_with_seed(seed);
+	t = time(NULL);
+	localtime_r(&t, &tms);
+	kpass_pack_time(&tms, now);
+
+	memset(&db, 0, sizeof(db));
+	db.flags = 3;	/* SHA-2 and Rijndael */
+	db.version = 0x00030002;
+	db.key_rounds = rounds;
+	random_bytes(rand, db.master_seed, sizeof(db.master_seed));
+	random_bytes(rand, db.master_seed_extra, sizeof(db.master_seed_extra));
+	random_bytes(rand, db.encryption_init_vector,
+			sizeof(db.encryption_init_vector));
+
+	/* Groups nest one level deeper each time until depth, then start
+	 * over at the top */
+	db.groups_len = n_groups;
+	db.groups = calloc(n_groups, sizeof(kpass_group*));
+	for(i = 0; i < n_groups; i++) {
+		group = calloc(1, sizeof(kpass_group));
+		group->id = i + 1;
+		group->name = random_field(rand);
+		memcpy(group->ctime, now, 5);
+		memcpy(group->mtime, now, 5);
+		memcpy(group->atime, now, 5);
+		memset(group->etime, 0xff, 5);
+		group->level = i % depth;
+		db.groups[i] = group;
+	}
+
+	db.entries_len = n_groups * n_entries;
+	db.entries = calloc(db.entries_len + 1, sizeof(kpass_entry*));
+	for(i = 0; i < n_groups; i++) {
+		for(j = 0; j < n_entries; j++) {
+			entry = calloc(1, sizeof(kpass_entry));
+			random_bytes(rand, entry->uuid, sizeof(entry->uuid));
+			entry->group_id = i + 1;
+			entry->title = random_field(rand);
+			entry->url = random_field(rand);
+			entry->username = random_field(rand);
+			entry->password = random_field(rand);
+			entry->notes = random_field(rand);
+			entry->desc = strdup("");
+			memcpy(entry->ctime, now, 5);
+			memcpy(entry->mtime, now, 5);
+			memcpy(entry->atime, now, 5);
+			memset(entry->etime, 0xff, 5);
+			db.entries[i * n_entries + j] = entry;
+		}
+	}
+
+	kpass_hash_pw(password, pw_hash);
+	len = kpass_db_encrypted_len(&db);
+	buf = malloc(len);
+	if(kpass_encrypt_db(&db, pw_hash, buf)) {
+		fprintf(stderr, "%s: encrypting failed\n", g_get_prgname());
+		return 1;
+	}
+
+	out = fopen(argv[1], "wb");
+	if(!out || fwrite(buf, 1, len, out) != len || fclose(out)) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	printf("%s\t%d\t%d\t%d\n", argv[1], n_groups, db.entries_len, len);
+
+	free(buf);
+	kpass_free_db(&db);
+	g_rand_free(rand);
+	return 0;
+}
@@ -0,0 +1,74 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "aes.h"
+
+/* Times the KDB key transform on each backend this machine can run and
+ * prints rounds per second.  Usage: kdfbench [rounds] */
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(aes_backend backend, uint32_t rounds) {
+	uint8_t seed[32], key[32];
+	double start, elapsed;
+	int i;
+
+	for(i = 0; i < 32; i++) {
+		seed[i] = i;
+		key[i] = 255 - i;
+	}
+
+	start = now();
+	aes_transform(backend, seed, key, rounds);
+	elapsed = now() - start;
+
+	printf("%s\t%u\t%.3f\t%.0f\n", aes_backend_name(backend), rounds,
+			elapsed, rounds / elapsed);
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t rounds = 1000000;
+
+	if(argc > 1)
+		rounds = strtoul(argv[1], NULL, 10);
+	if(!rounds) {
+		fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+		return 2;
+	}
+
+	printf("backend\trounds\tseconds\trounds/s\n");
+	run(AES_PORTABLE, rounds);
+	if(aes_have_aesni())
+		run(AES_AESNI, rounds);
+	else
+		printf("aesni\tunavailable\n");
+
+	return 0;
+}
@@ -0,0 +1,174 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <kpass.h>
+
+#include "config.h"
+#include "db.h"
+#include "store.h"
+
+/* Loads a database the way load_db_to_ts() does, without a display, and
+ * prints how long each stage took as tab separated lines:
+ *
+ *   file  groups  entries  run  stage  seconds
+ *
+ * Every group is filled in, so build covers a row for each group and entry
+ * and rows per second is (groups + entries) / seconds.  Rows go into an
+ * unsorted store that is sorted once at the end, as load_done() does with
+ * the view detached.  --sorted keeps the store sorted all along instead,
+ * which is what every row cost before that, and reports build-sorted.
+ */
+
+static gint repeat = 1;
+static gchar *password = "bench";
+static gboolean sorted = FALSE;
+
+static GOptionEntry options[] =
+{
+  { "repeat", 'n', 0, G_OPTION_ARG_INT, &repeat,
+    "Number of runs (default: 1)", "N" },
+  { "password", 'p', 0, G_OPTION_ARG_STRING, &password,
+    "Master password (default: bench)", "PASS" },
+  { "sorted", 's', 0, G_OPTION_ARG_NONE, &sorted,
+    "Keep the store sorted while adding rows", NULL },
+  { NULL }
+};
+
+static void report(const char *filename, kpass_db *db, int run,
+		const char *stage, double seconds) {
+	printf("%s\t%d\t%d\t%d\t%s\t%.6f\n", filename, db->groups_len,
+			db->entries_len, run, stage, seconds);
+}
+
+/* Fill every group below parent, as expanding them all would */
+static void fill_all(GtkTreeStore *ts, GtkTreeIter *parent) {
+	GtkTreeIter iter;
+	gboolean valid;
+
+	valid = gtk_tree_model_iter_children(GTK_TREE_MODEL(ts), &iter,
+			parent);
+	while(valid) {
+		fill_group(ts, &iter);
+		fill_all(ts, &iter);
+		valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(ts), &iter);
+	}
+}
+
+static int bench_file(char *filename, int run) {
+	struct load_timing timing;
+	GtkTreeStore *ts;
+	GtkTreeIter iter;
+	intern_set *keys;
+	GTimer *timer;
+	struct db_file *file;
+	kpass_db *db;
+	uint8_t *pw_hash;
+	int retval;
+
+	pw_hash = malloc(PW_HASH_LEN);
+	retval = load_db(filename, password, pw_hash, &db, &timing);
+	if(retval) {
+		fprintf(stderr, "%s: %s\n", filename, retval > 0 ?
+				kpass_strerror(retval) : "cannot read file");
+		free(pw_hash);
+		return 1;
+	}
+
+	file = db_file_new(filename, pw_hash, db);
+	if(!file) {
+		fprintf(stderr, "%s: out of memory\n", filename);
+		kpass_free_db(db);
+		free(db);
+		free(pw_hash);
+		return 1;
+	}
+
+	report(filename, db, run, "read", timing.map);
+	report(filename, db, run, "init", timing.init);
+	report(filename, db, run, "hash", timing.hash);
+	report(filename, db, run, "decrypt", timing.decrypt);
+
+	ts = store_new();
+	if(!sorted)
+		gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(ts),
+				GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID,
+				GTK_SORT_ASCENDING);
+	add_file_to_store(filename, ts, &iter);
+
+	timer = g_timer_new();
+	add_groups_to_store(file, ts, &iter);
+	fill_all(ts, &iter);
+	report(filename, db, run, sorted ? "build-sorted" : "build",
+			g_timer_elapsed(timer, NULL));
+
+	if(!sorted) {
+		g_timer_start(timer);
+		store_set_sort(ts, SORTID_GROUPS_ON_TOP, GTK_SORT_ASCENDING);
+		report(filename, db, run, "sort", g_timer_elapsed(timer, NULL));
+	}
+	g_timer_destroy(timer);
+
+	gtk_tree_model_get(GTK_TREE_MODEL(ts), &iter,
+			TL_KEYS, &keys,
+			TL_DB_FILE, &file,
+			-1);
+	g_object_unref(ts);
+	intern_set_free(keys);
+	db_file_free(file);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	int i, run;
+
+	context = g_option_context_new("FILE...");
+	g_option_context_add_main_entries(context, options, NULL);
+	if(!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 2;
+	}
+	g_option_context_free(context);
+
+	if(argc < 2 || repeat < 1) {
+		fprintf(stderr, "usage: %s [OPTION...] FILE...\n",
+				g_get_prgname());
+		return 2;
+	}
+
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init();
+#endif
+
+	printf("file\tgroups\tentries\trun\tstage\tseconds\n");
+	for(i = 1; i < argc; i++)
+		for(run = 0; run < repeat; run++)
+			if(bench_file(argv[i], run))
+				return 1;
+
+	return 0;
+}
@@ -0,0 +1,398 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <kpass.h>
+
+#include "config.h"
+#include "db.h"
+#include "store.h"
+
+/* Builds group hierarchies in memory that no real vault has, expands every
+ * group of them in a tree store and checks each group and entry ended up
+ * under the right row.  Prints how long each stage took as tab separated
+ * lines:
+ *
+ *   shape  groups  entries  run  stage  seconds
+ *
+ * deep:  one chain of groups, each inside the one before
+ * wide:  every group at the top level
+ * jumps: levels that go down by up to five at a time and back up anywhere,
+ *        as files written by broken tools do
+ * vault: groups nested four deep with 100 entries each, as kdbgen makes,
+ *        at 1000 entries and doubling up to --vault.  Filling the tree
+ *        should cost the same per entry at every size.
+ *
+ * Every shape is reloaded unchanged between being built and expanded, the
+ * way the main window reloads a file that changed on disk, so expanding
+ * also checks the reloaded file's tree still finds its groups.
+ */
+
+static gint deep_groups = 10000;
+static gint wide_groups = 100000;
+static gint n_entries = 1;
+static gint vault_entries = 100000;
+static gint repeat = 1;
+
+static GOptionEntry options[] =
+{
+  { "deep", 'd', 0, G_OPTION_ARG_INT, &deep_groups,
+    "Groups in the deep chain (default: 10000)", "N" },
+  { "wide", 'w', 0, G_OPTION_ARG_INT, &wide_groups,
+    "Groups side by side (default: 100000)", "N" },
+  { "entries", 'e', 0, G_OPTION_ARG_INT, &n_entries,
+    "Entries in each deep, wide or jumps group (default: 1)", "N" },
+  { "vault", 'v', 0, G_OPTION_ARG_INT, &vault_entries,
+    "Entries in the largest vault (default: 100000)", "N" },
+  { "repeat", 'n', 0, G_OPTION_ARG_INT, &repeat,
+    "Number of runs (default: 1)", "N" },
+  { NULL }
+};
+
+enum {
+	SHAPE_DEEP,
+	SHAPE_WIDE,
+	SHAPE_JUMPS,
+	SHAPE_VAULT,
+};
+
+static const char *shape_names[] = { "deep", "wide", "jumps", "vault" };
+
+/* Like kdbgen's defaults */
+#define VAULT_DEPTH 4
+#define VAULT_PER_GROUP 100
+
+/* From malloc(), like everything kpass_free_db() frees */
+static char *numbered(const char *what, int i) {
+	char *s;
+
+	s = malloc(32);
+	snprintf(s, 32, "%s %d", what, i);
+	return s;
+}
+
+static kpass_db *make_db(int shape, int n_groups, int per_group,
+		GRand *rand) {
+	kpass_db *db;
+	kpass_group *group;
+	kpass_entry *entry;
+	int i, level = 0;
+
+	db = calloc(1, sizeof(kpass_db));
+	db->groups_len = n_groups;
+	db->groups = calloc(n_groups + 1, sizeof(kpass_group*));
+	for(i = 0; i < n_groups; i++) {
+		if(shape == SHAPE_DEEP)
+			level = i;
+		else if(shape == SHAPE_VAULT)
+			level = i % VAULT_DEPTH;
+		else if(shape == SHAPE_JUMPS && i)
+			level = g_rand_boolean(rand) ?
+				MIN(level + g_rand_int_range(rand, 1, 6),
+						G_MAXUINT16) :
+				g_rand_int_range(rand, 0, level + 1);
+
+		group = calloc(1, sizeof(kpass_group));
+		group->id = i + 1;
+		group->name = numbered("group", i);
+		group->level = level;
+		db->groups[i] = group;
+	}
+
+	db->entries_len = n_groups * per_group;
+	db->entries = calloc(db->entries_len + 1, sizeof(kpass_entry*));
+	for(i = 0; i < db->entries_len; i++) {
+		entry = calloc(1, sizeof(kpass_entry));
+		entry->group_id = i / per_group + 1;
+		entry->title = numbered("entry", i);
+		entry->url = strdup("");
+		entry->username = strdup("");
+		entry->password = strdup("");
+		entry->notes = strdup("");
+		entry->desc = strdup("");
+		db->entries[i] = entry;
+	}
+
+	return db;
+}
+
+/* Fill every group below the file row at iter, walking the rows in order
+ * without recursing.  Returns FALSE if a row isn't under the group it
+ * belongs in. */
+static gboolean expand_all(GtkTreeStore *ts, GtkTreeIter *iter,
+		kpass_db *db, int *groups, int *entries) {
+	GtkTreeModel *model = GTK_TREE_MODEL(ts);
+	GtkTreeIter row, next, up;
+	kpass_group *group, *parent;
+	kpass_entry *entry;
+	int *parents, i;
+	gpointer data;
+	guint type;
+	gboolean ok = TRUE;
+
+	parents = group_parents(db);
+	*groups = *entries = 0;
+	if(!parents)
+		return FALSE;
+	if(!gtk_tree_model_iter_children(model, &row, iter)) {
+		free(parents);
+		return TRUE;
+	}
+
+	for(;;) {
+		gtk_tree_model_get(model, &row,
+				TL_TYPE, &type,
+				TL_STRUCT, &data,
+				-1);
+
+		parent = NULL;
+		if(gtk_tree_model_iter_parent(model, &up, &row))
+			gtk_tree_model_get(model, &up, TL_STRUCT, &parent, -1);
+		if(parent == (gpointer)db)
+			parent = NULL;
+
+		if(type == TYPE_GROUP) {
+			group = data;
+			(*groups)++;
+			fill_group(ts, &row);
+			i = group->id - 1;
+			if(parent != (parents[i] < 0 ? NULL :
+						db->groups[parents[i]]))
+				ok = FALSE;
+		} else if(type == TYPE_ENTRY) {
+			entry = data;
+			(*entries)++;
+			if(!parent || parent->id != entry->group_id)
+				ok = FALSE;
+		}
+
+		/* Down if we can, otherwise along, otherwise back up until
+		 * there's somewhere to go along to */
+		if(gtk_tree_model_iter_children(model, &next, &row)) {
+			row = next;
+			continue;
+		}
+		for(;;) {
+			next = row;
+			if(gtk_tree_model_iter_next(model, &next))
+				break;
+			gtk_tree_model_iter_parent(model, &up, &row);
+			if(!gtk_tree_store_iter_depth(ts, &up))
+				goto expand_all_out;
+			row = up;
+		}
+		row = next;
+	}
+
+expand_all_out:
+	free(parents);
+	return ok;
+}
+
+/* Load the same database again with its tree built, as the load worker
+ * does, swap in the group structs the rows point at as reload_rows() does
+ * for groups that didn't change, and put it in place of old at iter.  The
+ * timer is started once the new database is made.  Returns the new file,
+ * or NULL with old left as it was if out of memory. */
+static struct db_file *reload(GtkTreeStore *ts, GtkTreeIter *iter,
+		struct db_file *old, int shape, int n_groups, int per_group,
+		int run, GTimer *timer) {
+	struct db_file *file;
+	kpass_group *group;
+	kpass_db *db;
+	uint8_t *pw_hash;
+	GRand *rand;
+	int i;
+
+	rand = g_rand_new_with_seed(run + 1);
+	db = make_db(shape, n_groups, per_group, rand);
+	g_rand_free(rand);
+
+	pw_hash = calloc(1, PW_HASH_LEN);
+	file = pw_hash ? db_file_new(old->filename, pw_hash, db) : NULL;
+	if(!file || !db_file_tree(file)) {
+		if(file) {
+			db_file_free(file);
+		} else {
+			kpass_free_db(db);
+			free(db);
+			free(pw_hash);
+		}
+		return NULL;
+	}
+
+	g_timer_start(timer);
+	for(i = 0; i < db->groups_len; i++) {
+		group = db->groups[i];
+		db->groups[i] = old->db->groups[i];
+		old->db->groups[i] = group;
+	}
+	db_tree_reindex(file->tree, db);
+
+	gtk_tree_store_set(ts, iter,
+			TL_STRUCT, db,
+			TL_DB_FILE, file,
+			-1);
+	db_file_free(old);
+	return file;
+}
+
+static void report(int shape, kpass_db *db, int run, const char *stage,
+		double seconds) {
+	printf("%s\t%d\t%d\t%d\t%s\t%.6f\n", shape_names[shape],
+			db->groups_len, db->entries_len, run, stage, seconds);
+}
+
+static int bench_shape(int shape, int n_groups, int per_group, int run) {
+	GtkTreeStore *ts;
+	GtkTreeIter iter;
+	intern_set *keys;
+	GTimer *timer;
+	GRand *rand;
+	struct db_file *file, *reloaded;
+	struct db_tree *tree;
+	kpass_db *db;
+	uint8_t *pw_hash;
+	int groups, entries;
+	gboolean ok = FALSE;
+
+	rand = g_rand_new_with_seed(run + 1);
+	db = make_db(shape, n_groups, per_group, rand);
+	g_rand_free(rand);
+
+	timer = g_timer_new();
+	tree = db_tree_new(db);
+	report(shape, db, run, "tree", g_timer_elapsed(timer, NULL));
+	if(tree)
+		db_tree_free(tree);
+
+	pw_hash = calloc(1, PW_HASH_LEN);
+	file = pw_hash ? db_file_new(shape_names[shape], pw_hash, db) : NULL;
+	if(!file) {
+		fprintf(stderr, "%s: out of memory\n", shape_names[shape]);
+		g_timer_destroy(timer);
+		kpass_free_db(db);
+		free(db);
+		free(pw_hash);
+		return 1;
+	}
+
+	ts = store_new();
+	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(ts),
+			GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID,
+			GTK_SORT_ASCENDING);
+	add_file_to_store((char*)shape_names[shape], ts, &iter);
+
+	g_timer_start(timer);
+	add_groups_to_store(file, ts, &iter);
+	report(shape, db, run, "build", g_timer_elapsed(timer, NULL));
+
+	reloaded = reload(ts, &iter, file, shape, n_groups, per_group, run,
+			timer);
+	if(!reloaded) {
+		fprintf(stderr, "%s: out of memory\n", shape_names[shape]);
+		g_timer_destroy(timer);
+		goto bench_shape_out;
+	}
+	db = reloaded->db;
+	report(shape, db, run, "reload", g_timer_elapsed(timer, NULL));
+
+	g_timer_start(timer);
+	ok = expand_all(ts, &iter, db, &groups, &entries);
+	report(shape, db, run, "expand", g_timer_elapsed(timer, NULL));
+
+	g_timer_start(timer);
+	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(ts),
+			SORTID_GROUPS_ON_TOP, GTK_SORT_ASCENDING);
+	report(shape, db, run, "sort", g_timer_elapsed(timer, NULL));
+	g_timer_destroy(timer);
+
+	if(!ok || groups != db->groups_len || entries != db->entries_len) {
+		fprintf(stderr, "%s: %d of %d groups and %d of %d entries "
+				"shown%s\n", shape_names[shape], groups,
+				db->groups_len, entries, db->entries_len,
+				ok ? "" : ", some in the wrong place");
+		ok = FALSE;
+	}
+
+bench_shape_out:
+	gtk_tree_model_get(GTK_TREE_MODEL(ts), &iter,
+			TL_KEYS, &keys,
+			TL_DB_FILE, &file,
+			-1);
+	g_object_unref(ts);
+	intern_set_free(keys);
+	db_file_free(file);
+	return !ok;
+}
+
+/* The vault shape at each size up to vault_entries */
+static int bench_vaults(int run) {
+	int size;
+
+	for(size = 1000; size < vault_entries; size *= 2)
+		if(bench_shape(SHAPE_VAULT, size / VAULT_PER_GROUP,
+					VAULT_PER_GROUP, run))
+			return 1;
+	return bench_shape(SHAPE_VAULT, vault_entries / VAULT_PER_GROUP,
+			VAULT_PER_GROUP, run);
+}
+
+int main(int argc, char *argv[]) {
+	GOptionContext *context;
+	GError *error = NULL;
+	int run;
+
+	context = g_option_context_new("");
+	g_option_context_add_main_entries(context, options, NULL);
+	if(!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 2;
+	}
+	g_option_context_free(context);
+
+	if(argc != 1 || deep_groups < 1 || deep_groups > G_MAXUINT16 + 1 ||
+			wide_groups < 1 || n_entries < 0 ||
+			vault_entries < VAULT_PER_GROUP || repeat < 1) {
+		fprintf(stderr, "usage: %s [OPTION...]\n", g_get_prgname());
+		return 2;
+	}
+
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init();
+#endif
+
+	printf("shape\tgroups\tentries\trun\tstage\tseconds\n");
+	for(run = 0; run < repeat; run++)
+		if(bench_shape(SHAPE_DEEP, deep_groups, n_entries, run) ||
+				bench_shape(SHAPE_WIDE, wide_groups, n_entries,
+					run) ||
+				bench_shape(SHAPE_JUMPS, deep_groups, n_entries,
+					run) ||
+				bench_vaults(run))
+			return 1;
+
+	return 0;
+}
@@ -0,0 +1,366 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <string.h>
+
+#include "config.h"
+#include "aes.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AESNI 1
+#include <cpuid.h>
+#include <wmmintrin.h>
+#endif
+
+static const uint8_t sbox[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
+	0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+	0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc,
+	0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a,
+	0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+	0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
+	0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85,
+	0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+	0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17,
+	0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
+	0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+	0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9,
+	0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6,
+	0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+	0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94,
+	0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68,
+	0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+/* Portable AES-256.  Only used when the CPU can't do better, so it favours
+ * clarity over speed. */
+
+#define XTIME(x) ((uint8_t)(((x) << 1) ^ (((x) & 0x80) ? 0x1b : 0)))
+
+static void expand_key(const uint8_t key[32], uint8_t rk[240]) {
+	uint8_t t[4], tmp, rcon = 1;
+	int i;
+
+	memcpy(rk, key, 32);
+	for(i = 32; i < 240; i += 4) {
+		memcpy(t, rk + i - 4, 4);
+		if(i % 32 == 0) {
+			tmp = t[0];
+			t[0] = sbox[t[1]] ^ rcon;
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[tmp];
+			rcon = XTIME(rcon);
+		} else if(i % 32 == 16) {
+			t[0] = sbox[t[0]];
+			t[1] = sbox[t[1]];
+			t[2] = sbox[t[2]];
+			t[3] = sbox[t[3]];
+		}
+		rk[i] = rk[i - 32] ^ t[0];
+		rk[i + 1] = rk[i - 31] ^ t[1];
+		rk[i + 2] = rk[i - 30] ^ t[2];
+		rk[i + 3] = rk[i - 29] ^ t[3];
+	}
+}
+
+static void encrypt_block(const uint8_t rk[240], uint8_t s[16]) {
+	uint8_t t[16], a, b, c, d, e;
+	int round, i;
+
+	for(i = 0; i < 16; i++)
+		s[i] ^= rk[i];
+
+	for(round = 1; round <= 14; round++) {
+		/* SubBytes and ShiftRows together */
+		for(i = 0; i < 16; i++)
+			t[i] = sbox[s[(i + 4 * (i % 4)) % 16]];
+
+		/* MixColumns, skipped in the last round */
+		if(round < 14) {
+			for(i = 0; i < 16; i += 4) {
+				a = t[i];
+				b = t[i + 1];
+				c = t[i + 2];
+				d = t[i + 3];
+				e = a ^ b ^ c ^ d;
+				t[i] ^= e ^ XTIME(a ^ b);
+				t[i + 1] ^= e ^ XTIME(b ^ c);
+				t[i + 2] ^= e ^ XTIME(c ^ d);
+				t[i + 3] ^= e ^ XTIME(d ^ a);
+			}
+		}
+
+		for(i = 0; i < 16; i++)
+			s[i] = t[i] ^ rk[round * 16 + i];
+	}
+}
+
+static void decrypt_block(const uint8_t rk[240], const uint8_t inv[256],
+		uint8_t s[16]) {
+	uint8_t t[16], a, b, c, d, e, u, v;
+	int round, i;
+
+	for(i = 0; i < 16; i++)
+		s[i] ^= rk[14 * 16 + i];
+
+	for(round = 13; round >= 0; round--) {
+		/* InvShiftRows and InvSubBytes together */
+		for(i = 0; i < 16; i++)
+			t[i] = inv[s[(i + 16 - 4 * (i % 4)) % 16]];
+
+		for(i = 0; i < 16; i++)
+			s[i] = t[i] ^ rk[round * 16 + i];
+
+		if(!round)
+			break;
+
+		/* InvMixColumns, as a premultiply followed by MixColumns */
+		for(i = 0; i < 16; i += 4) {
+			u = XTIME(XTIME(s[i] ^ s[i + 2]));
+			v = XTIME(XTIME(s[i + 1] ^ s[i + 3]));
+			s[i] ^= u;
+			s[i + 1] ^= v;
+			s[i + 2] ^= u;
+			s[i + 3] ^= v;
+
+			a = s[i];
+			b = s[i + 1];
+			c = s[i + 2];
+			d = s[i + 3];
+			e = a ^ b ^ c ^ d;
+			s[i] ^= e ^ XTIME(a ^ b);
+			s[i + 1] ^= e ^ XTIME(b ^ c);
+			s[i + 2] ^= e ^ XTIME(c ^ d);
+			s[i + 3] ^= e ^ XTIME(d ^ a);
+		}
+	}
+}
+
+static void portable_cbc_decrypt(const uint8_t key[32], uint8_t iv[16],
+		uint8_t *data, size_t len) {
+	uint8_t rk[240], inv[256], prev[16], block[16];
+	size_t off;
+	int i;
+
+	expand_key(key, rk);
+	for(i = 0; i < 256; i++)
+		inv[sbox[i]] = i;
+
+	memcpy(prev, iv, 16);
+	for(off = 0; off + 16 <= len; off += 16) {
+		memcpy(block, data + off, 16);
+		decrypt_block(rk, inv, data + off);
+		for(i = 0; i < 16; i++)
+			data[off + i] ^= prev[i];
+		memcpy(prev, block, 16);
+	}
+	memcpy(iv, prev, 16);
+
+	memset(rk, 0, sizeof(rk));
+}
+
+static void portable_transform(const uint8_t seed[32], uint8_t key[32],
+		uint32_t rounds) {
+	uint8_t rk[240];
+	uint32_t r;
+
+	expand_key(seed, rk);
+	for(r = 0; r < rounds; r++) {
+		encrypt_block(rk, key);
+		encrypt_block(rk, key + 16);
+	}
+	memset(rk, 0, sizeof(rk));
+}
+
+#ifdef HAVE_AESNI
+
+#define AESNI __attribute__((target("aes,sse2")))
+
+static AESNI __m128i expand_assist_1(__m128i t1, __m128i t2) {
+	__m128i t4;
+
+	t2 = _mm_shuffle_epi32(t2, 0xff);
+	t4 = _mm_slli_si128(t1, 4);
+	t1 = _mm_xor_si128(t1, t4);
+	t4 = _mm_slli_si128(t4, 4);
+	t1 = _mm_xor_si128(t1, t4);
+	t4 = _mm_slli_si128(t4, 4);
+	t1 = _mm_xor_si128(t1, t4);
+	return _mm_xor_si128(t1, t2);
+}
+
+static AESNI __m128i expand_assist_2(__m128i t1, __m128i t3) {
+	__m128i t2, t4;
+
+	t4 = _mm_aeskeygenassist_si128(t1, 0x00);
+	t2 = _mm_shuffle_epi32(t4, 0xaa);
+	t4 = _mm_slli_si128(t3, 4);
+	t3 = _mm_xor_si128(t3, t4);
+	t4 = _mm_slli_si128(t4, 4);
+	t3 = _mm_xor_si128(t3, t4);
+	t4 = _mm_slli_si128(t4, 4);
+	t3 = _mm_xor_si128(t3, t4);
+	return _mm_xor_si128(t3, t2);
+}
+
+#define EXPAND_ROUND(i, rcon) \
+	t1 = expand_assist_1(t1, _mm_aeskeygenassist_si128(t3, rcon)); \
+	rk[i] = t1; \
+	if(i < 14) { \
+		t3 = expand_assist_2(t1, t3); \
+		rk[i + 1] = t3; \
+	}
+
+static AESNI void aesni_expand_key(const uint8_t key[32], __m128i rk[15]) {
+	__m128i t1, t3;
+
+	t1 = _mm_loadu_si128((const __m128i*)key);
+	t3 = _mm_loadu_si128((const __m128i*)(key + 16));
+	rk[0] = t1;
+	rk[1] = t3;
+	EXPAND_ROUND(2, 0x01);
+	EXPAND_ROUND(4, 0x02);
+	EXPAND_ROUND(6, 0x04);
+	EXPAND_ROUND(8, 0x08);
+	EXPAND_ROUND(10, 0x10);
+	EXPAND_ROUND(12, 0x20);
+	EXPAND_ROUND(14, 0x40);
+}
+
+/* Both halves go through each round together, so one half's aesenc runs
+ * while the other's is still in the pipeline */
+static AESNI void aesni_transform(const uint8_t seed[32], uint8_t key[32],
+		uint32_t rounds) {
+	__m128i rk[15], a, b;
+	uint32_t r;
+	int i;
+
+	aesni_expand_key(seed, rk);
+	a = _mm_loadu_si128((const __m128i*)key);
+	b = _mm_loadu_si128((const __m128i*)(key + 16));
+
+	for(r = 0; r < rounds; r++) {
+		a = _mm_xor_si128(a, rk[0]);
+		b = _mm_xor_si128(b, rk[0]);
+		for(i = 1; i < 14; i++) {
+			a = _mm_aesenc_si128(a, rk[i]);
+			b = _mm_aesenc_si128(b, rk[i]);
+		}
+		a = _mm_aesenclast_si128(a, rk[14]);
+		b = _mm_aesenclast_si128(b, rk[14]);
+	}
+
+	_mm_storeu_si128((__m128i*)key, a);
+	_mm_storeu_si128((__m128i*)(key + 16), b);
+	memset(rk, 0, sizeof(rk));
+}
+
+static AESNI void aesni_cbc_decrypt(const uint8_t key[32],
+		uint8_t iv[16], uint8_t *data, size_t len) {
+	__m128i rk[15], dk[15], prev, block, x;
+	size_t off;
+	int i;
+
+	aesni_expand_key(key, rk);
+	dk[0] = rk[14];
+	for(i = 1; i < 14; i++)
+		dk[i] = _mm_aesimc_si128(rk[14 - i]);
+	dk[14] = rk[0];
+
+	prev = _mm_loadu_si128((const __m128i*)iv);
+	for(off = 0; off + 16 <= len; off += 16) {
+		block = _mm_loadu_si128((const __m128i*)(data + off));
+		x = _mm_xor_si128(block, dk[0]);
+		for(i = 1; i < 14; i++)
+			x = _mm_aesdec_si128(x, dk[i]);
+		x = _mm_aesdeclast_si128(x, dk[14]);
+		_mm_storeu_si128((__m128i*)(data + off),
+				_mm_xor_si128(x, prev));
+		prev = block;
+	}
+	_mm_storeu_si128((__m128i*)iv, prev);
+
+	memset(rk, 0, sizeof(rk));
+	memset(dk, 0, sizeof(dk));
+}
+
+#endif
+
+int aes_have_aesni(void) {
+#ifdef HAVE_AESNI
+	unsigned int eax, ebx, ecx, edx;
+
+	if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+	return (ecx & bit_AES) != 0;
+#else
+	return 0;
+#endif
+}
+
+const char *aes_backend_name(aes_backend backend) {
+	switch(backend) {
+		case AES_AESNI:
+			return "aesni";
+		case AES_PORTABLE:
+		default:
+			return "portable";
+	}
+}
+
+void aes_transform(aes_backend backend, const uint8_t seed[32],
+		uint8_t key[32], uint32_t rounds) {
+#ifdef HAVE_AESNI
+	if(backend == AES_AESNI && aes_have_aesni()) {
+		aesni_transform(seed, key, rounds);
+		return;
+	}
+#endif
+	portable_transform(seed, key, rounds);
+}
+
+int aes_cbc_decrypt(const uint8_t key[32], uint8_t iv[16],
+		uint8_t *data, size_t len) {
+	if(len % 16)
+		return -1;
+#ifdef HAVE_AESNI
+	if(aes_have_aesni()) {
+		aesni_cbc_decrypt(key, iv, data, len);
+		return 0;
+	}
+#endif
+	portable_cbc_decrypt(key, iv, data, len);
+	return 0;
+}
@@ -0,0 +1,58 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GTKPASS_AES_H
+#define GTKPASS_AES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Ways of running the KDB key transformation */
+typedef enum {
+	AES_PORTABLE,
+	AES_AESNI,
+} aes_backend;
+
+/* Non-zero if this CPU has the AES instructions and we were built with
+ * support for them */
+int aes_have_aesni(void);
+
+const char *aes_backend_name(aes_backend backend);
+
+/* The KDB key transformation: encrypt both 16 byte halves of key with
+ * AES-256 under seed, rounds times, in place.  The halves don't depend on
+ * each other, so both backends run them side by side. */
+void aes_transform(aes_backend backend, const uint8_t seed[32],
+		uint8_t key[32], uint32_t rounds);
+
+/* What aes_transform() and the SHA-256 after it make of a key, which is
+ * the slow part of opening a database and only depends on the key, seed
+ * and rounds.  valid is set once key holds one. */
+struct transformed_key {
+	uint8_t key[32];
+	int valid;
+};
+
+/* AES-256-CBC decrypt len bytes of data in place, on AES-NI if there is
+ * one.  iv is left holding the last block of ciphertext, so a long message
+ * can be decrypted a piece at a time.  Returns -1 if len isn't a multiple
+ * of 16. */
+int aes_cbc_decrypt(const uint8_t key[32], uint8_t iv[16],
+		uint8_t *data, size_t len);
+
+#endif
@@ -0,0 +1,417 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* The unlock agent keeps password hashes for recently opened files in
+ * locked memory and hands them out over a Unix socket only reachable by
+ * the same user, so repeat opens don't have to ask again.
+ *
+ * One request per connection, one line each way:
+ *   GET <name>          -> OK <hex> | NO
+ *   PUT <hex> <name>    -> OK | NO
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "agent.h"
+
+#define AGENT_SLOTS 128
+#define AGENT_NAME_MAX 512
+#define AGENT_LINE_MAX (AGENT_NAME_MAX + 2 * AGENT_VALUE_MAX + 16)
+#define AGENT_DEFAULT_TTL 300
+
+struct agent_slot {
+	char name[AGENT_NAME_MAX];
+	uint8_t value[AGENT_VALUE_MAX];
+	size_t len;
+	time_t expires;
+};
+
+static volatile sig_atomic_t agent_quit;
+
+int agent_wanted(int argc, char **argv) {
+	int i;
+
+	for(i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--"))
+			break;
+		if(!strcmp(argv[i], "--agent"))
+			return 1;
+	}
+	return 0;
+}
+
+/* $GTKPASS_AGENT_SOCK, or a socket in a directory only we can get into */
+static int agent_socket_path(char *path, size_t size) {
+	const char *env;
+	char dir[PATH_MAX];
+	struct stat sb;
+
+	if((env = getenv("GTKPASS_AGENT_SOCK")) && *env) {
+		snprintf(path, size, "%s", env);
+		return 0;
+	}
+
+	if((env = getenv("XDG_RUNTIME_DIR")) && *env) {
+		snprintf(path, size, "%s/gtkpass-agent", env);
+		return 0;
+	}
+
+	snprintf(dir, sizeof(dir), "/tmp/gtkpass-%u", (unsigned)getuid());
+	if(mkdir(dir, 0700) == -1 && errno != EEXIST)
+		return -1;
+	if(lstat(dir, &sb) == -1 || !S_ISDIR(sb.st_mode) ||
+			sb.st_uid != getuid() || (sb.st_mode & 077))
+		return -1;
+
+	snprintf(path, size, "%s/agent", dir);
+	return 0;
+}
+
+static int agent_connect(void) {
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(agent_socket_path(addr.sun_path, sizeof(addr.sun_path)))
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd == -1)
+		return -1;
+
+	if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Read one newline terminated line, dropping the newline */
+static int read_line(int fd, char *buf, size_t size) {
+	size_t len = 0;
+	ssize_t r;
+
+	while(len < size - 1) {
+		r = read(fd, buf + len, 1);
+		if(r == -1 && errno == EINTR)
+			continue;
+		if(r <= 0)
+			return -1;
+		if(buf[len] == '\n') {
+			buf[len] = '\0';
+			return len;
+		}
+		len++;
+	}
+	return -1;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+	ssize_t w;
+
+	while(len > 0) {
+		w = write(fd, buf, len);
+		if(w == -1 && errno == EINTR)
+			continue;
+		if(w <= 0)
+			return -1;
+		buf += w;
+		len -= w;
+	}
+	return 0;
+}
+
+static void to_hex(const uint8_t *value, size_t len, char *hex) {
+	static const char digits[] = "0123456789abcdef";
+	size_t i;
+
+	for(i = 0; i < len; i++) {
+		hex[i * 2] = digits[value[i] >> 4];
+		hex[i * 2 + 1] = digits[value[i] & 0xf];
+	}
+	hex[len * 2] = '\0';
+}
+
+static int from_hex(const char *hex, uint8_t *value, size_t max) {
+	size_t i;
+	unsigned int byte;
+
+	for(i = 0; hex[i * 2] && hex[i * 2] != ' '; i++) {
+		if(i >= max || !hex[i * 2 + 1] ||
+				sscanf(hex + i * 2, "%2x", &byte) != 1)
+			return -1;
+		value[i] = byte;
+	}
+	return i;
+}
+
+int agent_get(const char *name, uint8_t *value, size_t len) {
+	char line[AGENT_LINE_MAX];
+	int fd, ret = -1;
+
+	if(strlen(name) >= AGENT_NAME_MAX || len > AGENT_VALUE_MAX)
+		return -1;
+
+	fd = agent_connect();
+	if(fd == -1)
+		return -1;
+
+	snprintf(line, sizeof(line), "GET %s\n", name);
+	if(write_all(fd, line, strlen(line)) == 0 &&
+			read_line(fd, line, sizeof(line)) > 0 &&
+			!strncmp(line, "OK ", 3) &&
+			from_hex(line + 3, value, len) == (int)len)
+		ret = 0;
+
+	memset(line, 0, sizeof(line));
+	close(fd);
+	return ret;
+}
+
+void agent_put(const char *name, const uint8_t *value, size_t len) {
+	char line[AGENT_LINE_MAX];
+	char hex[AGENT_VALUE_MAX * 2 + 1];
+	int fd;
+
+	if(strlen(name) >= AGENT_NAME_MAX || len > AGENT_VALUE_MAX)
+		return;
+
+	fd = agent_connect();
+	if(fd == -1)
+		return;
+
+	to_hex(value, len, hex);
+	snprintf(line, sizeof(line), "PUT %s %s\n", hex, name);
+	if(write_all(fd, line, strlen(line)) == 0)
+		read_line(fd, hex, sizeof(hex));
+
+	memset(hex, 0, sizeof(hex));
+	memset(line, 0, sizeof(line));
+	close(fd);
+}
+
+char *agent_hash_name(const char *filename) {
+	char *real, *name;
+
+	real = realpath(filename, NULL);
+	if(!real)
+		return NULL;
+
+	name = malloc(strlen(real) + sizeof("pw_hash:"));
+	strcpy(name, "pw_hash:");
+	strcat(name, real);
+	free(real);
+	return name;
+}
+
+static void agent_signal(int sig) {
+	agent_quit = 1;
+}
+
+static void expire_slots(struct agent_slot *slots, time_t now) {
+	int i;
+
+	for(i = 0; i < AGENT_SLOTS; i++)
+		if(slots[i].name[0] && slots[i].expires <= now)
+			memset(&slots[i], 0, sizeof(slots[i]));
+}
+
+static struct agent_slot *find_slot(struct agent_slot *slots,
+		const char *name) {
+	int i;
+
+	for(i = 0; i < AGENT_SLOTS; i++)
+		if(slots[i].name[0] && !strcmp(slots[i].name, name))
+			return &slots[i];
+	return NULL;
+}
+
+/* Somewhere to put name: its old slot, a free one, or the one closest to
+ * expiring */
+static struct agent_slot *claim_slot(struct agent_slot *slots,
+		const char *name) {
+	struct agent_slot *slot;
+	int i;
+
+	if((slot = find_slot(slots, name)))
+		return slot;
+
+	slot = &slots[0];
+	for(i = 0; i < AGENT_SLOTS; i++) {
+		if(!slots[i].name[0])
+			return &slots[i];
+		if(slots[i].expires < slot->expires)
+			slot = &slots[i];
+	}
+	return slot;
+}
+
+static void handle_client(int fd, struct agent_slot *slots, int ttl) {
+	char line[AGENT_LINE_MAX];
+	char hex[AGENT_VALUE_MAX * 2 + 1];
+	struct agent_slot *slot;
+	uint8_t value[AGENT_VALUE_MAX];
+	const char *reply = "NO\n";
+	struct timeval timeout = { 1, 0 };
+	char *name;
+	int len;
+#ifdef SO_PEERCRED
+	struct ucred cred;
+	socklen_t cred_len = sizeof(cred);
+
+	/* The socket directory should already keep others out */
+	if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == -1 ||
+			cred.uid != getuid())
+		return;
+#endif
+
+	/* Don't let a client that never talks hold everyone else up */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	if(read_line(fd, line, sizeof(line)) <= 0)
+		return;
+
+	if(!strncmp(line, "GET ", 4)) {
+		slot = find_slot(slots, line + 4);
+		if(slot && slot->expires > time(NULL)) {
+			to_hex(slot->value, slot->len, hex);
+			write_all(fd, "OK ", 3);
+			write_all(fd, hex, strlen(hex));
+			memset(hex, 0, sizeof(hex));
+			reply = "\n";
+		}
+	} else if(!strncmp(line, "PUT ", 4) &&
+			(name = strchr(line + 4, ' ')) &&
+			strlen(name + 1) < AGENT_NAME_MAX &&
+			(len = from_hex(line + 4, value, sizeof(value))) > 0) {
+		slot = claim_slot(slots, name + 1);
+		strcpy(slot->name, name + 1);
+		memcpy(slot->value, value, len);
+		slot->len = len;
+		slot->expires = time(NULL) + ttl;
+		memset(value, 0, sizeof(value));
+		reply = "OK\n";
+	}
+
+	memset(line, 0, sizeof(line));
+	write_all(fd, reply, strlen(reply));
+}
+
+int agent_main(int argc, char **argv) {
+	struct sockaddr_un addr;
+	struct agent_slot *slots;
+	struct pollfd pfd;
+	int fd, client, i;
+	int ttl = AGENT_DEFAULT_TTL;
+
+	for(i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--ttl") && i + 1 < argc)
+			ttl = atoi(argv[++i]);
+		else if(!strncmp(argv[i], "--ttl=", 6))
+			ttl = atoi(argv[i] + 6);
+		else if(strcmp(argv[i], "--agent")) {
+			fprintf(stderr, "usage: %s --agent [--ttl SECONDS]\n",
+					argv[0]);
+			return 2;
+		}
+	}
+	if(ttl <= 0) {
+		fprintf(stderr, "--ttl must be a positive number of seconds\n");
+		return 2;
+	}
+
+	/* Keep the cache out of swap and core dumps */
+	slots = mmap(NULL, sizeof(struct agent_slot) * AGENT_SLOTS,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+			-1, 0);
+	if(slots == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	if(mlock(slots, sizeof(struct agent_slot) * AGENT_SLOTS) == -1)
+		fprintf(stderr, "warning: can't lock agent memory: %s\n",
+				strerror(errno));
+#ifdef MADV_DONTDUMP
+	madvise(slots, sizeof(struct agent_slot) * AGENT_SLOTS,
+			MADV_DONTDUMP);
+#endif
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(agent_socket_path(addr.sun_path, sizeof(addr.sun_path))) {
+		fprintf(stderr, "no safe place for the agent socket\n");
+		return 1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd == -1) {
+		perror("socket");
+		return 1;
+	}
+
+	unlink(addr.sun_path);
+	umask(077);
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+			listen(fd, 16) == -1) {
+		fprintf(stderr, "%s: %s\n", addr.sun_path, strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	signal(SIGINT, agent_signal);
+	signal(SIGTERM, agent_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while(!agent_quit) {
+		expire_slots(slots, time(NULL));
+		if(poll(&pfd, 1, 1000) <= 0)
+			continue;
+
+		client = accept(fd, NULL, NULL);
+		if(client == -1)
+			continue;
+		handle_client(client, slots, ttl);
+		close(client);
+	}
+
+	memset(slots, 0, sizeof(struct agent_slot) * AGENT_SLOTS);
+	munmap(slots, sizeof(struct agent_slot) * AGENT_SLOTS);
+	close(fd);
+	unlink(addr.sun_path);
+	return 0;
+}
@@ -0,0 +1,44 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GTKPASS_AGENT_H
+#define GTKPASS_AGENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Largest value the agent will hold for a name */
+#define AGENT_VALUE_MAX 64
+
+/* Non-zero if the command line asks to run the agent */
+int agent_wanted(int argc, char **argv);
+
+/* Run the agent in the foreground until killed.  Returns the process exit
+ * status. */
+int agent_main(int argc, char **argv);
+
+/* Client side.  Both quietly do nothing if no agent is running.
+ * agent_get() returns 0 and fills in value if the agent holds exactly len
+ * bytes for name. */
+int agent_get(const char *name, uint8_t *value, size_t len);
+void agent_put(const char *name, const uint8_t *value, size_t len);
+
+/* The name a file's password hash is cached under, newly allocated */
+char *agent_hash_name(const char *filename);
+
+#endif
@@ -0,0 +1,119 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <kpass.h>
+
+#include "config.h"
+#include "audit.h"
+
+int password_bits(const char *password) {
+	const char *p;
+	gunichar c;
+	int lower = 0, upper = 0, digit = 0, symbol = 0, other = 0;
+	int pool, len = 0;
+
+	if(!g_utf8_validate(password, -1, NULL)) {
+		/* Treat it as bytes */
+		len = strlen(password);
+		return len * 8;
+	}
+
+	for(p = password; *p; p = g_utf8_next_char(p)) {
+		c = g_utf8_get_char(p);
+		if(c >= 'a' && c <= 'z')
+			lower = 1;
+		else if(c >= 'A' && c <= 'Z')
+			upper = 1;
+		else if(c >= '0' && c <= '9')
+			digit = 1;
+		else if(c < 128)
+			symbol = 1;
+		else
+			other = 1;
+		len++;
+	}
+
+	pool = lower * 26 + upper * 26 + digit * 10 + symbol * 33 +
+		other * 100;
+	if(!pool)
+		return 0;
+	return (int)(len * log2(pool));
+}
+
+void audit_items(struct audit_item *items, int count, time_t now) {
+	struct audit_item *item;
+	struct tm tms;
+	GChecksum *sum;
+	gsize len;
+	int i;
+
+	for(i = 0; i < count; i++) {
+		item = &items[i];
+
+		sum = g_checksum_new(G_CHECKSUM_SHA256);
+		if(item->password)
+			g_checksum_update(sum, (const guchar*)item->password,
+					strlen(item->password));
+		len = sizeof(item->digest);
+		g_checksum_get_digest(sum, item->digest, &len);
+		g_checksum_free(sum);
+
+		if(!item->password || !*item->password) {
+			item->flags |= AUDIT_EMPTY;
+			item->bits = 0;
+		} else {
+			item->bits = password_bits(item->password);
+			if(item->bits < AUDIT_WEAK_BITS)
+				item->flags |= AUDIT_WEAK;
+		}
+
+		memset(&tms, 0, sizeof(tms));
+		kpass_unpack_time(item->mtime, &tms);
+		tms.tm_isdst = -1;
+		item->age_days = (now - mktime(&tms)) / (24 * 60 * 60);
+		if(item->age_days > AUDIT_OLD_DAYS)
+			item->flags |= AUDIT_OLD;
+
+		if(item->password) {
+			memset(item->password, 0, strlen(item->password));
+			g_free(item->password);
+			item->password = NULL;
+		}
+	}
+}
+
+void audit_items_free(struct audit_item *items, int count) {
+	int i;
+
+	for(i = 0; i < count; i++) {
+		g_free(items[i].title);
+		g_free(items[i].username);
+		if(items[i].password) {
+			memset(items[i].password, 0,
+					strlen(items[i].password));
+			g_free(items[i].password);
+		}
+	}
+	g_free(items);
+}
@@ -0,0 +1,65 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GTKPASS_AUDIT_H
+#define GTKPASS_AUDIT_H
+
+#include <stdint.h>
+#include <time.h>
+
+/* Problems audit_items() finds with a password */
+enum {
+	AUDIT_EMPTY = 1 << 0,
+	AUDIT_WEAK = 1 << 1,
+	AUDIT_OLD = 1 << 2,
+	AUDIT_REUSED = 1 << 3,	/* Left to the caller, who sees them all */
+};
+
+/* Below this many bits a password counts as weak */
+#define AUDIT_WEAK_BITS 60
+
+/* Passwords unchanged for longer than this count as old */
+#define AUDIT_OLD_DAYS 365
+
+/* One entry to audit.  The caller fills in the first part from a copy of
+ * the entry, so the database can change while the audit runs. */
+struct audit_item {
+	const char *file;
+	char *title;
+	char *username;
+	char *password;
+	uint8_t mtime[5];
+
+	uint8_t digest[32];
+	int bits;
+	int age_days;
+	int flags;
+};
+
+/* Rough strength of a password: its length times the bits each character
+ * would take if drawn at random from the classes it uses */
+int password_bits(const char *password);
+
+/* Audit count items as of now, then wipe and free their passwords.  Doesn't
+ * touch GTK, so chunks of a large audit can run on separate threads. */
+void audit_items(struct audit_item *items, int count, time_t now);
+
+/* Free the copies made for items */
+void audit_items_free(struct audit_item *items, int count);
+
+#endif
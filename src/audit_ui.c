@@ -0,0 +1,471 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtk/gtk.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <kpass.h>
+
+#include "config.h"
+#include "db.h"
+#include "store.h"
+#include "audit.h"
+#include "audit_ui.h"
+#include "ui.h"
+
+/* Rows of the audit list */
+enum {
+	AL_FILE,
+	AL_TITLE,
+	AL_USERNAME,
+	AL_BITS,
+	AL_AGE,
+	AL_REUSED,
+	AL_FLAGS,
+	AL_ISSUES,
+};
+
+/* What the audit window shows, picked from its combo box */
+enum {
+	AUDIT_SHOW_PROBLEMS,
+	AUDIT_SHOW_REUSED,
+	AUDIT_SHOW_WEAK,
+	AUDIT_SHOW_OLD,
+	AUDIT_SHOW_ALL,
+};
+
+/* Entries handed to an audit worker at a time */
+#define AUDIT_CHUNK 1024
+
+/* An audit of every open file, its chunks spread over the audit pool.  The
+ * chunks come back to the main loop one by one, which is also where reuse
+ * is counted.  Closing the window cancels it; the last chunk back frees
+ * it. */
+struct audit_run {
+	GtkListStore *list;
+	GtkTreeModel *filter;
+	GtkWidget *status;
+	GPtrArray *files;
+	/* Password digest -> struct audit_digest */
+	GHashTable *digests;
+	int show;
+	int pending;
+	int total;
+	int done;
+	int weak;
+	int old;
+	int reused;
+	gboolean closed;
+	volatile gint cancelled;
+	GTimer *timer;
+	time_t now;
+};
+
+struct audit_chunk {
+	struct audit_run *run;
+	struct audit_item *items;
+	int count;
+};
+
+/* Rows sharing a password */
+struct audit_digest {
+	int count;
+	GSList *rows;
+};
+
+static GThreadPool *audit_pool;
+
+/* Audits still running or with their window open, main loop only */
+static GSList *audit_runs;
+
+static gboolean audit_done(gpointer data);
+
+static void audit_worker(gpointer data, gpointer user_data) {
+	struct audit_chunk *chunk = data;
+
+	if(!g_atomic_int_get(&chunk->run->cancelled))
+		audit_items(chunk->items, chunk->count, chunk->run->now);
+
+	g_idle_add(audit_done, chunk);
+}
+
+static guint digest_hash(gconstpointer key) {
+	guint hash;
+
+	/* It's already a SHA-256 */
+	memcpy(&hash, key, sizeof(hash));
+	return hash;
+}
+
+static gboolean digest_equal(gconstpointer a, gconstpointer b) {
+	return !memcmp(a, b, 32);
+}
+
+static void free_audit_digest(gpointer data) {
+	struct audit_digest *digest = data;
+
+	g_slist_foreach(digest->rows, (GFunc)gtk_tree_iter_free, NULL);
+	g_slist_free(digest->rows);
+	g_free(digest);
+}
+
+static void free_audit_run(struct audit_run *run) {
+	audit_runs = g_slist_remove(audit_runs, run);
+	g_hash_table_destroy(run->digests);
+	g_ptr_array_foreach(run->files, (GFunc)g_free, NULL);
+	g_ptr_array_free(run->files, TRUE);
+	g_object_unref(run->filter);
+	g_object_unref(run->list);
+	g_timer_destroy(run->timer);
+	g_free(run);
+}
+
+/* Fill in the columns that depend on the flags of the audit row at iter */
+static void set_audit_flags(GtkListStore *list, GtkTreeIter *iter, int flags,
+		int reused) {
+	GString *issues;
+
+	issues = g_string_new(NULL);
+	if(flags & AUDIT_EMPTY)
+		g_string_append(issues, "empty, ");
+	if(flags & AUDIT_REUSED)
+		g_string_append(issues, "reused, ");
+	if(flags & AUDIT_WEAK)
+		g_string_append(issues, "weak, ");
+	if(flags & AUDIT_OLD)
+		g_string_append(issues, "old, ");
+	if(issues->len)
+		g_string_truncate(issues, issues->len - 2);
+
+	gtk_list_store_set(list, iter,
+			AL_FLAGS, flags,
+			AL_REUSED, reused,
+			AL_ISSUES, issues->str,
+			-1);
+	g_string_free(issues, TRUE);
+}
+
+/* Count a password seen on the audit row at iter, flagging every row
+ * with it once it's been seen twice */
+static void count_digest(struct audit_run *run, GtkTreeIter *iter,
+		struct audit_item *item) {
+	struct audit_digest *digest;
+	gint flags;
+
+	digest = g_hash_table_lookup(run->digests, item->digest);
+	if(!digest) {
+		digest = g_new0(struct audit_digest, 1);
+		g_hash_table_insert(run->digests,
+				g_memdup(item->digest, sizeof(item->digest)),
+				digest);
+	}
+	digest->count++;
+	digest->rows = g_slist_prepend(digest->rows, gtk_tree_iter_copy(iter));
+
+	if(digest->count < 2)
+		return;
+
+	/* The first row didn't know it was reused yet */
+	if(digest->count == 2) {
+		gtk_tree_model_get(GTK_TREE_MODEL(run->list),
+				digest->rows->next->data,
+				AL_FLAGS, &flags,
+				-1);
+		set_audit_flags(run->list, digest->rows->next->data,
+				flags | AUDIT_REUSED, 2);
+		run->reused++;
+	}
+	item->flags |= AUDIT_REUSED;
+	run->reused++;
+}
+
+/* Once everything is in, say how many entries share each password */
+static void finish_audit(gpointer key, gpointer value, gpointer data) {
+	struct audit_digest *digest = value;
+	struct audit_run *run = data;
+	GSList *l;
+
+	if(digest->count < 3)
+		return;
+	for(l = digest->rows; l; l = l->next)
+		gtk_list_store_set(run->list, l->data,
+				AL_REUSED, digest->count,
+				-1);
+}
+
+static gboolean audit_done(gpointer data) {
+	struct audit_chunk *chunk = data;
+	struct audit_run *run = chunk->run;
+	struct audit_item *item;
+	GtkTreeIter iter;
+	char *status;
+	int i;
+
+	run->pending--;
+	if(run->closed) {
+		audit_items_free(chunk->items, chunk->count);
+		g_free(chunk);
+		if(!run->pending)
+			free_audit_run(run);
+		return FALSE;
+	}
+
+	for(i = 0; i < chunk->count; i++) {
+		item = &chunk->items[i];
+		gtk_list_store_insert_with_values(run->list, &iter, -1,
+				AL_FILE, item->file,
+				AL_TITLE, item->title,
+				AL_USERNAME, item->username,
+				AL_BITS, item->bits,
+				AL_AGE, item->age_days,
+				-1);
+
+		/* Nothing to gain from matching up empty passwords */
+		if(!(item->flags & AUDIT_EMPTY))
+			count_digest(run, &iter, item);
+		set_audit_flags(run->list, &iter, item->flags,
+				item->flags & AUDIT_REUSED ? 2 : 0);
+
+		if(item->flags & AUDIT_WEAK)
+			run->weak++;
+		if(item->flags & AUDIT_OLD)
+			run->old++;
+	}
+	run->done += chunk->count;
+
+	if(!run->pending)
+		g_hash_table_foreach(run->digests, finish_audit, run);
+
+	status = g_strdup_printf("%s %d of %d entries: %d reused, %d weak, "
+			"%d older than %d days%s", run->pending ? "Checking" :
+			"Checked", run->done, run->total, run->reused,
+			run->weak, run->old, AUDIT_OLD_DAYS, run->pending ? "..."
+			: "");
+	gtk_label_set_text(GTK_LABEL(run->status), status);
+	g_free(status);
+
+	if(!run->pending)
+		g_debug("audit: %d entries in %.3fs", run->total,
+				g_timer_elapsed(run->timer, NULL));
+
+	audit_items_free(chunk->items, chunk->count);
+	g_free(chunk);
+	return FALSE;
+}
+
+static gboolean audit_visible(GtkTreeModel *list, GtkTreeIter *iter,
+		gpointer data) {
+	struct audit_run *run = data;
+	gint flags;
+
+	gtk_tree_model_get(list, iter, AL_FLAGS, &flags, -1);
+
+	switch(run->show) {
+		case AUDIT_SHOW_PROBLEMS:
+			return flags != 0;
+		case AUDIT_SHOW_REUSED:
+			return flags & AUDIT_REUSED;
+		case AUDIT_SHOW_WEAK:
+			return flags & (AUDIT_WEAK | AUDIT_EMPTY);
+		case AUDIT_SHOW_OLD:
+			return flags & AUDIT_OLD;
+	}
+	return TRUE;
+}
+
+static void audit_show_changed(GtkComboBox *combo, gpointer data) {
+	struct audit_run *run = data;
+
+	run->show = gtk_combo_box_get_active(combo);
+	gtk_tree_model_filter_refilter(GTK_TREE_MODEL_FILTER(run->filter));
+}
+
+static void audit_closed(GtkWidget *window, gpointer data) {
+	struct audit_run *run = data;
+
+	run->closed = TRUE;
+	g_atomic_int_set(&run->cancelled, 1);
+	if(!run->pending)
+		free_audit_run(run);
+}
+
+/* Copy what the audit needs out of every entry of every open file and
+ * hand it to the audit pool in chunks */
+static void start_audit(GtkTreeView *tv, struct audit_run *run) {
+	GtkTreeModel *ts = tv_store(tv);
+	GtkTreeIter iter;
+	struct audit_chunk *chunk = NULL;
+	struct audit_item *item;
+	struct db_file *file;
+	kpass_entry *e;
+	char *name;
+	gboolean valid;
+	int i;
+
+	valid = gtk_tree_model_get_iter_first(ts, &iter);
+	while(valid) {
+		gtk_tree_model_get(ts, &iter,
+				TL_DB_FILE, &file,
+				TL_TITLE, &name,
+				-1);
+		if(file)
+			g_ptr_array_add(run->files, name);
+		else
+			g_free(name);
+
+		for(i = 0; file && i < file->db->entries_len; i++) {
+			e = file->db->entries[i];
+			if(is_meta_stream(e))
+				continue;
+
+			if(!chunk) {
+				chunk = g_new0(struct audit_chunk, 1);
+				chunk->run = run;
+				chunk->items = g_new0(struct audit_item,
+						AUDIT_CHUNK);
+			}
+			item = &chunk->items[chunk->count++];
+			item->file = name;
+			item->title = g_strdup(e->title);
+			item->username = g_strdup(e->username);
+			item->password = g_strdup(e->password);
+			memcpy(item->mtime, e->mtime, sizeof(item->mtime));
+
+			if(chunk->count == AUDIT_CHUNK) {
+				run->pending++;
+				g_thread_pool_push(audit_pool, chunk, NULL);
+				chunk = NULL;
+			}
+			run->total++;
+		}
+		valid = gtk_tree_model_iter_next(ts, &iter);
+	}
+
+	if(chunk) {
+		run->pending++;
+		g_thread_pool_push(audit_pool, chunk, NULL);
+	}
+
+	if(!run->total)
+		gtk_label_set_text(GTK_LABEL(run->status),
+				"No unlocked files to check.");
+}
+
+static GtkTreeViewColumn *audit_column(GtkWidget *view, const char *title,
+		int column) {
+	GtkTreeViewColumn *col;
+
+	col = gtk_tree_view_column_new_with_attributes(title,
+			gtk_cell_renderer_text_new(), "text", column, NULL);
+	gtk_tree_view_column_set_sort_column_id(col, column);
+	gtk_tree_view_column_set_resizable(col, TRUE);
+	gtk_tree_view_append_column(GTK_TREE_VIEW(view), col);
+	return col;
+}
+
+/* Check the passwords of every open file for reuse, strength and age in a
+ * window of its own, which fills in while the checks run */
+void menu_audit(GtkWidget *widget, gpointer callback_data) {
+	GtkTreeView *tv = GTK_TREE_VIEW(callback_data);
+	GtkWidget *window, *box, *hbox, *combo, *view, *scroller;
+	GtkTreeModel *sorted;
+	struct audit_run *run;
+
+	run = g_new0(struct audit_run, 1);
+	run->files = g_ptr_array_new();
+	run->digests = g_hash_table_new_full(digest_hash, digest_equal,
+			g_free, free_audit_digest);
+	run->timer = g_timer_new();
+	run->now = time(NULL);
+	audit_runs = g_slist_prepend(audit_runs, run);
+	run->list = gtk_list_store_new(8, G_TYPE_STRING, G_TYPE_STRING,
+			G_TYPE_STRING, G_TYPE_INT, G_TYPE_INT, G_TYPE_INT,
+			G_TYPE_INT, G_TYPE_STRING);
+	run->filter = gtk_tree_model_filter_new(GTK_TREE_MODEL(run->list),
+			NULL);
+	gtk_tree_model_filter_set_visible_func(
+			GTK_TREE_MODEL_FILTER(run->filter), audit_visible,
+			run, NULL);
+
+	window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+	gtk_window_set_title(GTK_WINDOW(window), "Password Audit");
+	gtk_window_set_transient_for(GTK_WINDOW(window),
+			GTK_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(tv))));
+	gtk_window_set_default_size(GTK_WINDOW(window), 600, 400);
+
+	combo = gtk_combo_box_new_text();
+	gtk_combo_box_append_text(GTK_COMBO_BOX(combo), "Any problem");
+	gtk_combo_box_append_text(GTK_COMBO_BOX(combo), "Reused");
+	gtk_combo_box_append_text(GTK_COMBO_BOX(combo), "Weak");
+	gtk_combo_box_append_text(GTK_COMBO_BOX(combo), "Old");
+	gtk_combo_box_append_text(GTK_COMBO_BOX(combo), "All entries");
+	gtk_combo_box_set_active(GTK_COMBO_BOX(combo), AUDIT_SHOW_PROBLEMS);
+	g_signal_connect(combo, "changed", G_CALLBACK(audit_show_changed),
+			run);
+
+	run->status = gtk_label_new(NULL);
+	gtk_misc_set_alignment(GTK_MISC(run->status), 0, 0.5);
+
+	/* Sorting goes on top of the filter, so it only sorts what's shown */
+	sorted = gtk_tree_model_sort_new_with_model(run->filter);
+	view = gtk_tree_view_new_with_model(sorted);
+	g_object_unref(sorted);
+	audit_column(view, "File", AL_FILE);
+	audit_column(view, "Title", AL_TITLE);
+	audit_column(view, "Username", AL_USERNAME);
+	audit_column(view, "Problems", AL_ISSUES);
+	audit_column(view, "Bits", AL_BITS);
+	audit_column(view, "Shared by", AL_REUSED);
+	audit_column(view, "Age (days)", AL_AGE);
+
+	scroller = gtk_scrolled_window_new(NULL, NULL);
+	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scroller),
+			GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+	gtk_container_add(GTK_CONTAINER(scroller), view);
+
+	hbox = gtk_hbox_new(FALSE, 6);
+	gtk_box_pack_start(GTK_BOX(hbox), combo, FALSE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(hbox), run->status, TRUE, TRUE, 0);
+
+	box = gtk_vbox_new(FALSE, 1);
+	gtk_box_pack_start(GTK_BOX(box), hbox, FALSE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(box), scroller, TRUE, TRUE, 0);
+	gtk_container_add(GTK_CONTAINER(window), box);
+
+	g_signal_connect(window, "destroy", G_CALLBACK(audit_closed), run);
+	gtk_widget_show_all(window);
+
+	start_audit(tv, run);
+}
+
+void audit_ui_init(void) {
+	audit_pool = g_thread_pool_new(audit_worker, NULL,
+			MAX(sysconf(_SC_NPROCESSORS_ONLN), 1), FALSE, NULL);
+}
+
+void audit_ui_shutdown(void) {
+	GSList *l;
+
+	/* What's left in the pool only has to notice */
+	for(l = audit_runs; l; l = l->next)
+		g_atomic_int_set(&((struct audit_run*)l->data)->cancelled, 1);
+	g_thread_pool_free(audit_pool, FALSE, TRUE);
+	audit_pool = NULL;
+}
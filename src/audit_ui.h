@@ -0,0 +1,33 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GTKPASS_AUDIT_UI_H
+#define GTKPASS_AUDIT_UI_H
+
+#include <gtk/gtk.h>
+
+/* Start and stop the pool audits run on.  Shutting down cancels every
+ * audit and waits for the workers to stop. */
+void audit_ui_init(void);
+void audit_ui_shutdown(void);
+
+/* Check the passwords of every open file for reuse, strength and age in a
+ * window of its own, which fills in while the checks run */
+void menu_audit(GtkWidget *widget, gpointer callback_data);
+
+#endif
@@ -0,0 +1,240 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <kpass.h>
+
+#include "config.h"
+#include "db.h"
+#include "agent.h"
+#include "cli.h"
+
+static gchar *get_path = NULL;
+static gchar *get_field = "password";
+
+static GOptionEntry cli_options[] =
+{
+  { "get", 'g', 0, G_OPTION_ARG_STRING, &get_path,
+    "Print a field of the entry at GROUP/.../TITLE and exit", "PATH" },
+  { "field", 'f', 0, G_OPTION_ARG_STRING, &get_field,
+    "Field to print with --get: title, username, password, url or notes "
+    "(default: password)", "FIELD" },
+  { NULL }
+};
+
+int cli_wanted(int argc, char **argv) {
+	int i;
+
+	for(i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--"))
+			break;
+		if(!strcmp(argv[i], "--get") || !strcmp(argv[i], "-g") ||
+				!strncmp(argv[i], "--get=", 6))
+			return 1;
+	}
+	return 0;
+}
+
+/* Read a password from stdin, without echo if it's a terminal */
+static char *read_password(const char *filename) {
+	struct termios old, quiet;
+	char buf[1024];
+	char *pass = NULL;
+	int tty = isatty(STDIN_FILENO);
+	size_t len;
+
+	if(tty) {
+		fprintf(stderr, "Password for %s: ", filename);
+		tcgetattr(STDIN_FILENO, &old);
+		quiet = old;
+		quiet.c_lflag &= ~ECHO;
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &quiet);
+	}
+
+	if(fgets(buf, sizeof(buf), stdin)) {
+		len = strlen(buf);
+		if(len && buf[len - 1] == '\n')
+			buf[--len] = '\0';
+		pass = strdup(buf);
+		memset(buf, 0, sizeof(buf));
+	}
+
+	if(tty) {
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &old);
+		fputc('\n', stderr);
+	}
+
+	return pass;
+}
+
+/* Walk GROUP/.../TITLE down the group hierarchy.  Names are matched
+ * exactly; a bare TITLE matches an entry in any group.  NULL with errno set
+ * to ENOMEM if memory ran out, otherwise NULL if there's no such entry. */
+static kpass_entry *find_entry(kpass_db *db, const char *path) {
+	gchar **parts;
+	int *parents;
+	int depth, d, i, parent = -1;
+	kpass_entry *found = NULL;
+
+	parts = g_strsplit(path, "/", -1);
+	depth = g_strv_length(parts);
+	if(depth == 0)
+		goto find_entry_out;
+
+	parents = group_parents(db);
+	if(!parents) {
+		errno = ENOMEM;
+		goto find_entry_out;
+	}
+
+	/* Each component names a child of the group found for the last */
+	for(d = 0; d < depth - 1; d++) {
+		for(i = 0; i < db->groups_len; i++)
+			if(parents[i] == parent && db->groups[i]->name &&
+					!strcmp(db->groups[i]->name, parts[d]))
+				break;
+		if(i == db->groups_len) {
+			free(parents);
+			goto find_entry_out;
+		}
+		parent = i;
+	}
+	free(parents);
+
+	for(i = 0; i < db->entries_len; i++) {
+		if(parent >= 0 && db->entries[i]->group_id !=
+				db->groups[parent]->id)
+			continue;
+		if(db->entries[i]->title &&
+				!strcmp(db->entries[i]->title, parts[depth - 1])) {
+			found = db->entries[i];
+			break;
+		}
+	}
+
+find_entry_out:
+	g_strfreev(parts);
+	return found;
+}
+
+int cli_main(int argc, char **argv) {
+	GOptionContext *context;
+	GError *error = NULL;
+	uint8_t pw_hash[PW_HASH_LEN];
+	kpass_db *db;
+	kpass_entry *entry;
+	const char *val;
+	char *pass, *agent_name;
+	int retval;
+
+	context = g_option_context_new("--get PATH FILE");
+	g_option_context_add_main_entries(context, cli_options, NULL);
+	if(!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 2;
+	}
+	g_option_context_free(context);
+
+	if(!get_path || argc != 2) {
+		fprintf(stderr, "usage: %s --get PATH [--field FIELD] FILE\n",
+				g_get_prgname());
+		return 2;
+	}
+
+	if(strcmp(get_field, "title") && strcmp(get_field, "username") &&
+			strcmp(get_field, "password") &&
+			strcmp(get_field, "url") && strcmp(get_field, "notes")) {
+		fprintf(stderr, "unknown field: %s\n", get_field);
+		return 2;
+	}
+
+	/* The password comes from stdin, so the database can't as well */
+	if(!strcmp(argv[1], "-")) {
+		fprintf(stderr, "FILE can't be - when the password is read "
+				"from stdin\n");
+		return 2;
+	}
+
+	/* A running agent may already know the hash, and the key it
+	 * transforms to */
+	db_set_key_cache(agent_get, agent_put);
+	retval = -1;
+	agent_name = agent_hash_name(argv[1]);
+	if(agent_name && !agent_get(agent_name, pw_hash, PW_HASH_LEN))
+		retval = load_db(argv[1], NULL, pw_hash, &db, NULL);
+
+	if(retval) {
+		pass = read_password(argv[1]);
+		if(!pass) {
+			free(agent_name);
+			return 1;
+		}
+
+		retval = load_db(argv[1], pass, pw_hash, &db, NULL);
+		memset(pass, 0, strlen(pass));
+		free(pass);
+
+		if(!retval && agent_name)
+			agent_put(agent_name, pw_hash, PW_HASH_LEN);
+	}
+	free(agent_name);
+
+	if(retval > 0) {
+		fprintf(stderr, "Error loading database: %s\n",
+				kpass_strerror(retval));
+		return 1;
+	} else if(retval < 0) {
+		fprintf(stderr, "Error opening file: %s\n", strerror(errno));
+		return 1;
+	}
+
+	errno = 0;
+	entry = find_entry(db, get_path);
+	if(!entry) {
+		fprintf(stderr, "%s: %s\n", get_path, errno == ENOMEM ?
+				strerror(errno) : "no such entry");
+		retval = 1;
+	} else {
+		if(!strcmp(get_field, "title"))
+			val = entry->title;
+		else if(!strcmp(get_field, "username"))
+			val = entry->username;
+		else if(!strcmp(get_field, "url"))
+			val = entry->url;
+		else if(!strcmp(get_field, "notes"))
+			val = entry->notes;
+		else
+			val = entry->password;
+		printf("%s\n", val ? val : "");
+	}
+
+	memset(pw_hash, 0, sizeof(pw_hash));
+	kpass_free_db(db);
+	free(db);
+	return retval;
+}
@@ -0,0 +1,29 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GTKPASS_CLI_H
+#define GTKPASS_CLI_H
+
+/* Non-zero if the command line asks for a lookup rather than the GUI */
+int cli_wanted(int argc, char **argv);
+
+/* Look up one field and print it, without ever touching GTK.  Returns the
+ * process exit status. */
+int cli_main(int argc, char **argv);
+
+#endif
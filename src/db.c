@@ -0,0 +1,1010 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <glib.h>
+#include <kpass.h>
+
+#include "config.h"
+#include "aes.h"
+#include "db.h"
+#include "input.h"
+
+static struct db_usage usage;
+G_LOCK_DEFINE_STATIC(usage);
+
+/* Set once at startup by db_set_key_cache() */
+static key_cache_get cache_get;
+static key_cache_put cache_put;
+
+/* Cipher bit in the KDB header flags */
+#define KDB_FLAG_RIJNDAEL 2
+
+static void sha256(const uint8_t *a, size_t a_len, const uint8_t *b,
+		size_t b_len, uint8_t out[32]) {
+	GChecksum *sum;
+	gsize len = 32;
+
+	sum = g_checksum_new(G_CHECKSUM_SHA256);
+	g_checksum_update(sum, a, a_len);
+	if(b)
+		g_checksum_update(sum, b, b_len);
+	g_checksum_get_digest(sum, out, &len);
+	g_checksum_free(sum);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* Pull the next type/size/data field out of the decrypted contents */
+static int next_field(const uint8_t **p, const uint8_t *end, uint16_t *type,
+		uint32_t *size, const uint8_t **data) {
+	if(end - *p < 6)
+		return -1;
+	*type = (*p)[0] | (*p)[1] << 8;
+	*size = get_u32(*p + 2);
+	*p += 6;
+	if((uint32_t)(end - *p) < *size)
+		return -1;
+	*data = *p;
+	*p += *size;
+	return 0;
+}
+
+static char *dup_field(const uint8_t *data, uint32_t size) {
+	char *s;
+
+	s = malloc(size + 1);
+	if(!s)
+		return NULL;
+	memcpy(s, data, size);
+	s[size] = '\0';
+	return s;
+}
+
+void db_entry_free(kpass_entry *e) {
+	free(e->title);
+	free(e->url);
+	free(e->username);
+	if(e->password) {
+		memset(e->password, 0, strlen(e->password));
+		free(e->password);
+	}
+	free(e->notes);
+	free(e->desc);
+	free(e->data);
+	free(e);
+}
+
+void db_group_free(kpass_group *g) {
+	free(g->name);
+	free(g);
+}
+
+static void free_contents(kpass_db *db) {
+	int i;
+
+	if(db->groups) {
+		for(i = 0; i < db->groups_len; i++)
+			if(db->groups[i])
+				db_group_free(db->groups[i]);
+		free(db->groups);
+		db->groups = NULL;
+	}
+
+	if(db->entries) {
+		for(i = 0; i < db->entries_len; i++)
+			if(db->entries[i])
+				db_entry_free(db->entries[i]);
+		free(db->entries);
+		db->entries = NULL;
+	}
+}
+
+static int parse_group(kpass_group *g, const uint8_t **p, const uint8_t *end) {
+	const uint8_t *data;
+	uint16_t type;
+	uint32_t size;
+
+	while(!next_field(p, end, &type, &size, &data)) {
+		switch(type) {
+			case 0x0001:
+				if(size != 4) return -1;
+				g->id = get_u32(data);
+				break;
+			case 0x0002:
+				free(g->name);
+				if(!(g->name = dup_field(data, size))) return -1;
+				break;
+			case 0x0003: case 0x0004: case 0x0005: case 0x0006:
+				if(size != 5) return -1;
+				memcpy(type == 0x0003 ? g->ctime :
+						type == 0x0004 ? g->mtime :
+						type == 0x0005 ? g->atime : g->etime,
+						data, 5);
+				break;
+			case 0x0007:
+				if(size != 4) return -1;
+				g->image_id = get_u32(data);
+				break;
+			case 0x0008:
+				if(size != 2) return -1;
+				g->level = data[0] | data[1] << 8;
+				break;
+			case 0x0009:
+				if(size != 4) return -1;
+				g->flags = get_u32(data);
+				break;
+			case 0xffff:
+				return 0;
+		}
+	}
+	return -1;
+}
+
+static int parse_entry(kpass_entry *e, const uint8_t **p, const uint8_t *end) {
+	const uint8_t *data;
+	uint16_t type;
+	uint32_t size;
+	char **str;
+
+	while(!next_field(p, end, &type, &size, &data)) {
+		str = NULL;
+		switch(type) {
+			case 0x0001:
+				if(size != 16) return -1;
+				memcpy(e->uuid, data, 16);
+				break;
+			case 0x0002:
+				if(size != 4) return -1;
+				e->group_id = get_u32(data);
+				break;
+			case 0x0003:
+				if(size != 4) return -1;
+				e->image_id = get_u32(data);
+				break;
+			case 0x0004: str = &e->title; break;
+			case 0x0005: str = &e->url; break;
+			case 0x0006: str = &e->username; break;
+			case 0x0007: str = &e->password; break;
+			case 0x0008: str = &e->notes; break;
+			case 0x000d: str = &e->desc; break;
+			case 0x0009: case 0x000a: case 0x000b: case 0x000c:
+				if(size != 5) return -1;
+				memcpy(type == 0x0009 ? e->ctime :
+						type == 0x000a ? e->mtime :
+						type == 0x000b ? e->atime : e->etime,
+						data, 5);
+				break;
+			case 0x000e:
+				free(e->data);
+				e->data = NULL;
+				e->data_len = size;
+				if(size) {
+					if(!(e->data = malloc(size))) return -1;
+					memcpy(e->data, data, size);
+				}
+				break;
+			case 0xffff:
+				return 0;
+		}
+		if(str) {
+			free(*str);
+			if(!(*str = dup_field(data, size))) return -1;
+		}
+	}
+	return -1;
+}
+
+static kpass_retval parse_contents(kpass_db *db, const uint8_t *p,
+		const uint8_t *end) {
+	int i;
+
+	/* Every record takes at least one six byte field */
+	if(db->groups_len > (end - p) / 6 || db->entries_len > (end - p) / 6)
+		return kpass_load_decrypted_data_group_fail;
+
+	db->groups = calloc(db->groups_len + 1, sizeof(kpass_group*));
+	db->entries = calloc(db->entries_len + 1, sizeof(kpass_entry*));
+	if(!db->groups || !db->entries) {
+		free_contents(db);
+		return kpass_load_decrypted_data_group_fail;
+	}
+
+	for(i = 0; i < db->groups_len; i++) {
+		db->groups[i] = calloc(1, sizeof(kpass_group));
+		if(!db->groups[i] || parse_group(db->groups[i], &p, end)) {
+			free_contents(db);
+			return kpass_load_decrypted_data_group_fail;
+		}
+	}
+
+	for(i = 0; i < db->entries_len; i++) {
+		db->entries[i] = calloc(1, sizeof(kpass_entry));
+		if(!db->entries[i] || parse_entry(db->entries[i], &p, end)) {
+			free_contents(db);
+			return kpass_load_decrypted_data_entry_fail;
+		}
+	}
+
+	return kpass_success;
+}
+
+/* Our own decrypt for AES databases, so the key transform can run on the
+ * AES instructions.  The layout filled in matches kpass_decrypt_db(), so
+ * kpass_free_db() still cleans it up.  tk is used and filled in as by
+ * kdbx_load(). */
+static kpass_retval fast_decrypt_db(kpass_db *db, const uint8_t *pw_hash,
+		struct transformed_key *tk) {
+	uint8_t key[32], final_key[32], hash[32], iv[16];
+	uint8_t *buf;
+	int len = db->encrypted_data_len, pad;
+	kpass_retval retval;
+
+	if(tk && tk->valid) {
+		memcpy(key, tk->key, 32);
+	} else {
+		memcpy(key, pw_hash, 32);
+		aes_transform(AES_AESNI, db->master_seed_extra, key,
+				db->key_rounds);
+		sha256(key, 32, NULL, 0, key);
+		if(tk) {
+			memcpy(tk->key, key, 32);
+			tk->valid = 1;
+		}
+	}
+	sha256(db->master_seed, sizeof(db->master_seed), key, 32, final_key);
+
+	buf = malloc(len);
+	if(!buf) {
+		retval = kpass_decrypt_db_fail;
+		goto fast_decrypt_out;
+	}
+	memcpy(buf, db->encrypted_data, len);
+
+	memcpy(iv, db->encryption_init_vector, sizeof(iv));
+	if(aes_cbc_decrypt(final_key, iv, buf, len)) {
+		retval = kpass_decrypt_db_fail;
+		goto fast_decrypt_out;
+	}
+
+	/* A wrong key shows up as bad padding or a bad contents hash */
+	pad = buf[len - 1];
+	if(pad < 1 || pad > 16) {
+		retval = kpass_decrypt_data_fail;
+		goto fast_decrypt_out;
+	}
+	len -= pad;
+	sha256(buf, len, NULL, 0, hash);
+	if(memcmp(hash, db->contents_hash, 32)) {
+		retval = kpass_decrypt_data_fail;
+		goto fast_decrypt_out;
+	}
+
+	retval = parse_contents(db, buf, buf + len);
+
+fast_decrypt_out:
+	if(buf) {
+		memset(buf, 0, db->encrypted_data_len);
+		free(buf);
+	}
+	memset(key, 0, sizeof(key));
+	memset(final_key, 0, sizeof(final_key));
+	return retval;
+}
+
+int can_fast_decrypt(kpass_db *db) {
+	return db->flags & KDB_FLAG_RIJNDAEL &&
+		db->encrypted_data_len > 0 &&
+		db->encrypted_data_len % 16 == 0 &&
+		aes_have_aesni();
+}
+
+void db_set_key_cache(key_cache_get get, key_cache_put put) {
+	cache_get = get;
+	cache_put = put;
+}
+
+/* What the transformed key for pw_hash under seed and rounds is cached as.
+ * The name is a hash of all three, so it gives none of them away and a
+ * changed password or a resaved file never finds a stale key. */
+static char *key_cache_name(const uint8_t seed[32], uint64_t rounds,
+		const uint8_t *pw_hash) {
+	uint8_t buf[32 + 8 + PW_HASH_LEN], hash[32];
+	char *name;
+	int i;
+
+	memcpy(buf, seed, 32);
+	for(i = 0; i < 8; i++)
+		buf[32 + i] = rounds >> (8 * i);
+	memcpy(buf + 40, pw_hash, PW_HASH_LEN);
+	sha256(buf, sizeof(buf), NULL, 0, hash);
+	memset(buf, 0, sizeof(buf));
+
+	name = malloc(sizeof("key:") + 2 * sizeof(hash));
+	if(!name)
+		return NULL;
+	strcpy(name, "key:");
+	for(i = 0; i < sizeof(hash); i++)
+		sprintf(name + 4 + 2 * i, "%02x", hash[i]);
+	return name;
+}
+
+static void count_mapping(long length, int fds) {
+	G_LOCK(usage);
+	usage.mapped += length;
+	usage.fds += fds;
+	G_UNLOCK(usage);
+}
+
+static void release_input(struct input *in) {
+	count_mapping(-(long)in->len, in->fd != -1 ? -1 : 0);
+	input_close(in);
+}
+
+/* Seconds since the last lap, restarting the timer */
+static double lap(GTimer *timer) {
+	double elapsed;
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_start(timer);
+	return elapsed;
+}
+
+int load_db(const char *filename, const char *pass, uint8_t *pw_hash,
+		kpass_db **out, struct load_timing *timing) {
+	return load_db_batched(filename, pass, pw_hash, out, timing, NULL,
+			NULL);
+}
+
+int load_db_batched(const char *filename, const char *pass,
+		uint8_t *pw_hash, kpass_db **out, struct load_timing *timing,
+		kdbx_batch_func batch, void *data) {
+	struct input in;
+	const uint8_t *file;
+	int length;
+	int kdbx;
+	kpass_db *db;
+	kpass_retval retval = 0;
+	struct transformed_key tk;
+	const uint8_t *seed;
+	uint64_t rounds;
+	char *cache_name = NULL;
+	int cached = 0;
+	GTimer *timer;
+	int err;
+
+	*out = NULL;
+	memset(&tk, 0, sizeof(tk));
+	timer = g_timer_new();
+
+	err = input_open(&in, filename);
+	if(err) {
+		g_timer_destroy(timer);
+		return err;
+	}
+	file = in.data;
+	length = in.len;
+	count_mapping(length, in.fd != -1);
+	if(timing) timing->map = lap(timer);
+
+	db = calloc(1, sizeof(kpass_db));
+	if(!db) {
+		release_input(&in);
+		g_timer_destroy(timer);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* KDBX headers are read along with the rest */
+	kdbx = kdbx_is(file, length);
+	if(!kdbx) {
+		retval = kpass_init_db(db, file, length);
+		if(retval) goto load_db_fail;
+	}
+	if(timing) timing->init = lap(timer);
+
+	if(pass)
+		kpass_hash_pw(pass, pw_hash);
+	if(timing) timing->hash = lap(timer);
+
+	/* libkpass does its own transform, so only our decrypts can use a
+	 * cached key */
+	if(cache_get && (kdbx ? !kdbx_key_params(file, length, &seed,
+					&rounds) : can_fast_decrypt(db))) {
+		if(!kdbx) {
+			seed = db->master_seed_extra;
+			rounds = db->key_rounds;
+		}
+		cache_name = key_cache_name(seed, rounds, pw_hash);
+		if(cache_name && !cache_get(cache_name, tk.key,
+					sizeof(tk.key)))
+			tk.valid = cached = 1;
+	}
+
+	if(kdbx)
+		retval = kdbx_load(file, length, pw_hash, &tk, db, batch,
+				data);
+	else if(can_fast_decrypt(db))
+		retval = fast_decrypt_db(db, pw_hash, &tk);
+	else
+		retval = kpass_decrypt_db(db, pw_hash);
+	if(retval) goto load_db_fail;
+	if(timing) timing->decrypt = lap(timer);
+
+	/* Only keys that worked are worth keeping */
+	if(cache_name && !cached && tk.valid && cache_put)
+		cache_put(cache_name, tk.key, sizeof(tk.key));
+	free(cache_name);
+	memset(&tk, 0, sizeof(tk));
+
+	/* Pipes and stdin can't be read a second time, so there's nothing
+	 * to reload from or save back to */
+	if(!in.rereadable)
+		db->flags |= DB_FLAG_STREAM;
+
+	/* Nothing needs the ciphertext once it's decrypted */
+	release_input(&in);
+	free(db->encrypted_data);
+	db->encrypted_data = NULL;
+
+	g_timer_destroy(timer);
+	*out = db;
+	return 0;
+
+load_db_fail:
+	free(cache_name);
+	memset(&tk, 0, sizeof(tk));
+	release_input(&in);
+	free(db->encrypted_data);
+	free(db);
+	g_timer_destroy(timer);
+	return retval;
+}
+
+/* Both decrypt paths and libkpass only give this for bad padding or a
+ * bad hash over the plaintext, which a wrong key almost always causes */
+int db_wrong_password(int retval) {
+	return retval == kpass_decrypt_data_fail;
+}
+
+/* Roughly what a decrypted database costs on the heap */
+static size_t db_bytes(kpass_db *db) {
+	kpass_entry *e;
+	size_t bytes;
+	int i;
+
+	bytes = sizeof(kpass_db) + (db->groups_len + db->entries_len) *
+		sizeof(void*);
+
+	for(i = 0; i < db->groups_len; i++) {
+		bytes += sizeof(kpass_group);
+		if(db->groups[i]->name)
+			bytes += strlen(db->groups[i]->name) + 1;
+	}
+
+	for(i = 0; i < db->entries_len; i++) {
+		e = db->entries[i];
+		bytes += sizeof(kpass_entry) + e->data_len;
+		if(e->title) bytes += strlen(e->title) + 1;
+		if(e->url) bytes += strlen(e->url) + 1;
+		if(e->username) bytes += strlen(e->username) + 1;
+		if(e->password) bytes += strlen(e->password) + 1;
+		if(e->notes) bytes += strlen(e->notes) + 1;
+		if(e->desc) bytes += strlen(e->desc) + 1;
+	}
+
+	return bytes;
+}
+
+struct db_file *db_file_new(const char *filename, uint8_t *pw_hash,
+		kpass_db *db) {
+	struct db_file *file;
+
+	file = malloc(sizeof(struct db_file));
+	if(!file)
+		return NULL;
+	file->filename = strdup(filename);
+	if(!file->filename) {
+		free(file);
+		return NULL;
+	}
+	file->pw_hash = pw_hash;
+	file->db = db;
+	file->tree = NULL;
+	file->bytes = db_bytes(db);
+	memset(&file->written, 0, sizeof(file->written));
+	file->exports = 0;
+	file->closed = 0;
+
+	G_LOCK(usage);
+	usage.files++;
+	usage.bytes += file->bytes;
+	G_UNLOCK(usage);
+
+	return file;
+}
+
+void db_file_free(struct db_file *file) {
+	G_LOCK(usage);
+	usage.files--;
+	usage.bytes -= file->bytes;
+	G_UNLOCK(usage);
+
+	if(file->tree)
+		db_tree_free(file->tree);
+	kpass_free_db(file->db);
+	free(file->db);
+	memset(file->pw_hash, 0, PW_HASH_LEN);
+	free(file->pw_hash);
+	free(file->filename);
+	free(file);
+}
+
+static char *dup_string(const char *s, int *failed) {
+	char *copy;
+
+	if(!s)
+		return NULL;
+	if(!(copy = strdup(s)))
+		*failed = 1;
+	return copy;
+}
+
+kpass_entry *db_entry_copy(const kpass_entry *entry) {
+	kpass_entry *e;
+	int failed = 0;
+
+	e = malloc(sizeof(kpass_entry));
+	if(!e)
+		return NULL;
+	*e = *entry;
+	e->title = dup_string(entry->title, &failed);
+	e->url = dup_string(entry->url, &failed);
+	e->username = dup_string(entry->username, &failed);
+	e->password = dup_string(entry->password, &failed);
+	e->notes = dup_string(entry->notes, &failed);
+	e->desc = dup_string(entry->desc, &failed);
+	e->data = NULL;
+	if(entry->data_len) {
+		if((e->data = malloc(entry->data_len)))
+			memcpy(e->data, entry->data, entry->data_len);
+		else
+			failed = 1;
+	}
+
+	if(failed) {
+		db_entry_free(e);
+		return NULL;
+	}
+	return e;
+}
+
+kpass_db *db_copy(kpass_db *db) {
+	kpass_db *copy;
+	int i, failed = 0;
+
+	copy = malloc(sizeof(kpass_db));
+	if(!copy)
+		return NULL;
+	*copy = *db;
+	copy->encrypted_data = NULL;
+	copy->encrypted_data_len = 0;
+
+	copy->groups = calloc(db->groups_len + 1, sizeof(kpass_group*));
+	copy->entries = calloc(db->entries_len + 1, sizeof(kpass_entry*));
+	if(!copy->groups || !copy->entries)
+		failed = 1;
+
+	for(i = 0; !failed && i < db->groups_len; i++) {
+		copy->groups[i] = malloc(sizeof(kpass_group));
+		if(!copy->groups[i]) {
+			failed = 1;
+			break;
+		}
+		*copy->groups[i] = *db->groups[i];
+		copy->groups[i]->name = dup_string(db->groups[i]->name,
+				&failed);
+	}
+
+	for(i = 0; !failed && i < db->entries_len; i++)
+		if(!(copy->entries[i] = db_entry_copy(db->entries[i])))
+			failed = 1;
+
+	if(failed) {
+		free_contents(copy);
+		free(copy);
+		return NULL;
+	}
+	return copy;
+}
+
+void db_copy_free(kpass_db *copy) {
+	free_contents(copy);
+	free(copy);
+}
+
+static int random_bytes(uint8_t *buf, size_t len) {
+	ssize_t got;
+	int fd;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if(fd == -1)
+		return -1;
+	while(len > 0) {
+		got = read(fd, buf, len);
+		if(got <= 0) {
+			if(got == -1 && errno == EINTR)
+				continue;
+			close(fd);
+			return -1;
+		}
+		buf += got;
+		len -= got;
+	}
+	close(fd);
+	return 0;
+}
+
+static int write_all(int fd, const uint8_t *buf, size_t len) {
+	ssize_t done;
+
+	while(len > 0) {
+		done = write(fd, buf, len);
+		if(done == -1) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += done;
+		len -= done;
+	}
+	return 0;
+}
+
+/* Make a rename in dir survive a crash */
+static int sync_dir(const char *filename) {
+	char *dir;
+	int fd, ret;
+
+	dir = g_path_get_dirname(filename);
+	fd = open(dir, O_RDONLY);
+	g_free(dir);
+	if(fd == -1)
+		return -1;
+	ret = fsync(fd);
+	close(fd);
+	return ret;
+}
+
+int db_read_only(kpass_db *db) {
+	return db->flags & (DB_FLAG_KDBX | DB_FLAG_STREAM);
+}
+
+int save_db(const char *filename, kpass_db *db, const uint8_t *pw_hash,
+		struct stat *written) {
+	struct stat sb;
+	uint8_t *buf;
+	char *tmp;
+	int len, fd, err;
+	kpass_retval retval;
+
+	if(db_read_only(db)) {
+		errno = EROFS;
+		return -1;
+	}
+
+	/* Never reuse an IV or master seed with a different plaintext */
+	if(random_bytes(db->master_seed, sizeof(db->master_seed)) ||
+			random_bytes(db->encryption_init_vector,
+				sizeof(db->encryption_init_vector)))
+		return -1;
+
+	len = kpass_db_encrypted_len(db);
+	buf = malloc(len);
+	if(!buf)
+		return -1;
+	retval = kpass_encrypt_db(db, pw_hash, buf);
+	if(retval) {
+		free(buf);
+		return retval;
+	}
+
+	/* Next to the original so rename() can't cross filesystems */
+	tmp = g_strdup_printf("%s.XXXXXX", filename);
+	fd = mkstemp(tmp);
+	if(fd == -1)
+		goto save_db_fail;
+
+	/* Keep the original's permissions, mkstemp() makes it 0600 */
+	if(!stat(filename, &sb))
+		fchmod(fd, sb.st_mode & 07777);
+
+	if(write_all(fd, buf, len) || fsync(fd) || fstat(fd, written)) {
+		err = errno;
+		close(fd);
+		unlink(tmp);
+		errno = err;
+		goto save_db_fail;
+	}
+	if(close(fd) || rename(tmp, filename)) {
+		err = errno;
+		unlink(tmp);
+		errno = err;
+		goto save_db_fail;
+	}
+
+	/* The new file is in place either way, a failure here only means
+	 * a crash could still bring back the old one */
+	sync_dir(filename);
+
+	free(buf);
+	g_free(tmp);
+	return 0;
+
+save_db_fail:
+	free(buf);
+	g_free(tmp);
+	return -1;
+}
+
+int db_file_unchanged(const char *filename, const struct stat *written) {
+	struct stat sb;
+
+	if(stat(filename, &sb))
+		return 0;
+	return sb.st_dev == written->st_dev &&
+		sb.st_ino == written->st_ino &&
+		sb.st_size == written->st_size &&
+		sb.st_mtime == written->st_mtime;
+}
+
+void db_file_replace(struct db_file *file, kpass_db *db) {
+	size_t bytes;
+
+	bytes = db_bytes(db);
+	G_LOCK(usage);
+	usage.bytes += bytes - file->bytes;
+	G_UNLOCK(usage);
+
+	if(file->tree)
+		db_tree_free(file->tree);
+	file->tree = NULL;
+	kpass_free_db(file->db);
+	free(file->db);
+	file->db = db;
+	file->bytes = bytes;
+}
+
+struct db_tree *db_file_tree(struct db_file *file) {
+	if(!file->tree)
+		file->tree = db_tree_new(file->db);
+	return file->tree;
+}
+
+/* Turn counts of how many items go in each slot, stored one slot along in
+ * first, into where each slot starts.  Returns a copy of those starts for
+ * filling the slots in with. */
+static int *slot_starts(int *first, int slots) {
+	int *fill;
+	int s;
+
+	for(s = 1; s <= slots; s++)
+		first[s] += first[s - 1];
+	fill = malloc(sizeof(int) * (slots + 1));
+	if(fill)
+		memcpy(fill, first, sizeof(int) * (slots + 1));
+	return fill;
+}
+
+struct db_tree *db_tree_new(kpass_db *db) {
+	struct db_tree *tree;
+	GHashTable *ids;
+	int *fill, *slots;
+	int i;
+
+	tree = calloc(1, sizeof(struct db_tree));
+	if(!tree)
+		return NULL;
+	tree->index = g_hash_table_new(g_direct_hash, g_direct_equal);
+	tree->parents = group_parents(db);
+	tree->group_first = calloc(db->groups_len + 2, sizeof(int));
+	tree->group_kids = malloc(sizeof(int) * (db->groups_len + 1));
+	tree->entry_first = calloc(db->groups_len + 2, sizeof(int));
+	tree->entry_kids = malloc(sizeof(int) * (db->entries_len + 1));
+	slots = malloc(sizeof(int) * (db->entries_len + 1));
+	if(!tree->parents || !tree->group_first || !tree->group_kids ||
+			!tree->entry_first || !tree->entry_kids || !slots) {
+		free(slots);
+		db_tree_free(tree);
+		return NULL;
+	}
+
+	db_tree_reindex(tree, db);
+
+	/* Group ids are only meant to be unique, the first one wins */
+	ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for(i = 0; i < db->groups_len; i++) {
+		tree->group_first[tree->parents[i] + 2]++;
+		if(!g_hash_table_lookup(ids,
+					GUINT_TO_POINTER(db->groups[i]->id)))
+			g_hash_table_insert(ids,
+					GUINT_TO_POINTER(db->groups[i]->id),
+					GINT_TO_POINTER(i + 1));
+	}
+
+	fill = slot_starts(tree->group_first, db->groups_len + 1);
+	if(!fill)
+		goto db_tree_new_fail;
+	for(i = 0; i < db->groups_len; i++)
+		tree->group_kids[fill[tree->parents[i] + 1]++] = i;
+	free(fill);
+
+	for(i = 0; i < db->entries_len; i++) {
+		slots[i] = GPOINTER_TO_INT(g_hash_table_lookup(ids,
+				GUINT_TO_POINTER(db->entries[i]->group_id)));
+		if(slots[i])
+			tree->entry_first[slots[i] + 1]++;
+	}
+
+	fill = slot_starts(tree->entry_first, db->groups_len + 1);
+	if(!fill)
+		goto db_tree_new_fail;
+	for(i = 0; i < db->entries_len; i++)
+		if(slots[i])
+			tree->entry_kids[fill[slots[i]]++] = i;
+	free(fill);
+	free(slots);
+	g_hash_table_destroy(ids);
+
+	return tree;
+
+db_tree_new_fail:
+	free(slots);
+	g_hash_table_destroy(ids);
+	db_tree_free(tree);
+	return NULL;
+}
+
+void db_tree_free(struct db_tree *tree) {
+	free(tree->parents);
+	free(tree->group_first);
+	free(tree->group_kids);
+	free(tree->entry_first);
+	free(tree->entry_kids);
+	g_hash_table_destroy(tree->index);
+	free(tree);
+}
+
+void db_tree_reindex(struct db_tree *tree, kpass_db *db) {
+	int i;
+
+	g_hash_table_remove_all(tree->index);
+	for(i = 0; i < db->groups_len; i++)
+		g_hash_table_insert(tree->index, db->groups[i],
+				GINT_TO_POINTER(i + 1));
+}
+
+int db_tree_group_index(struct db_tree *tree, kpass_group *group) {
+	return GPOINTER_TO_INT(g_hash_table_lookup(tree->index, group)) - 1;
+}
+
+int db_tree_has_children(struct db_tree *tree, int group) {
+	return tree->group_first[group + 2] > tree->group_first[group + 1] ||
+		tree->entry_first[group + 2] > tree->entry_first[group + 1];
+}
+
+void db_get_usage(struct db_usage *out) {
+	G_LOCK(usage);
+	*out = usage;
+	G_UNLOCK(usage);
+}
+
+int *group_parents(kpass_db *db) {
+	int *parents, *stack;
+	int depth = 0, i;
+
+	parents = malloc(sizeof(int) * (db->groups_len + 1));
+	stack = malloc(sizeof(int) * (db->groups_len + 1));
+	if(!parents || !stack) {
+		free(parents);
+		free(stack);
+		return NULL;
+	}
+
+	for(i = 0; i < db->groups_len; i++) {
+		while(depth > 0 && db->groups[stack[depth - 1]]->level >=
+				db->groups[i]->level)
+			depth--;
+		parents[i] = depth ? stack[depth - 1] : -1;
+		stack[depth++] = i;
+	}
+
+	free(stack);
+	return parents;
+}
+
+guint uuid_hash(gconstpointer key) {
+	const guint8 *uuid = key;
+	guint hash = 0;
+	int i;
+
+	for(i = 0; i < 16; i++)
+		hash = hash * 31 + uuid[i];
+	return hash;
+}
+
+gboolean uuid_equal(gconstpointer a, gconstpointer b) {
+	return !memcmp(a, b, 16);
+}
+
+static int same_string(const char *a, const char *b) {
+	if(!a || !b)
+		return a == b;
+	return !strcmp(a, b);
+}
+
+int same_group(const kpass_group *a, const kpass_group *b) {
+	return a->id == b->id &&
+		same_string(a->name, b->name) &&
+		!memcmp(a->ctime, b->ctime, sizeof(a->ctime)) &&
+		!memcmp(a->mtime, b->mtime, sizeof(a->mtime)) &&
+		!memcmp(a->atime, b->atime, sizeof(a->atime)) &&
+		!memcmp(a->etime, b->etime, sizeof(a->etime)) &&
+		a->image_id == b->image_id &&
+		a->level == b->level &&
+		a->flags == b->flags;
+}
+
+int is_meta_stream(const kpass_entry *e) {
+	return e->data_len && e->notes && e->title && e->username && e->url &&
+		!strcmp(e->title, "Meta-Info") &&
+		!strcmp(e->username, "SYSTEM") &&
+		!strcmp(e->url, "$");
+}
+
+int same_fields(const kpass_entry *a, const kpass_entry *b) {
+	return a->image_id == b->image_id &&
+		same_string(a->title, b->title) &&
+		same_string(a->url, b->url) &&
+		same_string(a->username, b->username) &&
+		same_string(a->password, b->password) &&
+		same_string(a->notes, b->notes) &&
+		same_string(a->desc, b->desc) &&
+		a->data_len == b->data_len &&
+		(!a->data_len || !memcmp(a->data, b->data, a->data_len));
+}
+
+int same_entry(const kpass_entry *a, const kpass_entry *b) {
+	return !memcmp(a->uuid, b->uuid, sizeof(a->uuid)) &&
+		a->group_id == b->group_id &&
+		same_fields(a, b) &&
+		!memcmp(a->ctime, b->ctime, sizeof(a->ctime)) &&
+		!memcmp(a->mtime, b->mtime, sizeof(a->mtime)) &&
+		!memcmp(a->atime, b->atime, sizeof(a->atime)) &&
+		!memcmp(a->etime, b->etime, sizeof(a->etime));
+}
@@ -0,0 +1,217 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GTKPASS_DB_H
+#define GTKPASS_DB_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <kpass.h>
+
+#include "kdbx.h"
+
+/* Size of the password hash handed to kpass_decrypt_db() */
+#define PW_HASH_LEN 32
+
+/* In the flags of databases read from KDBX files.  libkpass knows no such
+ * flag, so they can't be written out as KDB by mistake. */
+#define DB_FLAG_KDBX 0x80000000
+
+/* In the flags of databases read from a pipe or stdin, which can't be
+ * opened again to reload or save */
+#define DB_FLAG_STREAM 0x40000000
+
+/* Where every group and entry of a database sits, worked out once.  Slot
+ * 0 is the top level and slot i + 1 is db->groups[i].  The groups directly
+ * in slot s are group_kids[group_first[s]] up to group_kids[group_first[s +
+ * 1]], in database order, and the same goes for entries. */
+struct db_tree {
+	int *parents;
+	int *group_first;
+	int *group_kids;
+	int *entry_first;
+	int *entry_kids;
+	/* Index + 1 of each group struct */
+	GHashTable *index;
+};
+
+/* A loaded file and everything it owns */
+struct db_file {
+	char *filename;
+	uint8_t *pw_hash;
+	kpass_db *db;
+	/* Built by db_file_tree() when first asked for, dropped along with
+	 * db */
+	struct db_tree *tree;
+	size_t bytes;
+	/* What save_db() last left on disk, all zero if nothing yet */
+	struct stat written;
+	/* Exports reading db on a worker, and whether the file was closed
+	 * while they were.  Left to the main loop. */
+	int exports;
+	int closed;
+};
+
+/* What every load and open file is holding right now */
+struct db_usage {
+	int files;
+	size_t bytes;
+	/* File contents being decrypted, mapped or read in */
+	size_t mapped;
+	int fds;
+};
+
+/* Seconds load_db() spent in each stage */
+struct load_timing {
+	double map;
+	double init;
+	double hash;
+	double decrypt;
+};
+
+/* Read and decrypt filename, "-" being stdin, through input_open().  If
+ * pass is non-NULL it is hashed into pw_hash first, otherwise pw_hash must
+ * already hold the hash.  The file is released again before this returns.
+ * This does not touch GTK, so it is safe to call from a worker thread.  If
+ * timing is non-NULL the time taken by each stage is stored there.
+ *
+ * -1: open failed, or out of memory
+ * -2: fstat failed
+ * -3: mmap and read failed
+ *  All others are kpass errors
+ */
+int load_db(const char *filename, const char *pass, uint8_t *pw_hash,
+		kpass_db **out, struct load_timing *timing);
+
+/* load_db(), but KDBX files hand their groups and entries to batch as
+ * they are parsed and leave only the header in out.  KDB files ignore
+ * batch and load whole. */
+int load_db_batched(const char *filename, const char *pass,
+		uint8_t *pw_hash, kpass_db **out, struct load_timing *timing,
+		kdbx_batch_func batch, void *data);
+
+/* Somewhere to keep transformed keys between loads, with the same calls
+ * as agent_get() and agent_put().  get returns 0 if it filled in key. */
+typedef int (*key_cache_get)(const char *name, uint8_t *key, size_t len);
+typedef void (*key_cache_put)(const char *name, const uint8_t *key,
+		size_t len);
+
+/* Have load_db() look for the transformed key in a cache before running
+ * the key transform, and put it there after a successful load.  Set once
+ * before any loads start; with none set every load transforms. */
+void db_set_key_cache(key_cache_get get, key_cache_put put);
+
+/* Non-zero if retval from load_db() means the password was wrong, rather
+ * than the file being unreadable, damaged or in a format we can't read */
+int db_wrong_password(int retval);
+
+/* Take over pw_hash and db, which must have come from malloc() and
+ * load_db(), along with a copy of filename.  NULL if out of memory, in which
+ * case both are still the caller's. */
+struct db_file *db_file_new(const char *filename, uint8_t *pw_hash,
+		kpass_db *db);
+
+/* Free the database and wipe the hash */
+void db_file_free(struct db_file *file);
+
+/* Free file's database and have it own db, which must have come from
+ * load_db() or db_copy(), in its place */
+void db_file_replace(struct db_file *file, kpass_db *db);
+
+void db_get_usage(struct db_usage *usage);
+
+/* The hierarchy of file's database, building it the first time.  NULL if
+ * out of memory, in which case the next call tries again. */
+struct db_tree *db_file_tree(struct db_file *file);
+
+/* Sort db's groups and entries into slots in a single pass over each,
+ * without recursing, so any depth of nesting costs the same.  Entries of
+ * groups that don't exist are left out.  NULL if out of memory. */
+struct db_tree *db_tree_new(kpass_db *db);
+void db_tree_free(struct db_tree *tree);
+
+/* Look groups up by the structs now in db->groups, after equal ones have
+ * been swapped in for them as reload_rows() does.  Where each group sits
+ * has to be unchanged. */
+void db_tree_reindex(struct db_tree *tree, kpass_db *db);
+
+/* The index in db->groups of group, or -1 if it isn't one of them */
+int db_tree_group_index(struct db_tree *tree, kpass_group *group);
+
+/* Non-zero if db->groups[group] holds any groups or entries */
+int db_tree_has_children(struct db_tree *tree, int group);
+
+/* Deep copy of db without the ciphertext, for saving it on a worker while
+ * the original is still being edited.  NULL if out of memory.  Free it with
+ * db_copy_free(). */
+kpass_db *db_copy(kpass_db *db);
+void db_copy_free(kpass_db *copy);
+
+/* Copy and free single entries the same way, NULL if out of memory */
+kpass_entry *db_entry_copy(const kpass_entry *entry);
+void db_entry_free(kpass_entry *entry);
+void db_group_free(kpass_group *group);
+
+/* Encrypt db with pw_hash and write it to filename.  It goes to a temporary
+ * file next to it that is synced and renamed into place, so filename always
+ * holds either the old or the whole new database.  db gets a fresh master
+ * seed and IV.  On success written is the stat of the new file.
+ *
+ * -1: writing failed, errno says why
+ *  All others are kpass errors
+ */
+int save_db(const char *filename, kpass_db *db, const uint8_t *pw_hash,
+		struct stat *written);
+
+/* Non-zero for databases save_db() can't write, which are those read from
+ * KDBX files, pipes or stdin */
+int db_read_only(kpass_db *db);
+
+/* Non-zero if filename is still the file save_db() left as written */
+int db_file_unchanged(const char *filename, const struct stat *written);
+
+/* Non-zero if load_db() decrypts db itself, with the key transform on
+ * AES-NI, rather than handing it to libkpass */
+int can_fast_decrypt(kpass_db *db);
+
+/* Work out the parent of every group from the level sequence: the closest
+ * earlier group with a lower level, or -1 for top level groups.  A group
+ * that jumps several levels deeper still lands under the group before it.
+ * Returns a malloc'd array of db->groups_len indices, or NULL if out of
+ * memory. */
+int *group_parents(kpass_db *db);
+
+/* Hash table functions for entry UUIDs */
+guint uuid_hash(gconstpointer key);
+gboolean uuid_equal(gconstpointer a, gconstpointer b);
+
+/* Non-zero if two groups/entries have identical contents */
+int same_group(const kpass_group *a, const kpass_group *b);
+int same_entry(const kpass_entry *a, const kpass_entry *b);
+
+/* Non-zero if two entries hold the same data, wherever and whenever they
+ * were made */
+int same_fields(const kpass_entry *a, const kpass_entry *b);
+
+/* Non-zero for the entries KeePass keeps its own settings in, which
+ * aren't passwords */
+int is_meta_stream(const kpass_entry *e);
+
+#endif
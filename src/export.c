@@ -0,0 +1,278 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <kpass.h>
+
+#include "config.h"
+#include "db.h"
+#include "export.h"
+
+#define EXPORT_BUF 65536
+
+/* Records on their way to the file */
+struct export_out {
+	int fd;
+	int failed;
+	size_t len;
+	char buf[EXPORT_BUF];
+};
+
+static void out_flush(struct export_out *out) {
+	size_t off = 0;
+	ssize_t n;
+
+	while(!out->failed && off < out->len) {
+		n = write(out->fd, out->buf + off, out->len - off);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0)
+			out->failed = errno;
+		else
+			off += n;
+	}
+	out->len = 0;
+}
+
+static void out_putc(struct export_out *out, char c) {
+	if(out->len == EXPORT_BUF)
+		out_flush(out);
+	out->buf[out->len++] = c;
+}
+
+static void out_puts(struct export_out *out, const char *s) {
+	while(*s)
+		out_putc(out, *s++);
+}
+
+/* Quoted, with quotes doubled, so commas and newlines can be in it */
+static void csv_string(struct export_out *out, const char *s) {
+	for(; s && *s; s++) {
+		if(*s == '"')
+			out_putc(out, '"');
+		out_putc(out, *s);
+	}
+}
+
+/* Bytes that aren't UTF-8 are taken to be Latin-1, which is what older
+ * KeePass versions wrote */
+static void json_string(struct export_out *out, const char *s) {
+	char hex[8];
+	gboolean utf8;
+
+	if(!s)
+		return;
+	utf8 = g_utf8_validate(s, -1, NULL);
+	for(; *s; s++) {
+		switch(*s) {
+			case '"':
+				out_puts(out, "\\\"");
+				break;
+			case '\\':
+				out_puts(out, "\\\\");
+				break;
+			case '\n':
+				out_puts(out, "\\n");
+				break;
+			case '\r':
+				out_puts(out, "\\r");
+				break;
+			case '\t':
+				out_puts(out, "\\t");
+				break;
+			default:
+				if((guchar)*s < 0x20 || (!utf8 &&
+							(guchar)*s >= 0x80)) {
+					g_snprintf(hex, sizeof(hex), "\\u%04x",
+							(guchar)*s);
+					out_puts(out, hex);
+				} else {
+					out_putc(out, *s);
+				}
+		}
+	}
+}
+
+static void put_string(struct export_out *out, int format, const char *s) {
+	out_putc(out, '"');
+	if(format == EXPORT_CSV)
+		csv_string(out, s);
+	else
+		json_string(out, s);
+	out_putc(out, '"');
+}
+
+/* The path of a group, given as the depth indices from the top level group
+ * down to it */
+static void put_path(struct export_out *out, int format, kpass_db *db,
+		int *path, int depth) {
+	int i;
+
+	out_putc(out, '"');
+	for(i = 0; i < depth; i++) {
+		if(i)
+			out_putc(out, '/');
+		if(format == EXPORT_CSV)
+			csv_string(out, db->groups[path[i]]->name);
+		else
+			json_string(out, db->groups[path[i]]->name);
+	}
+	out_putc(out, '"');
+}
+
+static void put_time(struct export_out *out, int format,
+		const uint8_t time[5]) {
+	struct tm tms;
+	char buf[32];
+
+	kpass_unpack_time(time, &tms);
+	strftime(buf, sizeof(buf), format == EXPORT_CSV ? "%Y-%m-%d %H:%M:%S"
+			: "%Y-%m-%dT%H:%M:%S", &tms);
+	put_string(out, format, buf);
+}
+
+static void put_entry(struct export_out *out, int format, kpass_db *db,
+		int *path, int depth, kpass_entry *e, gboolean first) {
+	if(format == EXPORT_CSV) {
+		put_path(out, format, db, path, depth);
+		out_putc(out, ',');
+		put_string(out, format, e->title);
+		out_putc(out, ',');
+		put_string(out, format, e->username);
+		out_putc(out, ',');
+		put_string(out, format, e->password);
+		out_putc(out, ',');
+		put_string(out, format, e->url);
+		out_putc(out, ',');
+		put_string(out, format, e->notes);
+		out_putc(out, ',');
+		put_time(out, format, e->mtime);
+		out_puts(out, "\r\n");
+		return;
+	}
+
+	out_puts(out, first ? "\n  {\"group\": " : ",\n  {\"group\": ");
+	put_path(out, format, db, path, depth);
+	out_puts(out, ", \"title\": ");
+	put_string(out, format, e->title);
+	out_puts(out, ", \"username\": ");
+	put_string(out, format, e->username);
+	out_puts(out, ", \"password\": ");
+	put_string(out, format, e->password);
+	out_puts(out, ", \"url\": ");
+	put_string(out, format, e->url);
+	out_puts(out, ", \"notes\": ");
+	put_string(out, format, e->notes);
+	out_puts(out, ", \"modified\": ");
+	put_time(out, format, e->mtime);
+	out_putc(out, '}');
+}
+
+int export_db(int fd, kpass_db *db, struct db_tree *tree, int group,
+		int format, struct export_progress *progress) {
+	struct export_out *out;
+	kpass_entry *e;
+	int *path;
+	int start, end, depth, total = 0, done = 0;
+	int g, i, p, ret = 0;
+
+	/* Groups come in order, so everything under group is the run of
+	 * groups after it whose parents are in that run too */
+	if(group < 0) {
+		start = 0;
+		end = db->groups_len;
+	} else {
+		start = group;
+		for(end = group + 1; end < db->groups_len &&
+				tree->parents[end] >= group; end++);
+	}
+
+	for(g = start; g < end; g++)
+		for(i = tree->entry_first[g + 1]; i < tree->entry_first[g + 2];
+				i++)
+			if(!is_meta_stream(db->entries[tree->entry_kids[i]]))
+				total++;
+	g_atomic_int_set(&progress->total, total);
+
+	out = g_new(struct export_out, 1);
+	out->fd = fd;
+	out->failed = 0;
+	out->len = 0;
+	path = g_new(int, db->groups_len + 1);
+
+	/* The path is kept as a stack as the groups go by, starting from
+	 * the groups above the first one */
+	depth = 0;
+	for(p = group >= 0 ? tree->parents[group] : -1; p >= 0;
+			p = tree->parents[p])
+		path[depth++] = p;
+	for(i = 0; i < depth / 2; i++) {
+		p = path[i];
+		path[i] = path[depth - 1 - i];
+		path[depth - 1 - i] = p;
+	}
+
+	if(format == EXPORT_CSV)
+		out_puts(out, "\"Group\",\"Title\",\"Username\",\"Password\","
+				"\"URL\",\"Notes\",\"Modified\"\r\n");
+	else
+		out_putc(out, '[');
+
+	for(g = start; g < end && !out->failed; g++) {
+		if(g_atomic_int_get(&progress->cancelled)) {
+			out->failed = ECANCELED;
+			break;
+		}
+
+		while(depth && path[depth - 1] != tree->parents[g])
+			depth--;
+		path[depth++] = g;
+
+		for(i = tree->entry_first[g + 1]; i < tree->entry_first[g + 2];
+				i++) {
+			e = db->entries[tree->entry_kids[i]];
+			if(is_meta_stream(e))
+				continue;
+			put_entry(out, format, db, path, depth, e, !done);
+			done++;
+		}
+		g_atomic_int_set(&progress->done, done);
+	}
+
+	if(format == EXPORT_JSON)
+		out_puts(out, done ? "\n]\n" : "]\n");
+	if(!out->failed)
+		out_flush(out);
+
+	if(out->failed) {
+		errno = out->failed;
+		ret = -1;
+	}
+
+	/* It held passwords */
+	memset(out->buf, 0, sizeof(out->buf));
+	g_free(out);
+	g_free(path);
+	return ret;
+}
@@ -0,0 +1,53 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GTKPASS_EXPORT_H
+#define GTKPASS_EXPORT_H
+
+#include <glib.h>
+
+#include <kpass.h>
+
+#include "db.h"
+
+enum {
+	EXPORT_CSV,	/* Group,Title,Username,Password,URL,Notes,Modified */
+	EXPORT_JSON,	/* An array with an object for each entry */
+};
+
+/* Shared between an export running on a worker and the main loop */
+struct export_progress {
+	volatile gint done;
+	volatile gint total;
+	volatile gint cancelled;
+};
+
+/* Write every entry of db in group, an index into db->groups or -1 for all
+ * of them, and in the groups under it, to fd as format.  Groups are given
+ * as their path, "Parent/Child".  Records are formatted into a fixed buffer
+ * straight from db and tree as they're walked, so memory use doesn't grow
+ * with the database.  progress->total is set before the first is written
+ * and done counts them as they go.  Doesn't touch GTK, but db mustn't
+ * change until this returns.
+ *
+ * Returns 0, or -1 with errno set if writing failed or ECANCELED if
+ * progress->cancelled was set. */
+int export_db(int fd, kpass_db *db, struct db_tree *tree, int group,
+		int format, struct export_progress *progress);
+
+#endif
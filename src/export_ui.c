@@ -0,0 +1,332 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtk/gtk.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <kpass.h>
+
+#include "config.h"
+#include "db.h"
+#include "store.h"
+#include "export.h"
+#include "export_ui.h"
+#include "ui.h"
+
+/* An export running on the export pool.  It reads the file's database as
+ * it is, so the file can't be edited, reloaded or merged into until it's
+ * done. */
+struct export_job {
+	GtkTreeView *tv;
+	struct db_file *file;
+	int group;
+	int format;
+	int fd;
+	char *filename;
+	/* Written to, and renamed over filename once it's complete */
+	char *tmp;
+	struct export_progress progress;
+	int retval;
+	int err;
+	GTimer *timer;
+	GtkWidget *dialog;
+	GtkWidget *bar;
+	guint poll;
+};
+
+/* How often the export dialog catches up with the worker */
+#define EXPORT_POLL_MS 100
+
+static GThreadPool *export_pool;
+
+/* Exports that haven't finished, main loop only */
+static GSList *export_jobs;
+
+static gboolean export_done(gpointer data);
+
+static void export_worker(gpointer data, gpointer user_data) {
+	struct export_job *job = data;
+
+	job->retval = export_db(job->fd, job->file->db, job->file->tree,
+			job->group, job->format, &job->progress);
+	/* It's about to replace filename, so it had better be on disk */
+	if(!job->retval && fsync(job->fd))
+		job->retval = -1;
+	job->err = errno;
+
+	g_idle_add(export_done, job);
+}
+
+static gboolean export_poll(gpointer data) {
+	struct export_job *job = data;
+	char *text;
+	gint done, total;
+
+	done = g_atomic_int_get(&job->progress.done);
+	total = g_atomic_int_get(&job->progress.total);
+	if(total)
+		gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(job->bar),
+				(double)done / total);
+
+	text = g_strdup_printf("%d of %d entries", done, total);
+	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(job->bar), text);
+	g_free(text);
+	return TRUE;
+}
+
+static void export_response(GtkDialog *dialog, gint response, gpointer data) {
+	struct export_job *job = data;
+
+	g_atomic_int_set(&job->progress.cancelled, 1);
+	gtk_dialog_set_response_sensitive(dialog, GTK_RESPONSE_CANCEL, FALSE);
+}
+
+void cancel_exports(struct db_file *file) {
+	struct export_job *job;
+	GSList *l;
+
+	for(l = export_jobs; l; l = l->next) {
+		job = l->data;
+		if(job->file == file)
+			g_atomic_int_set(&job->progress.cancelled, 1);
+	}
+}
+
+/* Runs on the main loop once the export pool is done with a job */
+static gboolean export_done(gpointer data) {
+	struct export_job *job = data;
+
+	g_source_remove(job->poll);
+	export_jobs = g_slist_remove(export_jobs, job);
+
+	if((close(job->fd) || rename(job->tmp, job->filename)) &&
+			!job->retval) {
+		job->retval = -1;
+		job->err = errno;
+	}
+
+	/* Half an export is no use to anyone, and it has passwords in it */
+	if(job->retval)
+		unlink(job->tmp);
+
+	if(job->retval && job->err != ECANCELED) {
+		show_message(job->tv, GTK_MESSAGE_ERROR,
+				"Error exporting to %s: %s", job->filename,
+				g_strerror(job->err));
+	} else if(!job->retval) {
+		g_debug("export: %d entries in %.3fs",
+				g_atomic_int_get(&job->progress.total),
+				g_timer_elapsed(job->timer, NULL));
+	}
+
+	gtk_widget_destroy(job->dialog);
+	if(!--job->file->exports && job->file->closed)
+		db_file_free(job->file);
+	g_timer_destroy(job->timer);
+	g_free(job->filename);
+	g_free(job->tmp);
+	g_free(job);
+	return FALSE;
+}
+
+/* Write the entries of the file or group at the cursor to a CSV or JSON
+ * file, on the export pool, with a dialog showing how far it's got */
+void menu_export(GtkWidget *widget, gpointer callback_data) {
+	GtkTreeView *tv = GTK_TREE_VIEW(callback_data);
+	GtkTreeModel *ts = tv_store(tv);
+	GtkWidget *chooser, *label, *box;
+	GtkFileFilter *csv, *json;
+	GtkTreeRowReference *row;
+	GtkTreePath *path;
+	GtkTreeIter iter, file_iter;
+	struct export_job *job;
+	gpointer load;
+	struct db_file *file;
+	gpointer st;
+	guint type;
+	char *filename, *tmp, *title, *text;
+	int group = -1, format, fd;
+
+	if(!cursor_iter(tv, &iter, FALSE)) return;
+
+	gtk_tree_model_get(ts, &iter,
+			TL_TYPE, &type,
+			TL_STRUCT, &st,
+			-1);
+	file_row(ts, &iter, &file_iter);
+	gtk_tree_model_get(ts, &file_iter, TL_TITLE, &title, -1);
+
+	if(type == TYPE_GROUP) {
+		g_free(title);
+		title = g_strdup(((kpass_group*)st)->name ?
+				((kpass_group*)st)->name : "group");
+		g_strdelimit(title, "/", '_');
+	} else if(strrchr(title, '.')) {
+		*strrchr(title, '.') = '\0';
+	}
+	text = g_strdup_printf("%s.csv", title);
+	g_free(title);
+
+	/* The row could go away while the dialog is up */
+	path = gtk_tree_model_get_path(ts, &iter);
+	row = gtk_tree_row_reference_new(ts, path);
+	gtk_tree_path_free(path);
+
+	chooser = gtk_file_chooser_dialog_new(type == TYPE_GROUP ?
+			"Export Group" : "Export File",
+			GTK_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(tv))),
+			GTK_FILE_CHOOSER_ACTION_SAVE,
+			GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+			GTK_STOCK_SAVE, GTK_RESPONSE_ACCEPT,
+			NULL);
+	gtk_file_chooser_set_do_overwrite_confirmation(
+			GTK_FILE_CHOOSER(chooser), TRUE);
+	gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(chooser), text);
+	g_free(text);
+
+	csv = gtk_file_filter_new();
+	gtk_file_filter_set_name(csv, "CSV (*.csv)");
+	gtk_file_filter_add_pattern(csv, "*.csv");
+	gtk_file_chooser_add_filter(GTK_FILE_CHOOSER(chooser), csv);
+	json = gtk_file_filter_new();
+	gtk_file_filter_set_name(json, "JSON (*.json)");
+	gtk_file_filter_add_pattern(json, "*.json");
+	gtk_file_chooser_add_filter(GTK_FILE_CHOOSER(chooser), json);
+
+	label = gtk_label_new("Passwords are written out unencrypted.");
+	gtk_file_chooser_set_extra_widget(GTK_FILE_CHOOSER(chooser), label);
+
+	if(gtk_dialog_run(GTK_DIALOG(chooser)) != GTK_RESPONSE_ACCEPT) {
+		gtk_widget_destroy(chooser);
+		gtk_tree_row_reference_free(row);
+		return;
+	}
+	filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(chooser));
+	format = g_str_has_suffix(filename, ".json") ||
+		gtk_file_chooser_get_filter(GTK_FILE_CHOOSER(chooser)) == json
+		? EXPORT_JSON : EXPORT_CSV;
+	gtk_widget_destroy(chooser);
+
+	path = gtk_tree_row_reference_get_path(row);
+	gtk_tree_row_reference_free(row);
+	if(!path) {
+		g_free(filename);
+		return;
+	}
+	gtk_tree_model_get_iter(ts, &iter, path);
+	gtk_tree_path_free(path);
+
+	gtk_tree_model_get(ts, &iter,
+			TL_TYPE, &type,
+			TL_STRUCT, &st,
+			-1);
+	file_row(ts, &iter, &file_iter);
+	gtk_tree_model_get(ts, &file_iter,
+			TL_DB_FILE, &file,
+			TL_JOB, &load,
+			-1);
+
+	/* Still loading, or reloading, which would free what we'd read */
+	if(!file || load) {
+		gdk_beep();
+		g_free(filename);
+		return;
+	}
+	/* The worker walks the tree, so it has to be there already */
+	if(!db_file_tree(file)) {
+		show_message(tv, GTK_MESSAGE_ERROR, "Error exporting to %s: %s",
+				filename, g_strerror(ENOMEM));
+		g_free(filename);
+		return;
+	}
+	if(type == TYPE_GROUP) {
+		group = db_tree_group_index(file->tree, st);
+		if(group < 0) {
+			show_message(tv, GTK_MESSAGE_ERROR,
+					"Error exporting to %s: the group is "
+					"no longer in the database", filename);
+			g_free(filename);
+			return;
+		}
+	}
+
+	/* mkstemp() makes it 0600 whatever the file it replaces allowed,
+	 * and next to it so rename() can't cross filesystems */
+	tmp = g_strdup_printf("%s.XXXXXX", filename);
+	fd = mkstemp(tmp);
+	if(fd < 0) {
+		show_message(tv, GTK_MESSAGE_ERROR, "Error opening file: %s",
+				g_strerror(errno));
+		g_free(filename);
+		g_free(tmp);
+		return;
+	}
+
+	job = g_new0(struct export_job, 1);
+	job->tv = tv;
+	job->file = file;
+	job->group = group;
+	job->format = format;
+	job->fd = fd;
+	job->filename = filename;
+	job->tmp = tmp;
+	job->timer = g_timer_new();
+
+	/* Not destroyed with the main window, export_done() does that */
+	job->dialog = gtk_dialog_new_with_buttons("Exporting",
+			GTK_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(tv))),
+			0, GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL, NULL);
+	text = g_strdup_printf("Exporting to %s", filename);
+	label = gtk_label_new(text);
+	g_free(text);
+	gtk_misc_set_alignment(GTK_MISC(label), 0, 0.5);
+	job->bar = gtk_progress_bar_new();
+	box = gtk_dialog_get_content_area(GTK_DIALOG(job->dialog));
+	gtk_container_set_border_width(GTK_CONTAINER(box), 6);
+	gtk_box_pack_start(GTK_BOX(box), label, FALSE, TRUE, 6);
+	gtk_box_pack_start(GTK_BOX(box), job->bar, FALSE, TRUE, 6);
+	g_signal_connect(job->dialog, "response",
+			G_CALLBACK(export_response), job);
+	gtk_widget_show_all(job->dialog);
+
+	job->poll = g_timeout_add(EXPORT_POLL_MS, export_poll, job);
+	file->exports++;
+	export_jobs = g_slist_prepend(export_jobs, job);
+	g_thread_pool_push(export_pool, job, NULL);
+}
+
+void export_ui_init(void) {
+	export_pool = g_thread_pool_new(export_worker, NULL, 1, FALSE, NULL);
+}
+
+void export_ui_shutdown(void) {
+	struct export_job *job;
+
+	g_thread_pool_free(export_pool, FALSE, TRUE);
+	export_pool = NULL;
+
+	/* Every worker is done, so what's left is waiting on the main loop */
+	while(export_jobs) {
+		job = export_jobs->data;
+		g_idle_remove_by_data(job);
+		export_done(job);
+	}
+}
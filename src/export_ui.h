@@ -0,0 +1,38 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GTKPASS_EXPORT_UI_H
+#define GTKPASS_EXPORT_UI_H
+
+#include <gtk/gtk.h>
+
+#include "db.h"
+
+/* Start and stop the pool exports run on.  Shutting down waits for the
+ * exports that are running and cleans up after them. */
+void export_ui_init(void);
+void export_ui_shutdown(void);
+
+/* Write the entries of the file or group at the cursor to a CSV or JSON
+ * file, on the export pool, with a dialog showing how far it's got */
+void menu_export(GtkWidget *widget, gpointer callback_data);
+
+/* Cancel the exports reading file, which stays around until they're done */
+void cancel_exports(struct db_file *file);
+
+#endif
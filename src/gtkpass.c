@@ -28,37 +28,285 @@
 #include <string.h>
 #include <errno.h>
 #include <libgen.h>
+#include <time.h>
 
 #include <kpass.h>
 
 #include "config.h"
-
+#include "db.h"
+#include "search.h"
+#include "cli.h"
+#include "agent.h"
+#include "store.h"
+#include "profile.h"
+#include "intern.h"
+#include "input.h"
+#include "ui.h"
+#include "merge_ui.h"
+#include "audit_ui.h"
+#include "export_ui.h"
+
+/* Fields read straight out of a row's kpass struct by row_field() */
 enum {
-	TL_TYPE,
-	TL_TITLE,
-	TL_TITLE_WEIGHT,
-	TL_USERNAME,
-	TL_PASSWORD,
-	TL_URL,
-	TL_MTIME,
-	TL_MTIME_EPOCH,
-	TL_STRUCT,
-	TL_META_INFO,
-	TL_PW_HASH,
-	TL_FILENAME,
+	FIELD_TITLE,
+	FIELD_USERNAME,
+	FIELD_PASSWORD,
+	FIELD_URL,
 };
 
-enum {
-	TYPE_FILE,
-	TYPE_GROUP,
-	TYPE_ENTRY,
-};
 
-enum {
-	SORTID_GROUPS_ON_TOP,
-};
 
+/* Groups and entries only store a pointer to their kpass struct, so the
+ * strings shown for them are looked up here rather than copied into the
+ * store.  Rows without a struct (files, pending loads) keep their title in
+ * TL_TITLE.  Returns a newly allocated string or NULL. */
+gchar *row_field(GtkTreeModel *model, GtkTreeIter *iter, int field) {
+	guint type;
+	gpointer st;
+	struct kpass_entry *entry;
+	gchar *val = NULL;
+
+	gtk_tree_model_get(model, iter,
+			TL_TYPE, &type,
+			TL_STRUCT, &st,
+			-1);
+
+	if(type == TYPE_ENTRY) {
+		entry = st;
+		switch(field) {
+			case FIELD_TITLE:
+				val = g_strdup(entry->title);
+				break;
+			case FIELD_USERNAME:
+				val = g_strdup(entry->username);
+				break;
+			case FIELD_PASSWORD:
+				val = g_strdup(entry->password);
+				break;
+			case FIELD_URL:
+				val = g_strdup(entry->url);
+				break;
+		}
+	} else if(type == TYPE_GROUP) {
+		if(field == FIELD_TITLE)
+			val = g_strdup(((struct kpass_group*)st)->name);
+	} else if(field == FIELD_TITLE) {
+		gtk_tree_model_get(model, iter,
+				TL_TITLE, &val,
+				-1);
+	}
+
+	return val;
+}
+
+void render_field(GtkTreeViewColumn *col, GtkCellRenderer *renderer,
+		GtkTreeModel *model, GtkTreeIter *iter, gpointer data) {
+	int field = GPOINTER_TO_INT(data);
+	GtkTreeIter file;
+	gboolean editable;
+	kpass_db *db;
+	guint type;
+	gchar *val;
+
+	val = row_field(model, iter, field);
+	gtk_tree_model_get(model, iter, TL_TYPE, &type, -1);
+
+	/* Groups have nothing but a name to edit, and files still loading
+	 * or read from KDBX nothing at all */
+	editable = type == TYPE_ENTRY ||
+		(type == TYPE_GROUP && field == FIELD_TITLE);
+	if(editable) {
+		file_row(model, iter, &file);
+		gtk_tree_model_get(model, &file, TL_STRUCT, &db, -1);
+		editable = db && !db_read_only(db);
+	}
+
+	g_object_set(renderer,
+			"text", val,
+			"editable", editable,
+			NULL);
+	g_free(val);
+}
+
+/* Cell data functions only run for rows the view shows, so times are
+ * formatted for those and never stored */
+void render_mtime(GtkTreeViewColumn *col, GtkCellRenderer *renderer,
+		GtkTreeModel *model, GtkTreeIter *iter, gpointer data) {
+	static const uint8_t never_set[5];
+	const uint8_t *mtime = NULL;
+	struct tm tms;
+	char text[32] = "";
+	gpointer st;
+	guint type;
+
+	gtk_tree_model_get(model, iter,
+			TL_TYPE, &type,
+			TL_STRUCT, &st,
+			-1);
+
+	if(type == TYPE_ENTRY)
+		mtime = ((struct kpass_entry*)st)->mtime;
+	else if(type == TYPE_GROUP)
+		mtime = ((struct kpass_group*)st)->mtime;
+
+	if(mtime && memcmp(mtime, never_set, sizeof(never_set))) {
+		memset(&tms, 0, sizeof(tms));
+		kpass_unpack_time(mtime, &tms);
+		strftime(text, sizeof(text), "%Y-%m-%d %H:%M", &tms);
+	}
+
+	g_object_set(renderer, "text", text, NULL);
+}
+
+/* Typeahead on titles; like GTK's default this returns FALSE on a match */
+gboolean search_title(GtkTreeModel *model, gint column, const gchar *key,
+		GtkTreeIter *iter, gpointer data) {
+	gchar *title, *norm_title, *fold_title, *norm_key, *fold_key;
+	gboolean ret = TRUE;
+
+	title = row_field(model, iter, FIELD_TITLE);
+	if(!title)
+		return TRUE;
+
+	norm_title = g_utf8_normalize(title, -1, G_NORMALIZE_ALL);
+	norm_key = g_utf8_normalize(key, -1, G_NORMALIZE_ALL);
+	if(norm_title && norm_key) {
+		fold_title = g_utf8_casefold(norm_title, -1);
+		fold_key = g_utf8_casefold(norm_key, -1);
+		ret = strncmp(fold_key, fold_title, strlen(fold_key)) != 0;
+		g_free(fold_title);
+		g_free(fold_key);
+	}
+
+	g_free(norm_title);
+	g_free(norm_key);
+	g_free(title);
+	return ret;
+}
+
+/* Rows to show while searching, or NULL to show everything */
+static GHashTable *search_matches;
+static GtkWidget *search_entry;
+
+gboolean search_visible(GtkTreeModel *ts, GtkTreeIter *iter, gpointer data) {
+	gpointer st;
+
+	if(!search_matches)
+		return TRUE;
+
+	gtk_tree_model_get(ts, iter,
+			TL_STRUCT, &st,
+			-1);
+
+	return st && g_hash_table_lookup(search_matches, st);
+}
+
+/* The view shows the store through a filter for the search bar */
+GtkTreeModel *new_filter(GtkTreeModel *ts) {
+	GtkTreeModel *filter;
+
+	filter = gtk_tree_model_filter_new(ts, NULL);
+	gtk_tree_model_filter_set_visible_func(GTK_TREE_MODEL_FILTER(filter),
+			search_visible, NULL, NULL);
+	return filter;
+}
+
+/* Fill in every group on the way to a match, so the filter has rows to
+ * show for them */
+void fill_matches(GtkTreeStore *ts, GtkTreeIter *parent) {
+	GtkTreeIter iter;
+	gpointer st;
+	guint type;
+	gboolean valid;
+
+	valid = gtk_tree_model_iter_children(GTK_TREE_MODEL(ts), &iter, parent);
+	while(valid) {
+		gtk_tree_model_get(GTK_TREE_MODEL(ts), &iter,
+				TL_TYPE, &type,
+				TL_STRUCT, &st,
+				-1);
+		if(type != TYPE_ENTRY && st &&
+				g_hash_table_lookup(search_matches, st)) {
+			if(type == TYPE_GROUP)
+				fill_group(ts, &iter);
+			fill_matches(ts, &iter);
+		}
+		valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(ts), &iter);
+	}
+}
+
+/* Run the search bar's query against every open file and refilter */
+void search_refresh(GtkTreeView *tv) {
+	GtkTreeModel *filter = gtk_tree_view_get_model(tv);
+	GtkTreeModel *ts = tv_store(tv);
+	GtkTreeIter iter;
+	search_index *index;
+	struct db_file *file;
+	const gchar *query;
+	GTimer *timer;
+	gboolean valid;
+	int found = 0;
+
+	if(!filter || !search_entry)
+		return;
+
+	timer = g_timer_new();
+
+	if(search_matches)
+		g_hash_table_destroy(search_matches);
+	search_matches = NULL;
+
+	query = gtk_entry_get_text(GTK_ENTRY(search_entry));
+	if(*query) {
+		search_matches = g_hash_table_new(g_direct_hash,
+				g_direct_equal);
+		valid = gtk_tree_model_get_iter_first(ts, &iter);
+		while(valid) {
+			gtk_tree_model_get(ts, &iter,
+					TL_SEARCH, &index,
+					TL_DB_FILE, &file,
+					-1);
+			/* Edits throw the index away, it's rebuilt here */
+			if(!index && file) {
+				index = search_index_new(file->db);
+				gtk_tree_store_set(GTK_TREE_STORE(ts), &iter,
+						TL_SEARCH, index,
+						-1);
+			}
+			if(index)
+				found += search_index_query(index, query,
+						search_matches);
+			valid = gtk_tree_model_iter_next(ts, &iter);
+		}
+	}
+
+	if(search_matches)
+		fill_matches(GTK_TREE_STORE(ts), NULL);
+
+	gtk_tree_model_filter_refilter(GTK_TREE_MODEL_FILTER(filter));
+	if(search_matches)
+		gtk_tree_view_expand_all(tv);
+
+	g_debug("search: %d matches in %.3fs", found,
+			g_timer_elapsed(timer, NULL));
+	g_timer_destroy(timer);
+}
+
+void search_changed(GtkEditable *editable, gpointer data) {
+	search_refresh(GTK_TREE_VIEW(data));
+}
+
+/* Groups only get rows for their children the first time they're opened */
+gboolean expand_row(GtkTreeView *tv, GtkTreeIter *iter, GtkTreePath *path,
+		gpointer data) {
+	GtkTreeIter store_iter;
 
+	gtk_tree_model_filter_convert_iter_to_child_iter(
+			GTK_TREE_MODEL_FILTER(gtk_tree_view_get_model(tv)),
+			&store_iter, iter);
+	fill_group(GTK_TREE_STORE(tv_store(tv)), &store_iter);
+	return FALSE;
+}
 
 gboolean walkprint(GtkTreeModel *model,
 			GtkTreePath *path,
@@ -67,8 +315,8 @@ gboolean walkprint(GtkTreeModel *model,
 	gchar *name, *tree_path_str;
 	guint name_weight;
 
+	name = row_field(model, iter, FIELD_TITLE);
 	gtk_tree_model_get(model, iter,
-			TL_TITLE, &name,
 			TL_TITLE_WEIGHT, &name_weight,
 			-1);
 	tree_path_str = gtk_tree_path_to_string(path);
@@ -78,225 +326,1704 @@ gboolean walkprint(GtkTreeModel *model,
 
 	g_free(tree_path_str);
 
-	g_free(name);
+	g_free(name);
+
+	return FALSE;
+}
+
+
+/* An open or reload running on the load pool.  The worker only fills in
+ * file, retval and err; everything touching the store happens in load_done()
+ * back on the main loop. */
+struct load_job {
+	GtkTreeView *tv;
+	GtkTreeRowReference *row;
+	char *filename;
+	char *pass;
+	uint8_t *pw_hash;
+	struct db_file *file;
+	search_index *index;
+	int retval;
+	int err;
+	gboolean background;
+	volatile gint cancelled;
+	double started;
+	struct load_profile profile;
+
+	/* First loads of KDBX files put their top level rows up as they
+	 * arrive.  The worker sets streamed once it has sent a batch, and
+	 * leaves db with only the header. */
+	gboolean stream;
+	gboolean streamed;
+	kpass_db *db;
+
+	/* Only touched on the main loop: what has arrived so far, the rows
+	 * of the top level groups, which of those each group is under and
+	 * the groups that can still get children.  Anything deeper gets its
+	 * row from fill_group() once the file is done, as loads that don't
+	 * stream do. */
+	GPtrArray *groups;
+	GPtrArray *entries;
+	GPtrArray *group_rows;
+	GArray *tops;
+	GArray *open_groups;
+};
+
+/* Groups and entries the worker parsed, on their way to the main loop */
+struct load_batch {
+	struct load_job *job;
+	GPtrArray *groups;
+	GPtrArray *entries;
+};
+
+/* A TYPE_FILE row being watched for changes on disk */
+struct file_watch {
+	GtkTreeView *tv;
+	GtkTreeRowReference *row;
+	guint timeout;
+};
+
+/* How long a changed file has to stay quiet before it's reloaded */
+#define WATCH_DELAY_MS 1000
+
+/* A TYPE_FILE row that has been edited, kept in TL_SAVE */
+struct save_state {
+	GtkTreeView *tv;
+	GtkTreeRowReference *row;
+	guint timeout;
+	gboolean running;
+	gboolean again;
+};
+
+/* A save running on the save pool.  It works on its own copy of the
+ * database, so editing can go on meanwhile. */
+struct save_job {
+	GtkTreeView *tv;
+	GtkTreeRowReference *row;
+	char *filename;
+	uint8_t *pw_hash;
+	kpass_db *db;
+	struct stat written;
+	int retval;
+	int err;
+};
+
+/* How long edits have to stop coming before they're saved */
+#define SAVE_DELAY_MS 2000
+
+static GThreadPool *load_pool;
+static GThreadPool *save_pool;
+
+/* Saves that haven't finished, main loop only */
+static GSList *save_jobs;
+
+void prompt_and_load(GtkTreeView *tv, char *filename, gboolean use_agent);
+gboolean load_done(gpointer data);
+gboolean save_done(gpointer data);
+gboolean save_pending(struct save_state *state);
+void load_db_to_ts(GtkTreeView *tv, GtkTreeIter *iter, char *filename,
+		const char *pass, const uint8_t *pw_hash, gboolean background);
+
+/* Streamed rows go in unsorted while any load is streaming, and the
+ * store is sorted once when the last one is done */
+static int streaming_loads;
+static gint stream_sort_id;
+static GtkSortType stream_order;
+
+void pause_sorting(GtkTreeModel *ts) {
+	if(streaming_loads++)
+		return;
+	store_get_sort(GTK_TREE_STORE(ts), &stream_sort_id, &stream_order);
+	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(ts),
+			GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID,
+			GTK_SORT_ASCENDING);
+}
+
+void resume_sorting(GtkTreeModel *ts) {
+	if(--streaming_loads)
+		return;
+	store_set_sort(GTK_TREE_STORE(ts), stream_sort_id, stream_order);
+}
+
+/* The filter in front of the store can't sort, so the column headers sort
+ * the store themselves.  Clicking the sorted column again reverses it.
+ * While sorting is paused the choice waits for resume_sorting(). */
+void column_clicked(GtkTreeViewColumn *col, gpointer data) {
+	GtkTreeView *tv = GTK_TREE_VIEW(data);
+	GtkTreeStore *ts = GTK_TREE_STORE(tv_store(tv));
+	GList *cols, *l;
+	GtkSortType order;
+	gint id, sort_id;
+
+	id = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(col), "sort-id"));
+	if(streaming_loads) {
+		sort_id = stream_sort_id;
+		order = stream_order;
+	} else {
+		store_get_sort(ts, &sort_id, &order);
+	}
+
+	if(sort_id == id && order == GTK_SORT_ASCENDING)
+		order = GTK_SORT_DESCENDING;
+	else
+		order = GTK_SORT_ASCENDING;
+
+	if(streaming_loads) {
+		stream_sort_id = id;
+		stream_order = order;
+	} else {
+		store_set_sort(ts, id, order);
+	}
+
+	cols = gtk_tree_view_get_columns(tv);
+	for(l = cols; l; l = l->next)
+		gtk_tree_view_column_set_sort_indicator(l->data,
+				l->data == col);
+	g_list_free(cols);
+	gtk_tree_view_column_set_sort_order(col, order);
+}
+
+/* Let clicking the header of col sort the store with sort function id */
+void sort_by_column(GtkTreeView *tv, GtkTreeViewColumn *col, gint id) {
+	g_object_set_data(G_OBJECT(col), "sort-id", GINT_TO_POINTER(id));
+	gtk_tree_view_column_set_clickable(col, TRUE);
+	g_signal_connect(col, "clicked", G_CALLBACK(column_clicked), tv);
+}
+
+/* Done with the streamed rows of job.  Unless keep is set the structs
+ * they showed are freed too, their rows must be gone by then. */
+void end_stream(struct load_job *job, gboolean keep) {
+	guint i;
+
+	if(!job->groups)
+		return;
+
+	for(i = 0; !keep && i < job->groups->len; i++)
+		db_group_free(g_ptr_array_index(job->groups, i));
+	for(i = 0; !keep && i < job->entries->len; i++)
+		db_entry_free(g_ptr_array_index(job->entries, i));
+	g_ptr_array_free(job->groups, TRUE);
+	g_ptr_array_free(job->entries, TRUE);
+	job->groups = NULL;
+	job->entries = NULL;
+
+	for(i = 0; i < job->group_rows->len; i++)
+		gtk_tree_iter_free(g_ptr_array_index(job->group_rows, i));
+	g_ptr_array_free(job->group_rows, TRUE);
+	g_array_free(job->tops, TRUE);
+	g_array_free(job->open_groups, TRUE);
+
+	resume_sorting(tv_store(job->tv));
+}
+
+void free_load_job(struct load_job *job) {
+	end_stream(job, FALSE);
+	if(job->db) {
+		kpass_free_db(job->db);
+		free(job->db);
+	}
+	if(job->file)
+		db_file_free(job->file);
+	if(job->pass) {
+		memset(job->pass, 0, strlen(job->pass));
+		free(job->pass);
+	}
+	if(job->index)
+		search_index_free(job->index);
+	if(job->pw_hash) {
+		memset(job->pw_hash, 0, PW_HASH_LEN);
+		free(job->pw_hash);
+	}
+	g_free(job->filename);
+	if(job->row)
+		gtk_tree_row_reference_free(job->row);
+	g_free(job);
+}
+
+/* The file stopped changing, pick up the new contents with the hash we
+ * already have */
+gboolean file_settled(gpointer data) {
+	struct file_watch *watch = data;
+	GtkTreeModel *ts = tv_store(watch->tv);
+	GtkTreePath *path;
+	GtkTreeIter iter;
+	struct db_file *file;
+	struct load_job *job;
+	struct save_state *save;
+
+	path = gtk_tree_row_reference_get_path(watch->row);
+	if(!path) {
+		watch->timeout = 0;
+		return FALSE;
+	}
+	gtk_tree_model_get_iter(ts, &iter, path);
+	gtk_tree_path_free(path);
+
+	gtk_tree_model_get(ts, &iter,
+			TL_DB_FILE, &file,
+			TL_JOB, &job,
+			TL_SAVE, &save,
+			-1);
+
+	/* Let a load, save or export that's already running finish, then
+	 * try again */
+	if(job || (save && save->running) || (file && file->exports))
+		return TRUE;
+
+	/* Only our own save, nothing new to load */
+	if(file && db_file_unchanged(file->filename, &file->written)) {
+		watch->timeout = 0;
+		return FALSE;
+	}
+
+	/* Reloading now would throw away edits that aren't saved yet */
+	if(file && save_pending(save)) {
+		g_message("%s: changed on disk, keeping unsaved edits",
+				file->filename);
+		watch->timeout = 0;
+		return FALSE;
+	}
+
+	if(file)
+		load_db_to_ts(watch->tv, &iter, file->filename, NULL,
+				file->pw_hash, TRUE);
+
+	watch->timeout = 0;
+	return FALSE;
+}
+
+void file_changed(GFileMonitor *monitor, GFile *file, GFile *other_file,
+		GFileMonitorEvent event, gpointer data) {
+	struct file_watch *watch = data;
+
+	switch(event) {
+		case G_FILE_MONITOR_EVENT_CHANGED:
+		case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+		case G_FILE_MONITOR_EVENT_CREATED:
+			break;
+		default:
+			return;
+	}
+
+	/* Writers tend to come in bursts, wait for the file to settle */
+	if(watch->timeout)
+		g_source_remove(watch->timeout);
+	watch->timeout = g_timeout_add(WATCH_DELAY_MS, file_settled, watch);
+}
+
+void free_file_watch(gpointer data, GClosure *closure) {
+	struct file_watch *watch = data;
+
+	if(watch->timeout)
+		g_source_remove(watch->timeout);
+	gtk_tree_row_reference_free(watch->row);
+	g_free(watch);
+}
+
+/* Reload the TYPE_FILE row at iter in the background whenever its file
+ * changes.  The monitor lives in the row, so it goes away with it. */
+void watch_file(GtkTreeView *tv, GtkTreeIter *iter, char *filename) {
+	GtkTreeModel *ts = tv_store(tv);
+	GFileMonitor *monitor;
+	GFile *file;
+	GtkTreePath *path;
+	struct file_watch *watch;
+
+	/* Pipes and stdin have nothing to reload from */
+	if(!input_rereadable(filename))
+		return;
+
+	file = g_file_new_for_path(filename);
+	monitor = g_file_monitor_file(file, G_FILE_MONITOR_NONE, NULL, NULL);
+	g_object_unref(file);
+	if(!monitor)
+		return;
+
+	watch = g_new0(struct file_watch, 1);
+	watch->tv = tv;
+	path = gtk_tree_model_get_path(ts, iter);
+	watch->row = gtk_tree_row_reference_new(ts, path);
+	gtk_tree_path_free(path);
+
+	g_signal_connect_data(monitor, "changed", G_CALLBACK(file_changed),
+			watch, free_file_watch, 0);
+
+	gtk_tree_store_set(GTK_TREE_STORE(ts), iter,
+			TL_MONITOR, monitor,
+			-1);
+	g_object_unref(monitor);
+}
+
+void remove_pending_row(GtkTreeStore *ts, GtkTreeIter *parent) {
+	GtkTreeIter iter;
+	intern_set *keys;
+	guint type;
+	gboolean valid;
+
+	gtk_tree_store_set(ts, parent, TL_JOB, NULL, -1);
+	gtk_tree_model_get(GTK_TREE_MODEL(ts), parent, TL_KEYS, &keys, -1);
+
+	valid = gtk_tree_model_iter_children(GTK_TREE_MODEL(ts), &iter, parent);
+	while(valid) {
+		gtk_tree_model_get(GTK_TREE_MODEL(ts), &iter,
+				TL_TYPE, &type,
+				-1);
+		if(type == TYPE_PENDING) {
+			store_remove_row(ts, &iter, keys);
+			return;
+		}
+		valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(ts), &iter);
+	}
+}
+
+/* Map the kpass struct of every row under parent to a copy of its iter */
+void map_rows(GtkTreeModel *ts, GtkTreeIter *parent, GHashTable *rows) {
+	GtkTreeIter iter, next;
+	gpointer st;
+	int depth = 1;
+
+	if(!gtk_tree_model_iter_children(ts, &iter, parent))
+		return;
+
+	while(depth > 0) {
+		gtk_tree_model_get(ts, &iter,
+				TL_STRUCT, &st,
+				-1);
+		if(st)
+			g_hash_table_insert(rows, st, gtk_tree_iter_copy(&iter));
+
+		if(gtk_tree_model_iter_children(ts, &next, &iter)) {
+			iter = next;
+			depth++;
+			continue;
+		}
+
+		/* Climb until there's a sibling to move on to */
+		while(depth > 0) {
+			next = iter;
+			if(gtk_tree_model_iter_next(ts, &next)) {
+				iter = next;
+				break;
+			}
+			gtk_tree_model_iter_parent(ts, &next, &iter);
+			iter = next;
+			depth--;
+		}
+	}
+}
+
+gint64 parent_id(kpass_db *db, int *parents, int i) {
+	return parents[i] < 0 ? -1 : (gint64)db->groups[parents[i]]->id;
+}
+
+/* Bring the rows under a reloaded file up to date with new_db, touching
+ * only groups and entries that changed.  Rows that didn't change keep
+ * pointing at their struct from old_db, which is swapped into new_db for the
+ * new copy, so old_db can be freed afterwards either way.  Returns FALSE
+ * without touching anything if groups moved to different parents, in which
+ * case the caller has to rebuild the file's rows. */
+gboolean reload_rows(GtkTreeStore *ts, GtkTreeIter *file, kpass_db *old_db,
+		kpass_db *new_db, intern_set *keys) {
+	GHashTable *rows, *old_groups, *old_entries, *group_rows;
+	GtkTreeIter iter, *row, *parent_row;
+	kpass_group *group;
+	kpass_entry *entry;
+	int *old_parents, *new_parents;
+	char *seen_groups, *seen_entries;
+	int i, j, changed = 0;
+	gboolean ret = FALSE;
+
+	old_parents = group_parents(old_db);
+	new_parents = group_parents(new_db);
+	if(!old_parents || !new_parents) {
+		free(old_parents);
+		free(new_parents);
+		return FALSE;
+	}
+
+	old_groups = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for(j = 0; j < old_db->groups_len; j++)
+		g_hash_table_insert(old_groups,
+				GUINT_TO_POINTER(old_db->groups[j]->id),
+				GINT_TO_POINTER(j + 1));
+
+	old_entries = g_hash_table_new(uuid_hash, uuid_equal);
+	for(j = 0; j < old_db->entries_len; j++)
+		g_hash_table_insert(old_entries, old_db->entries[j]->uuid,
+				GINT_TO_POINTER(j + 1));
+
+	/* Groups that moved would need their whole subtree moved with them */
+	for(i = 0; i < new_db->groups_len; i++) {
+		j = GPOINTER_TO_INT(g_hash_table_lookup(old_groups,
+				GUINT_TO_POINTER(new_db->groups[i]->id))) - 1;
+		if(j >= 0 && parent_id(old_db, old_parents, j) !=
+				parent_id(new_db, new_parents, i))
+			goto reload_rows_out;
+	}
+
+	rows = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+			(GDestroyNotify)gtk_tree_iter_free);
+	map_rows(GTK_TREE_MODEL(ts), file, rows);
+
+	group_rows = g_hash_table_new(g_direct_hash, g_direct_equal);
+	seen_groups = calloc(old_db->groups_len + 1, 1);
+	seen_entries = calloc(old_db->entries_len + 1, 1);
+
+	for(i = 0; i < new_db->groups_len; i++) {
+		group = new_db->groups[i];
+		j = GPOINTER_TO_INT(g_hash_table_lookup(old_groups,
+				GUINT_TO_POINTER(group->id))) - 1;
+		row = (j >= 0 && !seen_groups[j]) ?
+			g_hash_table_lookup(rows, old_db->groups[j]) : NULL;
+
+		if(row) {
+			seen_groups[j] = 1;
+			if(same_group(old_db->groups[j], group)) {
+				new_db->groups[i] = old_db->groups[j];
+				old_db->groups[j] = group;
+			} else {
+				set_group_row(ts, row, group, keys);
+				changed++;
+			}
+		} else {
+			if(new_parents[i] < 0)
+				parent_row = file;
+			else
+				parent_row = g_hash_table_lookup(group_rows,
+					GUINT_TO_POINTER(new_db->groups[
+						new_parents[i]]->id));
+			if(!parent_row)
+				continue;
+
+			gtk_tree_store_append(ts, &iter, parent_row);
+			set_group_row(ts, &iter, group, keys);
+			row = gtk_tree_iter_copy(&iter);
+			g_hash_table_insert(rows, group, row);
+			changed++;
+		}
+		/* Children of groups nobody has opened yet come from
+		 * new_db when they are */
+		if(group_filled(ts, row))
+			g_hash_table_insert(group_rows,
+					GUINT_TO_POINTER(group->id), row);
+	}
+
+	for(i = 0; i < new_db->entries_len; i++) {
+		entry = new_db->entries[i];
+		j = GPOINTER_TO_INT(g_hash_table_lookup(old_entries,
+				entry->uuid)) - 1;
+		if(j >= 0 && seen_entries[j])
+			j = -1;
+		row = (j >= 0) ?
+			g_hash_table_lookup(rows, old_db->entries[j]) : NULL;
+		if(j >= 0)
+			seen_entries[j] = 1;
+
+		if(row && old_db->entries[j]->group_id == entry->group_id) {
+			if(same_entry(old_db->entries[j], entry)) {
+				new_db->entries[i] = old_db->entries[j];
+				old_db->entries[j] = entry;
+			} else {
+				set_entry_row(ts, row, entry, keys);
+				changed++;
+			}
+			continue;
+		}
+
+		/* New, or moved to another group */
+		if(row) {
+			store_remove_row(ts, row, keys);
+			changed++;
+		}
+		parent_row = g_hash_table_lookup(group_rows,
+				GUINT_TO_POINTER(entry->group_id));
+		if(parent_row) {
+			gtk_tree_store_append(ts, &iter, parent_row);
+			set_entry_row(ts, &iter, entry, keys);
+			changed++;
+		}
+	}
+
+	for(j = 0; j < old_db->entries_len; j++) {
+		if(seen_entries[j])
+			continue;
+		row = g_hash_table_lookup(rows, old_db->entries[j]);
+		if(row) {
+			store_remove_row(ts, row, keys);
+			changed++;
+		}
+	}
+
+	/* Backwards, so subgroups go before the groups holding them */
+	for(j = old_db->groups_len - 1; j >= 0; j--) {
+		if(seen_groups[j])
+			continue;
+		row = g_hash_table_lookup(rows, old_db->groups[j]);
+		if(row) {
+			store_remove_row(ts, row, keys);
+			changed++;
+		}
+	}
+
+	g_debug("reload: %d of %d rows changed", changed,
+			new_db->groups_len + new_db->entries_len);
+
+	free(seen_groups);
+	free(seen_entries);
+	g_hash_table_destroy(group_rows);
+	g_hash_table_destroy(rows);
+	ret = TRUE;
+
+reload_rows_out:
+	g_hash_table_destroy(old_entries);
+	g_hash_table_destroy(old_groups);
+	free(old_parents);
+	free(new_parents);
+	return ret;
+}
+
+/* What the view loses when its model is taken away */
+struct view_state {
+	GList *expanded;
+	GtkTreeRowReference *cursor;
+	gint sort_id;
+	GtkSortType order;
+};
+
+/* Remember expanded rows by their place in the store, the filter in front
+ * of it doesn't survive detach_model() */
+void save_expanded_row(GtkTreeView *tv, GtkTreePath *path, gpointer data) {
+	struct view_state *state = data;
+	GtkTreePath *store_path;
+
+	store_path = gtk_tree_model_filter_convert_path_to_child_path(
+			GTK_TREE_MODEL_FILTER(gtk_tree_view_get_model(tv)), path);
+	if(!store_path)
+		return;
+
+	state->expanded = g_list_prepend(state->expanded,
+		gtk_tree_row_reference_new(tv_store(tv), store_path));
+	gtk_tree_path_free(store_path);
+}
+
+/* Take the model away from the view and turn sorting off, so bulk inserts
+ * don't reposition every new row and signal the view about it.  The
+ * search filter is dropped along with it so it doesn't see them either;
+ * attach_model() puts a new one in. */
+void detach_model(GtkTreeView *tv, struct view_state *state) {
+	GtkTreeModel *ts = tv_store(tv);
+	GtkTreePath *path;
+	GtkTreeIter iter;
+
+	state->expanded = NULL;
+	state->cursor = NULL;
+
+	gtk_tree_view_map_expanded_rows(tv, save_expanded_row, state);
+	state->expanded = g_list_reverse(state->expanded);
+
+	if(cursor_iter(tv, &iter, FALSE)) {
+		path = gtk_tree_model_get_path(ts, &iter);
+		state->cursor = gtk_tree_row_reference_new(ts, path);
+		gtk_tree_path_free(path);
+	}
+
+	gtk_tree_view_set_model(tv, NULL);
+
+	gtk_tree_sortable_get_sort_column_id(GTK_TREE_SORTABLE(ts),
+			&state->sort_id, &state->order);
+	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(ts),
+			GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, state->order);
+}
+
+/* Sort once, hand the model back and restore what the user had open */
+void attach_model(GtkTreeView *tv, GtkTreeModel *ts, struct view_state *state) {
+	GtkTreeModel *filter;
+	GtkTreePath *path, *store_path;
+	GList *l;
+
+	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(ts),
+			state->sort_id, state->order);
+
+	filter = new_filter(ts);
+	gtk_tree_view_set_model(tv, filter);
+	g_object_unref(filter);
+
+	for(l = state->expanded; l; l = l->next) {
+		store_path = gtk_tree_row_reference_get_path(l->data);
+		if(store_path) {
+			path = view_path(tv, store_path);
+			if(path) {
+				gtk_tree_view_expand_row(tv, path, FALSE);
+				gtk_tree_path_free(path);
+			}
+			gtk_tree_path_free(store_path);
+		}
+		gtk_tree_row_reference_free(l->data);
+	}
+	g_list_free(state->expanded);
+
+	if(state->cursor) {
+		store_path = gtk_tree_row_reference_get_path(state->cursor);
+		if(store_path) {
+			path = view_path(tv, store_path);
+			if(path) {
+				gtk_tree_view_set_cursor(tv, path, NULL,
+						FALSE);
+				gtk_tree_path_free(path);
+			}
+			gtk_tree_path_free(store_path);
+		}
+		gtk_tree_row_reference_free(state->cursor);
+	}
+}
+
+/* Let the unlock agent, if one is running, skip the prompt next time */
+void remember_hash(char *filename, uint8_t *pw_hash) {
+	char *name;
+
+	name = agent_hash_name(filename);
+	if(name)
+		agent_put(name, pw_hash, PW_HASH_LEN);
+	free(name);
+}
+
+/* Trace the stages load_db() timed, one after another from start */
+void trace_load_db(struct load_job *job, double start) {
+	struct load_timing *t = &job->profile.timing;
+
+	profile_event("map", job->filename, start, t->map);
+	start += t->map;
+	profile_event("init", job->filename, start, t->init);
+	start += t->init;
+	profile_event("hash", job->filename, start, t->hash);
+	start += t->hash;
+	profile_event("decrypt", job->filename, start, t->decrypt);
+}
+
+/* Give the top level group row that streamed group i is under a
+ * placeholder, now that it has something to show when expanded */
+void stream_placeholder(struct load_job *job, GtkTreeStore *ts, int i) {
+	GtkTreeIter *row;
+
+	row = g_ptr_array_index(job->group_rows,
+			g_array_index(job->tops, int, i));
+	if(!gtk_tree_model_iter_has_child(GTK_TREE_MODEL(ts), row))
+		add_placeholder(ts, row);
+}
+
+/* Put up rows for the top level groups in a batch of streamed groups and
+ * entries, and keep the rest for finish_stream().  Groups come parent
+ * first and entries after their group, so the parents are always there
+ * already. */
+gboolean load_batch_done(gpointer data) {
+	struct load_batch *batch = data;
+	struct load_job *job = batch->job;
+	GtkTreeModel *ts;
+	GtkTreePath *path;
+	GtkTreeIter file, iter;
+	intern_set *keys;
+	kpass_group *g;
+	kpass_entry *e;
+	guint i;
+	int top = 0;
+
+	/* The row is gone, nothing will show these */
+	if(g_atomic_int_get(&job->cancelled)) {
+		for(i = 0; i < batch->groups->len; i++)
+			db_group_free(g_ptr_array_index(batch->groups, i));
+		for(i = 0; i < batch->entries->len; i++)
+			db_entry_free(g_ptr_array_index(batch->entries, i));
+		goto load_batch_out;
+	}
+
+	ts = tv_store(job->tv);
+	path = gtk_tree_row_reference_get_path(job->row);
+	gtk_tree_model_get_iter(ts, &file, path);
+	gtk_tree_path_free(path);
+	gtk_tree_model_get(ts, &file, TL_KEYS, &keys, -1);
+
+	if(!job->groups) {
+		job->groups = g_ptr_array_new();
+		job->entries = g_ptr_array_new();
+		job->group_rows = g_ptr_array_new();
+		job->tops = g_array_new(FALSE, FALSE, sizeof(int));
+		job->open_groups = g_array_new(FALSE, FALSE, sizeof(int));
+		pause_sorting(ts);
+	}
+
+	for(i = 0; i < batch->groups->len; i++) {
+		g = g_ptr_array_index(batch->groups, i);
+
+		/* The parent is the closest earlier group a level up */
+		while(job->open_groups->len) {
+			top = g_array_index(job->open_groups, int,
+					job->open_groups->len - 1);
+			if(((kpass_group*)g_ptr_array_index(job->groups,
+						top))->level < g->level)
+				break;
+			g_array_set_size(job->open_groups,
+					job->open_groups->len - 1);
+		}
+
+		if(job->open_groups->len) {
+			stream_placeholder(job, GTK_TREE_STORE(ts), top);
+			g_array_append_val(job->tops,
+					g_array_index(job->tops, int, top));
+		} else {
+			gtk_tree_store_append(GTK_TREE_STORE(ts), &iter,
+					&file);
+			set_group_row(GTK_TREE_STORE(ts), &iter, g, keys);
+			g_array_append_val(job->tops, job->group_rows->len);
+			g_ptr_array_add(job->group_rows,
+					gtk_tree_iter_copy(&iter));
+		}
+		g_array_append_val(job->open_groups, job->groups->len);
+		g_ptr_array_add(job->groups, g);
+	}
+
+	for(i = 0; i < batch->entries->len; i++) {
+		e = g_ptr_array_index(batch->entries, i);
+		stream_placeholder(job, GTK_TREE_STORE(ts), e->group_id - 1);
+		g_ptr_array_add(job->entries, e);
+	}
+
+load_batch_out:
+	g_ptr_array_free(batch->groups, TRUE);
+	g_ptr_array_free(batch->entries, TRUE);
+	g_free(batch);
+	return FALSE;
+}
+
+/* kdbx_batch_func for streaming loads, runs on the worker */
+void load_batch(kpass_group **groups, int groups_len, kpass_entry **entries,
+		int entries_len, void *data) {
+	struct load_batch *batch;
+	int i;
+
+	batch = g_new(struct load_batch, 1);
+	batch->job = data;
+	batch->groups = g_ptr_array_sized_new(groups_len);
+	batch->entries = g_ptr_array_sized_new(entries_len);
+	for(i = 0; i < groups_len; i++)
+		g_ptr_array_add(batch->groups, groups[i]);
+	for(i = 0; i < entries_len; i++)
+		g_ptr_array_add(batch->entries, entries[i]);
+
+	batch->job->streamed = TRUE;
+	g_idle_add(load_batch_done, batch);
+}
+
+void load_worker(gpointer data, gpointer user_data) {
+	struct load_job *job = data;
+	kpass_db *db;
+	double start;
+
+	if(!job->retval && !g_atomic_int_get(&job->cancelled)) {
+		start = profile_now();
+		job->retval = load_db_batched(job->filename, job->pass,
+				job->pw_hash, &db, profile_enabled ?
+				&job->profile.timing : NULL,
+				job->stream ? load_batch : NULL, job);
+		job->err = errno;
+		if(!job->retval && job->pass)
+			remember_hash(job->filename, job->pw_hash);
+		if(!job->retval && job->streamed) {
+			/* The rows are up already, and the search index is
+			 * built the first time it's needed */
+			job->db = db;
+			trace_load_db(job, start);
+		} else if(!job->retval) {
+			job->file = db_file_new(job->filename, job->pw_hash,
+					db);
+			if(!job->file) {
+				/* Left for free_load_job() */
+				job->db = db;
+				job->retval = -1;
+				job->err = ENOMEM;
+			}
+		}
+		if(job->file) {
+			job->pw_hash = NULL;
+			/* Here rather than on the first expand, which tries
+			 * again if memory runs out */
+			db_file_tree(job->file);
+			trace_load_db(job, start);
+			start = profile_now();
+			job->index = search_index_new(db);
+			job->profile.index = profile_now() - start;
+			profile_event("index", job->filename, start,
+					job->profile.index);
+		}
+	}
+
+	if(job->pass) {
+		memset(job->pass, 0, strlen(job->pass));
+		free(job->pass);
+		job->pass = NULL;
+	}
+
+	g_idle_add(load_done, job);
+}
+
+/* Hand the search index the worker built over to the TYPE_FILE row */
+void set_search_index(GtkTreeStore *ts, GtkTreeIter *iter,
+		struct load_job *job) {
+	search_index *old_index;
+
+	gtk_tree_model_get(GTK_TREE_MODEL(ts), iter,
+			TL_SEARCH, &old_index,
+			-1);
+	gtk_tree_store_set(ts, iter,
+			TL_SEARCH, job->index,
+			-1);
+	job->index = NULL;
+
+	if(old_index)
+		search_index_free(old_index);
+}
+
+/* Finish off the job's profile and keep it on the TYPE_FILE row */
+void save_profile(GtkTreeStore *ts, GtkTreeIter *iter, struct load_job *job,
+		guint compares) {
+	struct load_profile *profile;
+	guint loads;
+
+	if(!profile_enabled)
+		return;
+
+	job->profile.total = profile_now() - job->started;
+	job->profile.compares = profile_compares - compares;
+	profile_event("load", job->filename, job->started, job->profile.total);
+
+	gtk_tree_model_get(GTK_TREE_MODEL(ts), iter,
+			TL_PROFILE, &profile,
+			-1);
+	if(!profile) {
+		profile = g_new0(struct load_profile, 1);
+		gtk_tree_store_set(ts, iter, TL_PROFILE, profile, -1);
+	}
+
+	loads = profile->loads;
+	*profile = job->profile;
+	profile->loads = loads + 1;
+}
+
+/* Move the streamed groups and entries into the header the worker left
+ * and give the TYPE_FILE row at iter the result.  FALSE if out of memory,
+ * with nothing moved. */
+gboolean finish_stream(struct load_job *job, GtkTreeStore *ts,
+		GtkTreeIter *iter) {
+	kpass_db *db = job->db;
+	kpass_group **groups;
+	kpass_entry **entries;
+	struct db_file *file;
+	GtkTreePath *path, *shown;
+	GtkTreeIter row;
+	gboolean valid;
+	double start;
+
+	start = profile_now();
+	groups = malloc(MAX(job->groups->len, 1) * sizeof(kpass_group*));
+	entries = malloc(MAX(job->entries->len, 1) * sizeof(kpass_entry*));
+	file = groups && entries ?
+		db_file_new(job->filename, job->pw_hash, db) : NULL;
+	if(!file) {
+		free(groups);
+		free(entries);
+		return FALSE;
+	}
+
+	free(db->groups);
+	free(db->entries);
+	db->groups_len = job->groups->len;
+	db->entries_len = job->entries->len;
+	db->groups = groups;
+	db->entries = entries;
+	memcpy(db->groups, job->groups->pdata,
+			db->groups_len * sizeof(kpass_group*));
+	memcpy(db->entries, job->entries->pdata,
+			db->entries_len * sizeof(kpass_entry*));
+	job->db = NULL;
+	job->pw_hash = NULL;
+
+	remove_pending_row(ts, iter);
+	gtk_tree_store_set(ts, iter,
+			TL_STRUCT, db,
+			TL_DB_FILE, file,
+			-1);
+
+	end_stream(job, TRUE);
+
+	/* Groups opened while the rest was on its way were left with just
+	 * the placeholder */
+	valid = gtk_tree_model_iter_children(GTK_TREE_MODEL(ts), &row, iter);
+	while(valid) {
+		path = gtk_tree_model_get_path(GTK_TREE_MODEL(ts), &row);
+		shown = view_path(job->tv, path);
+		if(shown && gtk_tree_view_row_expanded(job->tv, shown))
+			fill_group(ts, &row);
+		if(shown)
+			gtk_tree_path_free(shown);
+		gtk_tree_path_free(path);
+		valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(ts), &row);
+	}
+
+	job->profile.sort = profile_now() - start;
+	profile_event("sort", job->filename, start, job->profile.sort);
+	return TRUE;
+}
+
+/* Runs on the main loop once a worker has finished with a job */
+gboolean load_done(gpointer data) {
+	struct load_job *job = data;
+	GtkTreeModel *ts;
+	GtkTreePath *path;
+	GtkTreeIter iter, child;
+	struct view_state state;
+	intern_set *keys;
+	struct db_file *old_file;
+	guint compares = profile_compares;
+	double start;
+
+	/* The row was closed while we were busy */
+	if(g_atomic_int_get(&job->cancelled)) {
+		free_load_job(job);
+		return FALSE;
+	}
+
+	ts = tv_store(job->tv);
+	path = gtk_tree_row_reference_get_path(job->row);
+	gtk_tree_model_get_iter(ts, &iter, path);
+	gtk_tree_path_free(path);
+
+	gtk_tree_model_get(ts, &iter,
+			TL_DB_FILE, &old_file,
+			TL_KEYS, &keys,
+			-1);
+
+	/* Streamed rows are in place, the structs they show just need a
+	 * database to belong to */
+	if(!job->retval && job->streamed &&
+			!finish_stream(job, GTK_TREE_STORE(ts), &iter)) {
+		job->retval = -1;
+		job->err = ENOMEM;
+	}
+
+	if(job->retval) {
+		/* A failed reload keeps what we already had */
+		if(old_file) {
+			remove_pending_row(GTK_TREE_STORE(ts), &iter);
+		} else {
+			gtk_tree_store_remove(GTK_TREE_STORE(ts), &iter);
+			intern_set_free(keys);
+		}
+
+		/* Probably caught the file half written, the next change
+		 * will try again */
+		if(job->background) {
+			g_message("%s: reload failed: %s", job->filename,
+				job->retval > 0 ? kpass_strerror(job->retval)
+				: g_strerror(job->err));
+			free_load_job(job);
+			return FALSE;
+		}
+
+		if(job->retval > 0)
+			show_message(job->tv, GTK_MESSAGE_ERROR,
+					"Error loading database: %s",
+					kpass_strerror(job->retval));
+		else
+			show_message(job->tv, GTK_MESSAGE_ERROR,
+					"Error opening file: %s",
+					g_strerror(job->err));
+
+		/* A wrong password can be tried again, anything else would
+		 * only fail the same way */
+		if(!old_file && db_wrong_password(job->retval) &&
+				input_rereadable(job->filename))
+			prompt_and_load(job->tv, job->filename, FALSE);
+
+		free_load_job(job);
+		return FALSE;
+	}
+
+	if(job->streamed) {
+		watch_file(job->tv, &iter, job->filename);
+
+		search_refresh(job->tv);
+		log_usage(job->filename);
+		save_profile(GTK_TREE_STORE(ts), &iter, job, compares);
+		free_load_job(job);
+		return FALSE;
+	}
+
+	/* Reloads only touch what changed if they can */
+	if(old_file) {
+		remove_pending_row(GTK_TREE_STORE(ts), &iter);
+		start = profile_now();
+		if(reload_rows(GTK_TREE_STORE(ts), &iter, old_file->db,
+					job->file->db, keys)) {
+			/* The tree was built over the structs that have
+			 * just been swapped out */
+			if(job->file->tree)
+				db_tree_reindex(job->file->tree,
+						job->file->db);
+			job->profile.build = profile_now() - start;
+			job->profile.incremental = TRUE;
+			profile_event("build", job->filename, start,
+					job->profile.build);
+			gtk_tree_store_set(GTK_TREE_STORE(ts), &iter,
+					TL_STRUCT, job->file->db,
+					TL_DB_FILE, job->file,
+					-1);
+			set_search_index(GTK_TREE_STORE(ts), &iter, job);
+			db_file_free(old_file);
+			job->file = NULL;
+
+			search_refresh(job->tv);
+			log_usage(job->filename);
+			save_profile(GTK_TREE_STORE(ts), &iter, job, compares);
+			free_load_job(job);
+			return FALSE;
+		}
+	}
+
+	start = profile_now();
+	detach_model(job->tv, &state);
+
+	/* Clear out the pending row and, on reload, the old contents */
+	while(gtk_tree_model_iter_children(ts, &child, &iter))
+		gtk_tree_store_remove(GTK_TREE_STORE(ts), &child);
+
+	if(old_file) {
+		db_file_free(old_file);
+		intern_set_free(renew_keys(GTK_TREE_STORE(ts), &iter));
+	}
+
+	add_groups_to_store(job->file, GTK_TREE_STORE(ts), &iter);
+	job->file = NULL;
+
+	set_search_index(GTK_TREE_STORE(ts), &iter, job);
+
+	if(!old_file)
+		watch_file(job->tv, &iter, job->filename);
+
+	job->profile.build = profile_now() - start;
+	profile_event("build", job->filename, start, job->profile.build);
+
+	start = profile_now();
+	attach_model(job->tv, ts, &state);
+	job->profile.sort = profile_now() - start;
+	profile_event("sort", job->filename, start, job->profile.sort);
+
+	search_refresh(job->tv);
+	log_usage(job->filename);
+
+	save_profile(GTK_TREE_STORE(ts), &iter, job, compares);
+	free_load_job(job);
+	return FALSE;
+}
+
+/* Hand filename off to the load pool, showing a pending row under the
+ * TYPE_FILE row at iter until it's done.  Either pass is given and hashed
+ * on the worker, or pw_hash is reused from an earlier load.  Background
+ * loads show no pending row and don't complain if they fail. */
+void load_db_to_ts(GtkTreeView *tv, GtkTreeIter *iter, char *filename,
+		const char *pass, const uint8_t *pw_hash, gboolean background) {
+	GtkTreeModel *ts = tv_store(tv);
+	GtkTreeIter pending;
+	GtkTreePath *path, *shown;
+	intern_set *keys;
+	struct db_file *file;
+	struct load_job *job;
+
+	job = g_new0(struct load_job, 1);
+	job->tv = tv;
+	job->filename = g_strdup(filename);
+	job->background = background;
+	job->started = profile_now();
+	job->pw_hash = malloc(PW_HASH_LEN);
+	if(pass)
+		job->pass = strdup(pass);
+	else if(job->pw_hash)
+		memcpy(job->pw_hash, pw_hash, PW_HASH_LEN);
+	/* The worker leaves it failed, so load_done() cleans up as usual */
+	if(!job->pw_hash || (pass && !job->pass)) {
+		job->retval = -1;
+		job->err = ENOMEM;
+	}
+
+	gtk_tree_model_get(ts, iter,
+			TL_KEYS, &keys,
+			TL_DB_FILE, &file,
+			-1);
+
+	/* Reloads have to be compared with the rows already there, so only
+	 * first loads can show rows as they're parsed */
+	job->stream = !background && !file;
+
+	gtk_tree_store_set(GTK_TREE_STORE(ts), iter, TL_JOB, job, -1);
+
+	path = gtk_tree_model_get_path(ts, iter);
+	job->row = gtk_tree_row_reference_new(ts, path);
+
+	if(background) {
+		gtk_tree_path_free(path);
+		g_thread_pool_push(load_pool, job, NULL);
+		return;
+	}
+
+	gtk_tree_store_prepend(GTK_TREE_STORE(ts), &pending, iter);
+	gtk_tree_store_set(GTK_TREE_STORE(ts), &pending,
+			TL_TYPE, TYPE_PENDING,
+			TL_TITLE, "Unlocking...",
+			TL_TITLE_WEIGHT, PANGO_WEIGHT_NORMAL,
+			TL_SORT_KEY, make_sort_key(keys, "Unlocking...",
+				PANGO_WEIGHT_NORMAL),
+			-1);
+
+	shown = view_path(tv, path);
+	if(shown) {
+		gtk_tree_view_expand_row(tv, shown, FALSE);
+		gtk_tree_path_free(shown);
+	}
+	gtk_tree_path_free(path);
+
+	g_thread_pool_push(load_pool, job, NULL);
+}
+
+gboolean save_pending(struct save_state *state) {
+	return state && (state->timeout || state->running || state->again);
+}
+
+void free_save_job(struct save_job *job) {
+	if(job->db)
+		db_copy_free(job->db);
+	memset(job->pw_hash, 0, PW_HASH_LEN);
+	free(job->pw_hash);
+	g_free(job->filename);
+	gtk_tree_row_reference_free(job->row);
+	g_free(job);
+}
+
+void save_worker(gpointer data, gpointer user_data) {
+	struct save_job *job = data;
+
+	job->retval = save_db(job->filename, job->db, job->pw_hash,
+			&job->written);
+	job->err = errno;
+
+	db_copy_free(job->db);
+	job->db = NULL;
+
+	g_idle_add(save_done, job);
+}
+
+/* Hand a copy of the TYPE_FILE row's database at iter to the save pool.
+ * The pool has one thread, so saves land on disk in the order they were
+ * started. */
+void start_save(struct save_state *state, GtkTreeModel *ts,
+		GtkTreeIter *iter) {
+	struct save_job *job;
+	struct db_file *file;
+	GtkTreePath *path;
+
+	gtk_tree_model_get(ts, iter,
+			TL_DB_FILE, &file,
+			-1);
+
+	job = g_new0(struct save_job, 1);
+	job->db = db_copy(file->db);
+	job->pw_hash = malloc(PW_HASH_LEN);
+	if(!job->db || !job->pw_hash) {
+		if(job->db)
+			db_copy_free(job->db);
+		free(job->pw_hash);
+		g_free(job);
+		show_message(state->tv, GTK_MESSAGE_ERROR,
+				"Error saving database: %s",
+				g_strerror(ENOMEM));
+		return;
+	}
+
+	job->tv = state->tv;
+	job->filename = g_strdup(file->filename);
+	memcpy(job->pw_hash, file->pw_hash, PW_HASH_LEN);
+
+	path = gtk_tree_model_get_path(ts, iter);
+	job->row = gtk_tree_row_reference_new(ts, path);
+	gtk_tree_path_free(path);
+
+	state->running = TRUE;
+	state->again = FALSE;
+	save_jobs = g_slist_prepend(save_jobs, job);
+	g_thread_pool_push(save_pool, job, NULL);
+}
+
+/* Edits stopped coming in, save them unless a save is already running, in
+ * which case save_done() starts another one when it's finished */
+gboolean save_settled(gpointer data) {
+	struct save_state *state = data;
+	GtkTreeModel *ts = tv_store(state->tv);
+	GtkTreePath *path;
+	GtkTreeIter iter;
+
+	state->timeout = 0;
+
+	if(state->running) {
+		state->again = TRUE;
+		return FALSE;
+	}
+
+	path = gtk_tree_row_reference_get_path(state->row);
+	if(!path)
+		return FALSE;
+	gtk_tree_model_get_iter(ts, &iter, path);
+	gtk_tree_path_free(path);
 
+	start_save(state, ts, &iter);
 	return FALSE;
 }
 
-
-void add_keys_of_group(struct kpass_db *db, GtkTreeStore *ts, GtkTreeIter *parent, int group) {
-	int i;
+/* Runs on the main loop once the save pool is done with a job */
+gboolean save_done(gpointer data) {
+	struct save_job *job = data;
+	GtkTreeModel *ts = tv_store(job->tv);
+	GtkTreePath *path;
 	GtkTreeIter iter;
-//	struct tm tms;
-//	char time[64];
-
-//	memset(&tms, 0, sizeof(tms));
-
-	for(i = 0; i < db->entries_len; i++) {
-		if(db->entries[i]->group_id == group) {
-//			kpass_unpack_time(db->entries[i]->mtime, &tms);
-//			strftime(time, 64, "%F", &tms);
-			gtk_tree_store_append(ts, &iter, parent);
-			gtk_tree_store_set(ts, &iter,
-					TL_TYPE, TYPE_ENTRY,
-					TL_TITLE,  db->entries[i]->title,
-					TL_TITLE_WEIGHT, PANGO_WEIGHT_NORMAL,
-					TL_USERNAME, db->entries[i]->username,
-					TL_PASSWORD, db->entries[i]->password,
-					TL_URL, db->entries[i]->url,
-					TL_STRUCT, db->entries[i],
-					TL_MTIME, time,
-					-1);
+	struct save_state *state;
+	struct db_file *file;
+
+	save_jobs = g_slist_remove(save_jobs, job);
+
+	/* The row is gone if the file was closed with edits pending */
+	path = gtk_tree_row_reference_get_path(job->row);
+	if(path) {
+		gtk_tree_model_get_iter(ts, &iter, path);
+		gtk_tree_path_free(path);
+		gtk_tree_model_get(ts, &iter,
+				TL_DB_FILE, &file,
+				TL_SAVE, &state,
+				-1);
+
+		/* So the file monitor knows this change was ours */
+		if(!job->retval && file)
+			file->written = job->written;
+
+		if(state) {
+			state->running = FALSE;
+			if(state->again)
+				start_save(state, ts, &iter);
 		}
 	}
-}
 
-int add_subgroups_to_store(struct kpass_db *db, GtkTreeStore *ts, GtkTreeIter *parent, int index, int l) {
-	GtkTreeIter iter;
-	int i = index;
-//	struct tm tms;
-//	char time[64];
-
-	while(i < db->groups_len && db->groups[i]->level >= l) {
-		if(db->groups[i]->level == l) {
-//			kpass_unpack_time(db->groups[i]->mtime, &tms);
-//			strftime(time, 64, "%c", &tms);
-			gtk_tree_store_append(ts, &iter, parent);
-			gtk_tree_store_set(ts, &iter,
-					TL_TYPE, TYPE_GROUP,
-					TL_TITLE, db->groups[i]->name,
-					TL_TITLE_WEIGHT, PANGO_WEIGHT_BOLD,
-					TL_STRUCT, db->groups[i],
-/*					TL_MTIME, time,*/
-					-1);
-			add_keys_of_group(db, ts, &iter, db->groups[i]->id);
-		} else if (db->groups[i]->level == l + 1) {
-			i += add_subgroups_to_store(db, ts, &iter, i, l + 1);
-		}
-		i++;
+	if(job->retval) {
+		if(job->retval > 0)
+			show_message(job->tv, GTK_MESSAGE_ERROR,
+					"Error saving database: %s",
+					kpass_strerror(job->retval));
+		else
+			show_message(job->tv, GTK_MESSAGE_ERROR,
+					"Error saving %s: %s", job->filename,
+					g_strerror(job->err));
 	}
-	return i - index - 1;
+
+	free_save_job(job);
+	return FALSE;
 }
 
-void add_groups_to_store(struct kpass_db *db, char* filename, GtkTreeStore *ts, char* pw_hash) {
-	GtkTreeIter iter;
-	char* local_name;
-	char* name;
-
-	local_name = strdup(filename);
-	name = strdup(basename(local_name));
-	free(local_name);
-
-	gtk_tree_store_append(ts, &iter, NULL);
-	gtk_tree_store_set(ts, &iter,
-			TL_TYPE, TYPE_FILE,
-			TL_TITLE, name,
-			TL_TITLE_WEIGHT, PANGO_WEIGHT_NORMAL+1,
-			TL_STRUCT, db,
-			TL_PW_HASH, pw_hash,
-			TL_FILENAME, filename,
+/* Save the TYPE_FILE row at iter once edits to it stop for a while */
+void schedule_save(GtkTreeView *tv, GtkTreeIter *iter) {
+	GtkTreeModel *ts = tv_store(tv);
+	GtkTreePath *path;
+	struct save_state *state;
+
+	gtk_tree_model_get(ts, iter,
+			TL_SAVE, &state,
 			-1);
-	free(name);
-	add_subgroups_to_store(db, ts, &iter, 0, 0);
-}
-
-/* -1: open failed
- * -2: fstat failed
- * -3: mmap failed
- *  All others are kpass errors
- */
-int load_db_to_ts(char *filename, char *pass, char *pw_hash, GtkTreeStore *ts) {
-	uint8_t *file = NULL;
-	int length;
-	int fd;
-	struct stat sb;
-	kpass_db *db;
-	kpass_retval retval = 0;
-	uint8_t *outdb;
-	int outdb_len;
-	char *hash;
 
-	db = malloc(sizeof(kpass_db));
+	if(!state) {
+		state = g_new0(struct save_state, 1);
+		state->tv = tv;
+		path = gtk_tree_model_get_path(ts, iter);
+		state->row = gtk_tree_row_reference_new(ts, path);
+		gtk_tree_path_free(path);
+		gtk_tree_store_set(GTK_TREE_STORE(ts), iter,
+				TL_SAVE, state,
+				-1);
+	}
 
-	if(!pw_hash)
-		pw_hash = malloc(32);
-	else
-		hash = pw_hash;
+	if(state->timeout)
+		g_source_remove(state->timeout);
+	state->timeout = g_timeout_add(SAVE_DELAY_MS, save_settled, state);
+}
 
-	memset(db, 0, sizeof(kpass_db));
+/* Remove a TYPE_FILE row and free everything it owns.  Returns TRUE if the
+ * file was loaded, so the caller knows to refresh the search.  Edits
+ * still waiting to be saved are handed to the save pool first. */
+gboolean close_file(GtkTreeStore *ts, GtkTreeIter *iter) {
+	intern_set *keys;
+	search_index *index;
+	struct load_profile *profile;
+	struct db_file *file;
+	struct load_job *job;
+	struct save_state *save;
+
+	gtk_tree_model_get(GTK_TREE_MODEL(ts), iter,
+			TL_DB_FILE, &file,
+			TL_JOB, &job,
+			TL_KEYS, &keys,
+			TL_SEARCH, &index,
+			TL_PROFILE, &profile,
+			TL_SAVE, &save,
+			-1);
 
-	fd = open(filename, O_RDONLY);
-	if(fd == -1) {
-		return -1;
-	}
+	/* Closing a file that's still unlocking cancels it */
+	if(job)
+		g_atomic_int_set(&job->cancelled, 1);
 
-	if(fstat(fd, &sb) == -1) {
-		close(fd);
-		return -2;
+	if(save) {
+		if(save->timeout) {
+			g_source_remove(save->timeout);
+			save->timeout = 0;
+			save->again = TRUE;
+		}
+		if(save->again)
+			start_save(save, GTK_TREE_MODEL(ts), iter);
+		gtk_tree_row_reference_free(save->row);
+		g_free(save);
 	}
 
-	length = sb.st_size;
+	/* The rows point into the database, so they go first */
+	gtk_tree_store_remove(ts, iter);
 
-	file = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
-	if(file == MAP_FAILED) {
-		close(fd);
-		return -3;
+	/* The last export still reading it frees it */
+	if(file && file->exports) {
+		cancel_exports(file);
+		file->closed = TRUE;
+	} else if(file) {
+		db_file_free(file);
 	}
-	retval = kpass_init_db(db, file, length);
-	if(retval) goto load_db_to_ts_fail;
-
-	if(pass)
-		kpass_hash_pw(pass, pw_hash);
-	
-	retval = kpass_decrypt_db(db, pw_hash);
-	if(retval) goto load_db_to_ts_fail;
-
-	add_groups_to_store(db, filename, ts, pw_hash);
+	intern_set_free(keys);
+	g_free(profile);
+	if(index)
+		search_index_free(index);
 
-	goto load_db_to_ts_success;
-
-load_db_to_ts_fail:
-	munmap(file, length);
-	free(db);
-	if(!pw_hash)
-		free(hash);
-	close(fd);
+	return file != NULL;
+}
 
-//	kpass_free_db(&db);
-//	free(db);
-load_db_to_ts_success:
-	return retval;
+void log_usage(const char *what) {
+	struct db_usage usage;
+	struct intern_usage strings;
+
+	db_get_usage(&usage);
+	intern_get_usage(&strings);
+	g_debug("%s: %d files, %lu bytes decrypted, %lu bytes mapped, "
+			"%d fds, %u shared strings in %lu bytes", what,
+			usage.files, (unsigned long)usage.bytes,
+			(unsigned long)usage.mapped, usage.fds,
+			strings.strings, (unsigned long)strings.bytes);
 }
 
 void menu_close(GtkWidget *widget, gpointer callback_data) {
 	GtkTreeView *tv = GTK_TREE_VIEW(callback_data);
-	GtkTreeModel *ts = gtk_tree_view_get_model(tv);
-	GtkTreePath *path;
-	GtkTreeViewColumn *col;
 	GtkTreeIter iter;
-	kpass_db *db;
 
-	gtk_tree_view_get_cursor(tv, &path, &col);
+	if(!cursor_iter(tv, &iter, TRUE)) return;
 
-	if(!path) return;
+	if(close_file(GTK_TREE_STORE(tv_store(tv)), &iter))
+		search_refresh(tv);
+	log_usage("close");
+}
 
-	while(gtk_tree_path_get_depth(path) > 1) gtk_tree_path_up(path);
+void menu_reload(GtkWidget *widget, gpointer callback_data) {
+	GtkTreeView *tv = GTK_TREE_VIEW(callback_data);
+	GtkTreeModel *ts = tv_store(tv);
+	GtkTreeIter iter;
+	struct db_file *file;
+	struct load_job *job;
+	struct save_state *save;
 
-	gtk_tree_model_get_iter(ts, &iter, path);
+	if(!cursor_iter(tv, &iter, TRUE)) return;
 
 	gtk_tree_model_get(ts, &iter,
-			TL_STRUCT, &db,
+			TL_DB_FILE, &file,
+			TL_JOB, &job,
+			TL_SAVE, &save,
 			-1);
 
-	kpass_free_db(db);
-	free(db);
+	/* Nothing to reload until the first load finishes, and nothing new
+	 * on disk until our edits are.  Exports need the database left as
+	 * it is, and pipes can't be read twice. */
+	if(file && !job && !file->exports && !save_pending(save) &&
+			!(file->db->flags & DB_FLAG_STREAM)) {
+		profile_event("reload", file->filename, profile_now(), 0);
+		load_db_to_ts(tv, &iter, file->filename, NULL, file->pw_hash,
+				FALSE);
+	}
+}
 
-	gtk_tree_store_remove(GTK_TREE_STORE(ts), &iter);
+/* Add a "name: value" line to the properties table, taking value */
+void add_property(GtkWidget *table, guint *row, const char *name,
+		char *value) {
+	GtkWidget *label;
 
-	gtk_tree_path_free(path);
+	gtk_table_resize(GTK_TABLE(table), *row + 1, 2);
+
+	label = gtk_label_new(name);
+	gtk_misc_set_alignment(GTK_MISC(label), 0, 0.5);
+	gtk_table_attach(GTK_TABLE(table), label, 0, 1, *row, *row + 1,
+			GTK_FILL, GTK_FILL, 0, 0);
+
+	label = gtk_label_new(value);
+	gtk_misc_set_alignment(GTK_MISC(label), 0, 0.5);
+	gtk_label_set_selectable(GTK_LABEL(label), TRUE);
+	gtk_table_attach(GTK_TABLE(table), label, 1, 2, *row, *row + 1,
+			GTK_EXPAND | GTK_FILL, GTK_FILL, 0, 0);
+
+	g_free(value);
+	(*row)++;
 }
 
-void menu_reload(GtkWidget *widget, gpointer callback_data) {
+#define MSEC(s) g_strdup_printf("%.1f ms", (s) * 1000)
+
+/* Show what we know about the selected file, including where the time went
+ * the last time it loaded if we're profiling */
+void menu_properties(GtkWidget *widget, gpointer callback_data) {
 	GtkTreeView *tv = GTK_TREE_VIEW(callback_data);
-	GtkTreeModel *ts = gtk_tree_view_get_model(tv);
-	GtkTreePath *path;
-	GtkTreeViewColumn *col;
+	GtkTreeModel *ts = tv_store(tv);
+	GtkWidget *dialog, *table;
 	GtkTreeIter iter;
-	GtkTreeRowReference *rr;
+	struct load_profile *p;
+	struct db_file *file;
+	struct db_usage usage;
+	struct intern_usage strings;
+	search_index *index;
+	intern_set *keys;
+	gsize added, stored, index_added, index_stored;
 	kpass_db *db;
-	char *pw_hash, *filename;
+	gchar *size;
+	guint row = 0;
 
-	gtk_tree_view_get_cursor(tv, &path, &col);
+	if(!cursor_iter(tv, &iter, TRUE)) return;
 
+	gtk_tree_model_get(ts, &iter,
+			TL_DB_FILE, &file,
+			TL_PROFILE, &p,
+			TL_KEYS, &keys,
+			TL_SEARCH, &index,
+			-1);
 
-	if(!path) return;
+	/* Still unlocking for the first time */
+	if(!file)
+		return;
+	db = file->db;
+
+	dialog = gtk_dialog_new_with_buttons("Properties",
+			GTK_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(tv))),
+			GTK_DIALOG_DESTROY_WITH_PARENT,
+			GTK_STOCK_CLOSE, GTK_RESPONSE_CLOSE, NULL);
+
+	table = gtk_table_new(1, 2, FALSE);
+	gtk_table_set_col_spacings(GTK_TABLE(table), 12);
+	gtk_container_set_border_width(GTK_CONTAINER(table), 6);
+
+	add_property(table, &row, "File:", g_strdup(file->filename));
+	add_property(table, &row, "Groups:",
+			g_strdup_printf("%u", db->groups_len));
+	add_property(table, &row, "Entries:",
+			g_strdup_printf("%u", db->entries_len));
+	add_property(table, &row, "Key rounds:",
+			g_strdup_printf("%u", db->key_rounds));
+	add_property(table, &row, "Decrypted by:",
+			g_strdup(db->flags & DB_FLAG_KDBX ?
+				"gtkpass (KDBX, read-only)" :
+				can_fast_decrypt(db) ? "gtkpass (AES-NI)" :
+				"libkpass"));
+	if(db->flags & DB_FLAG_STREAM)
+		add_property(table, &row, "Read from:",
+				g_strdup("Pipe, read-only"));
+	add_property(table, &row, "Memory:",
+			g_format_size_for_display(file->bytes));
+
+	/* Sort keys, and the search index once there is one */
+	intern_set_size(keys, &added, &stored);
+	if(index) {
+		intern_set_size(search_index_strings(index), &index_added,
+				&index_stored);
+		added += index_added;
+		stored += index_stored;
+	}
+	add_property(table, &row, "  Keys and search text:",
+			g_format_size_for_display(stored));
+	add_property(table, &row, "  Saved by sharing:",
+			g_format_size_for_display(added - stored));
+
+	if(p) {
+		add_property(table, &row, "Loads:",
+				g_strdup_printf("%u", p->loads));
+		add_property(table, &row, "Last load:", MSEC(p->total));
+		add_property(table, &row, "  Read file:", MSEC(p->timing.map));
+		add_property(table, &row, "  Read header:",
+				MSEC(p->timing.init));
+		add_property(table, &row, "  Hash password:",
+				MSEC(p->timing.hash));
+		add_property(table, &row, "  Decrypt:",
+				MSEC(p->timing.decrypt));
+		add_property(table, &row, "  Search index:", MSEC(p->index));
+		add_property(table, &row, p->incremental ?
+				"  Update rows:" : "  Build rows:",
+				MSEC(p->build));
+		add_property(table, &row, "  Sort:", MSEC(p->sort));
+		add_property(table, &row, "Sort comparisons:",
+				g_strdup_printf("%u", p->compares));
+	} else if(!profile_enabled) {
+		add_property(table, &row, "Load timings:",
+				g_strdup("start with --profile to record"));
+	}
 
-	while(gtk_tree_path_get_depth(path) > 1) gtk_tree_path_up(path);
+	/* Should stay flat however often files are reloaded */
+	db_get_usage(&usage);
+	add_property(table, &row, "All open files:",
+			g_strdup_printf("%d", usage.files));
+	add_property(table, &row, "  Memory:",
+			g_format_size_for_display(usage.bytes));
+	add_property(table, &row, "  File contents:",
+			g_format_size_for_display(usage.mapped));
+	add_property(table, &row, "  File descriptors:",
+			g_strdup_printf("%d", usage.fds));
+	intern_get_usage(&strings);
+	size = g_format_size_for_display(strings.bytes);
+	add_property(table, &row, "  Shared strings:",
+			g_strdup_printf("%u in %s", strings.strings, size));
+	g_free(size);
 
-	rr = gtk_tree_row_reference_new(ts, path);
-	if(!rr) return;
-	
-	gtk_tree_model_get_iter(ts, &iter, path);
-	gtk_tree_path_free(path);
+	gtk_container_add(GTK_CONTAINER(gtk_dialog_get_content_area(
+					GTK_DIALOG(dialog))), table);
+	gtk_widget_show_all(dialog);
+	gtk_dialog_run(GTK_DIALOG(dialog));
+	gtk_widget_destroy(dialog);
+}
 
-	gtk_tree_model_get(ts, &iter,
+/* The TYPE_FILE row at iter changed, its search index is rebuilt when
+ * it's next needed */
+void drop_search_index(GtkTreeView *tv, GtkTreeIter *iter) {
+	GtkTreeModel *ts = tv_store(tv);
+	search_index *index;
+
+	gtk_tree_model_get(ts, iter,
+			TL_SEARCH, &index,
+			-1);
+	if(index) {
+		search_index_free(index);
+		gtk_tree_store_set(GTK_TREE_STORE(ts), iter,
+				TL_SEARCH, NULL,
+				-1);
+	}
+	if(search_matches)
+		search_refresh(tv);
+}
+
+/* Change a field of the group or entry at iter in the store, then have
+ * the file saved once the edits stop */
+void edit_field(GtkTreeView *tv, GtkTreeIter *iter, int field,
+		const char *text) {
+	GtkTreeModel *ts = tv_store(tv);
+	GtkTreeIter file;
+	intern_set *keys;
+	struct load_job *job;
+	struct db_file *db_file;
+	struct kpass_entry *entry = NULL;
+	struct kpass_group *group = NULL;
+	kpass_db *db;
+	struct tm tms;
+	time_t now;
+	gpointer st;
+	guint type;
+	char **str = NULL;
+
+	gtk_tree_model_get(ts, iter,
+			TL_TYPE, &type,
+			TL_STRUCT, &st,
+			-1);
+
+	if(type == TYPE_ENTRY) {
+		entry = st;
+		switch(field) {
+			case FIELD_TITLE:
+				str = &entry->title;
+				break;
+			case FIELD_USERNAME:
+				str = &entry->username;
+				break;
+			case FIELD_PASSWORD:
+				str = &entry->password;
+				break;
+			case FIELD_URL:
+				str = &entry->url;
+				break;
+		}
+	} else if(type == TYPE_GROUP && field == FIELD_TITLE) {
+		group = st;
+		str = &group->name;
+	}
+
+	if(!str || (*str && !strcmp(*str, text)))
+		return;
+
+	file_row(ts, iter, &file);
+	gtk_tree_model_get(ts, &file,
+			TL_KEYS, &keys,
+			TL_JOB, &job,
 			TL_STRUCT, &db,
-			TL_PW_HASH, &pw_hash,
-			TL_FILENAME, &filename,
+			TL_DB_FILE, &db_file,
 			-1);
 
-	if(load_db_to_ts(filename, NULL, pw_hash, GTK_TREE_STORE(ts))) {
-		gtk_tree_row_reference_free(rr);
+	/* A reload in progress would replace the struct we'd be changing,
+	 * an export could be reading it, and KDBX files can't be saved */
+	if(job || !db || db_read_only(db) || db_file->exports) {
+		gdk_beep();
 		return;
 	}
 
-	kpass_free_db(db);
-	free(db);
+	if(*str) {
+		if(field == FIELD_PASSWORD)
+			memset(*str, 0, strlen(*str));
+		free(*str);
+	}
+	*str = strdup(text);
+
+	now = time(NULL);
+	localtime_r(&now, &tms);
+	kpass_pack_time(&tms, entry ? entry->mtime : group->mtime);
+
+	/* New titles need new sort keys */
+	if(field != FIELD_TITLE)
+		set_row_mtime(GTK_TREE_STORE(ts), iter,
+				entry ? entry->mtime : group->mtime);
+	else if(entry)
+		set_entry_row(GTK_TREE_STORE(ts), iter, entry, keys);
+	else
+		set_group_row(GTK_TREE_STORE(ts), iter, group, keys);
 
-	path = gtk_tree_row_reference_get_path(rr);
-	gtk_tree_model_get_iter(ts, &iter, path);
-	gtk_tree_store_remove(GTK_TREE_STORE(ts), &iter);
-	gtk_tree_path_free(path);
+	drop_search_index(tv, &file);
+	schedule_save(tv, &file);
+}
+
+void cell_edited(GtkCellRendererText *renderer, gchar *path_string,
+		gchar *text, gpointer data) {
+	GtkTreeView *tv = GTK_TREE_VIEW(data);
+	GtkTreeModel *filter = gtk_tree_view_get_model(tv);
+	GtkTreeIter filter_iter, iter;
+
+	if(!filter || !gtk_tree_model_get_iter_from_string(filter,
+				&filter_iter, path_string))
+		return;
+	gtk_tree_model_filter_convert_iter_to_child_iter(
+			GTK_TREE_MODEL_FILTER(filter), &iter, &filter_iter);
+
+	edit_field(tv, &iter, GPOINTER_TO_INT(g_object_get_data(
+				G_OBJECT(renderer), "field")), text);
 }
 
 void menu_copy_pw(GtkWidget *widget, gpointer callback_data) {
@@ -313,15 +2040,18 @@ void menu_copy_pw(GtkWidget *widget, gpointer callback_data) {
 
 	gtk_tree_model_get_iter(ts, &iter, path);
 
-	gtk_tree_model_get(ts, &iter,
-			TL_PASSWORD, &val,
-			-1);
+	val = row_field(ts, &iter, FIELD_PASSWORD);
 
 	if(val && strlen(val) > 0) {
 		gtk_clipboard_set_text(gtk_clipboard_get(GDK_SELECTION_CLIPBOARD), val, -1);
 		gtk_clipboard_set_text(gtk_clipboard_get(GDK_SELECTION_PRIMARY), val, -1);
 	}
 
+	if(val) {
+		memset(val, 0, strlen(val));
+		g_free(val);
+	}
+
 	gtk_tree_path_free(path);
 }
 
@@ -339,9 +2069,7 @@ void menu_copy_un(GtkWidget *widget, gpointer callback_data) {
 
 	gtk_tree_model_get_iter(ts, &iter, path);
 
-	gtk_tree_model_get(ts, &iter,
-			TL_USERNAME, &val,
-			-1);
+	val = row_field(ts, &iter, FIELD_USERNAME);
 
 	if(val && strlen(val) > 0) {
 		gtk_clipboard_set_text(gtk_clipboard_get(
@@ -350,52 +2078,65 @@ void menu_copy_un(GtkWidget *widget, gpointer callback_data) {
 					GDK_SELECTION_PRIMARY), val, -1);
 	}
 
+	g_free(val);
+
 	gtk_tree_path_free(path);
 }
 
+void menu_find(GtkWidget *widget, gpointer callback_data) {
+	gtk_widget_grab_focus(search_entry);
+}
+
 void menu_quit(GtkWidget *widget, gpointer data1, gpointer data2) {
 	GtkTreeView *tv;
 	GtkTreeModel *ts;
+	GtkTreeIter iter;
+	struct save_job *job;
 
 	if(GTK_IS_TREE_VIEW(data1))
 		tv = GTK_TREE_VIEW(data1);
 	else
 		tv = GTK_TREE_VIEW(data2);
-	ts = gtk_tree_view_get_model(tv);
+	ts = tv_store(tv);
+
+	/* Already on the way out, waiting on saves below */
+	if(!save_pool)
+		return;
+
+	while(gtk_tree_model_get_iter_first(ts, &iter))
+		close_file(GTK_TREE_STORE(ts), &iter);
+	log_usage("quit");
+
+	audit_ui_shutdown();
+	/* close_file() cancelled the exports, they still have to clean up */
+	export_ui_shutdown();
+
+	/* Let the saves close_file() started finish, and say if any failed */
+	g_thread_pool_free(save_pool, FALSE, TRUE);
+	save_pool = NULL;
+	while(save_jobs) {
+		job = save_jobs->data;
+		g_idle_remove_by_data(job);
+		save_done(job);
+	}
 
-	/* Should probably clean up kpass databases here... */
+	/* A load can sit in the key transform for seconds, and there's
+	 * nothing left to show it in */
+	g_thread_pool_free(load_pool, TRUE, FALSE);
+	load_pool = NULL;
 
+	profile_write_trace();
 	gtk_main_quit();
 }
 
-void menu_open(GtkWidget *widget, gpointer callback_data) {
-	GtkTreeView *tv = GTK_TREE_VIEW(callback_data);
-	GtkTreeModel *ts = gtk_tree_view_get_model(tv);
-	GtkWidget *dialog_f, *dialog_p, *mdialog_p, *label_p, *entry_p;
-	GtkFileFilter *filter;
-	GtkTreeIter iter;
+/* Ask for a password, naming filename in the prompt if given.  Returns a
+ * newly allocated string, or NULL if the user cancelled. */
+char *prompt_password(GtkTreeView *tv, char *filename) {
+	GtkWidget *dialog_p, *label_p, *entry_p;
 	GtkWidget *hbox;
-	char *filename;
-	int retval;
-	GtkWidget *parent_window = gtk_widget_get_toplevel(callback_data);
-
-	/* Set up file chooser */
-	dialog_f = gtk_file_chooser_dialog_new ("Open File",
-			GTK_WINDOW(parent_window),
-			GTK_FILE_CHOOSER_ACTION_OPEN,
-			GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
-			GTK_STOCK_OPEN, GTK_RESPONSE_ACCEPT,
-			NULL);
-
-	filter = gtk_file_filter_new();
-	gtk_file_filter_add_pattern(filter, "*.kdb");
-	gtk_file_filter_set_name(filter, "KeePass files");
-	gtk_file_chooser_add_filter(GTK_FILE_CHOOSER (dialog_f), filter);
-
-	filter = gtk_file_filter_new();
-	gtk_file_filter_add_pattern(filter, "*");
-	gtk_file_filter_set_name(filter, "All files");
-	gtk_file_chooser_add_filter(GTK_FILE_CHOOSER (dialog_f), filter);
+	GtkWidget *parent_window = gtk_widget_get_toplevel(GTK_WIDGET(tv));
+	char *local_name, *label;
+	char *pass = NULL;
 
 	/* Set up password entry */
 	dialog_p = gtk_dialog_new_with_buttons("Password",
@@ -406,7 +2147,16 @@ void menu_open(GtkWidget *widget, gpointer callback_data) {
 					GTK_RESPONSE_ACCEPT);
 
 
-	label_p = gtk_label_new("Password:");
+	if(filename) {
+		local_name = strdup(filename);
+		label = g_strdup_printf("Password for %s:",
+				basename(local_name));
+		free(local_name);
+	} else {
+		label = g_strdup("Password:");
+	}
+	label_p = gtk_label_new(label);
+	g_free(label);
 	entry_p = gtk_entry_new();
 	gtk_entry_set_visibility(GTK_ENTRY(entry_p), FALSE);
 	gtk_entry_set_activates_default(GTK_ENTRY(entry_p), TRUE);
@@ -422,73 +2172,156 @@ void menu_open(GtkWidget *widget, gpointer callback_data) {
 	gtk_widget_show (entry_p);
 	gtk_widget_show (hbox);
 
-	if (gtk_dialog_run (GTK_DIALOG (dialog_f)) == GTK_RESPONSE_ACCEPT){
-		filename = gtk_file_chooser_get_filename(
-					GTK_FILE_CHOOSER (dialog_f));
-		gtk_widget_hide(dialog_f);
+	if (gtk_dialog_run(GTK_DIALOG (dialog_p)) == GTK_RESPONSE_ACCEPT)
+		pass = g_strdup(gtk_entry_get_text(GTK_ENTRY(entry_p)));
 
-		while (gtk_dialog_run(GTK_DIALOG (dialog_p)) == GTK_RESPONSE_ACCEPT) {
-			retval = load_db_to_ts(filename,
-				(char*)gtk_entry_get_text(GTK_ENTRY(entry_p)),
-				NULL, GTK_TREE_STORE(ts));
-			if(!retval)
-				break;
-			if(retval > 0)
-				mdialog_p = gtk_message_dialog_new(GTK_WINDOW(
-				dialog_p), GTK_DIALOG_DESTROY_WITH_PARENT,
-				GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
-				"Error loading database: %s",
-				kpass_strerror(retval));
-			else
-				mdialog_p = gtk_message_dialog_new(GTK_WINDOW(
-				dialog_p), GTK_DIALOG_DESTROY_WITH_PARENT,
-				GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
-				"Error opening file: %s", g_strerror(errno));
-
-			gtk_dialog_run (GTK_DIALOG (mdialog_p));
-			gtk_widget_destroy (mdialog_p);
-			
-		}
-		gtk_widget_destroy (dialog_p);
+	gtk_widget_destroy (dialog_p);
+	return pass;
+}
+
+void free_password(char *pass) {
+	memset(pass, 0, strlen(pass));
+	g_free(pass);
+}
+
+void menu_edit_pw(GtkWidget *widget, gpointer callback_data) {
+	GtkTreeView *tv = GTK_TREE_VIEW(callback_data);
+	GtkTreeModel *ts = tv_store(tv);
+	GtkTreeRowReference *row;
+	GtkTreePath *path;
+	GtkTreeIter iter;
+	guint type;
+	char *pass;
+
+	if(!cursor_iter(tv, &iter, FALSE)) return;
+
+	gtk_tree_model_get(ts, &iter,
+			TL_TYPE, &type,
+			-1);
+	if(type != TYPE_ENTRY) return;
+
+	/* The row could go away while the dialog is up */
+	path = gtk_tree_model_get_path(ts, &iter);
+	row = gtk_tree_row_reference_new(ts, path);
+	gtk_tree_path_free(path);
+
+	pass = prompt_password(tv, NULL);
+
+	path = gtk_tree_row_reference_get_path(row);
+	if(pass && path) {
+		gtk_tree_model_get_iter(ts, &iter, path);
+		edit_field(tv, &iter, FIELD_PASSWORD, pass);
 	}
-	gtk_widget_destroy (dialog_f);
+
+	if(path)
+		gtk_tree_path_free(path);
+	if(pass)
+		free_password(pass);
+	gtk_tree_row_reference_free(row);
+}
+
+/* Start loading filename with a hash from the unlock agent, if it has one */
+gboolean load_from_agent(GtkTreeView *tv, char *filename) {
+	GtkTreeModel *ts = tv_store(tv);
+	GtkTreeIter iter;
+	uint8_t pw_hash[PW_HASH_LEN];
+	char *name;
+	gboolean found = FALSE;
+
+	name = agent_hash_name(filename);
+	if(name && !agent_get(name, pw_hash, PW_HASH_LEN)) {
+		add_file_to_store(filename, GTK_TREE_STORE(ts), &iter);
+		load_db_to_ts(tv, &iter, filename, NULL, pw_hash, FALSE);
+		memset(pw_hash, 0, sizeof(pw_hash));
+		found = TRUE;
+	}
+
+	free(name);
+	return found;
 }
 
-gint sort_iter_compare_func (GtkTreeModel *model,
-		GtkTreeIter  *a,
-		GtkTreeIter  *b,
-		gpointer      userdata) {
+/* Ask for the password to filename and start loading it.  A hash from the
+ * agent is tried first unless use_agent is FALSE, as it is when retrying
+ * after a failed load. */
+void prompt_and_load(GtkTreeView *tv, char *filename, gboolean use_agent) {
+	GtkTreeModel *ts = tv_store(tv);
+	GtkTreeIter iter;
+	char *pass;
 
-	gchar *name1, *name2;
-	gint sortcol = GPOINTER_TO_INT(userdata), ret = 0;
-	gint weight1, weight2;
+	if(use_agent && load_from_agent(tv, filename))
+		return;
 
-	switch(sortcol) {
-		case SORTID_GROUPS_ON_TOP:
-			gtk_tree_model_get(model, a, TL_TITLE_WEIGHT, &weight1, -1);
-			gtk_tree_model_get(model, b, TL_TITLE_WEIGHT, &weight2, -1);
+	pass = prompt_password(tv, filename);
+	if(!pass) return;
 
-			if(weight1 != weight2) {
-				ret = (weight1 > weight2) ? -1 : 1;
-				break;
-			}
-			gtk_tree_model_get(model, a, TL_TITLE, &name1, -1);
-			gtk_tree_model_get(model, b, TL_TITLE, &name2, -1);
-			if(!name1 || !name2) {
-				if(!name1 && !name2)
-					break;
-				ret = (name1)? -1 : 1;
-			} else {
-				ret = g_utf8_collate(name1,name2);
-			}
-			g_free(name1);
-			g_free(name2);
-			break;
-		default:
-			break;
+	add_file_to_store(filename, GTK_TREE_STORE(ts), &iter);
+	load_db_to_ts(tv, &iter, filename, pass, NULL, FALSE);
+	free_password(pass);
+}
+
+/* Open the databases named on the command line.  Each one goes to the load
+ * pool as soon as its password is known, so they all decrypt at once. */
+void open_files(GtkTreeView *tv, int count, char **files, gboolean shared) {
+	GtkTreeModel *ts = tv_store(tv);
+	GtkTreeIter iter;
+	char *pass = NULL;
+	int i;
+
+	for(i = 0; i < count; i++) {
+		if(!shared) {
+			prompt_and_load(tv, files[i], TRUE);
+			continue;
+		}
+
+		if(load_from_agent(tv, files[i]))
+			continue;
+
+		if(!pass && !(pass = prompt_password(tv, NULL)))
+			return;
+
+		add_file_to_store(files[i], GTK_TREE_STORE(ts), &iter);
+		load_db_to_ts(tv, &iter, files[i], pass, NULL, FALSE);
 	}
 
-	return ret;
+	if(pass)
+		free_password(pass);
+}
+
+void menu_open(GtkWidget *widget, gpointer callback_data) {
+	GtkTreeView *tv = GTK_TREE_VIEW(callback_data);
+	GtkWidget *dialog_f;
+	GtkFileFilter *filter;
+	char *filename;
+	GtkWidget *parent_window = gtk_widget_get_toplevel(callback_data);
+
+	/* Set up file chooser */
+	dialog_f = gtk_file_chooser_dialog_new ("Open File",
+			GTK_WINDOW(parent_window),
+			GTK_FILE_CHOOSER_ACTION_OPEN,
+			GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+			GTK_STOCK_OPEN, GTK_RESPONSE_ACCEPT,
+			NULL);
+
+	filter = gtk_file_filter_new();
+	gtk_file_filter_add_pattern(filter, "*.kdb");
+	gtk_file_filter_add_pattern(filter, "*.kdbx");
+	gtk_file_filter_set_name(filter, "KeePass files");
+	gtk_file_chooser_add_filter(GTK_FILE_CHOOSER (dialog_f), filter);
+
+	filter = gtk_file_filter_new();
+	gtk_file_filter_add_pattern(filter, "*");
+	gtk_file_filter_set_name(filter, "All files");
+	gtk_file_chooser_add_filter(GTK_FILE_CHOOSER (dialog_f), filter);
+
+	if (gtk_dialog_run (GTK_DIALOG (dialog_f)) == GTK_RESPONSE_ACCEPT){
+		filename = gtk_file_chooser_get_filename(
+					GTK_FILE_CHOOSER (dialog_f));
+		gtk_widget_hide(dialog_f);
+
+		prompt_and_load(tv, filename, TRUE);
+		g_free(filename);
+	}
+	gtk_widget_destroy (dialog_f);
 }
 
 void menu_about(GtkWidget *widget, gpointer callback_data) {
@@ -536,18 +2369,25 @@ static char *ui_xml =
 "			<menuitem name='Open' action='OpenAction' />\n"
 "			<menuitem name='Reload' action='ReloadAction' />\n"
 "			<menuitem name='Close' action='CloseAction' />\n"
+"			<menuitem name='Merge' action='MergeAction' />\n"
+"			<menuitem name='Audit' action='AuditAction' />\n"
+"			<menuitem name='Properties' action='PropertiesAction' />\n"
 "			<separator/>\n"
 "			<menuitem name='Quit' action='QuitAction' />\n"
 "		</menu>\n"
 "		<menu name='GroupMenu' action='GroupMenuAction'>\n"
 "		</menu>\n"
 "		<menu name='EntryMenu' action='EntryMenuAction'>\n"
+"			<menuitem name='Find' action='FindAction' />\n"
 "			<menuitem name='Copy Password'\n"
 "					action='CopyAction' />\n"
 "			<menuitem name='Copy Password'\n"
 "					action='CopyPWAction' />\n"
 "			<menuitem name='Copy Username'\n"
 "					action='CopyUNAction' />\n"
+"			<separator/>\n"
+"			<menuitem name='Edit Password'\n"
+"					action='EditPWAction' />\n"
 "		</menu>\n"
 "		<menu name='HelpMenu' action='HelpMenuAction'>\n"
 "			<menuitem name='About' action='AboutAction' />\n"
@@ -557,13 +2397,20 @@ static char *ui_xml =
 "		<menuitem name='Open' action='OpenAction' />\n"
 "		<menuitem name='Reload' action='ReloadAction' />\n"
 "		<menuitem name='Close' action='CloseAction' />\n"
+"		<menuitem name='Merge' action='MergeAction' />\n"
+"		<menuitem name='Export' action='ExportAction' />\n"
+"		<separator/>\n"
+"		<menuitem name='Properties' action='PropertiesAction' />\n"
 "	</popup>\n"
 "	<popup name='GroupPop' action='GroupPopAction'>\n"
+"		<menuitem name='Export' action='ExportAction' />\n"
 "	</popup>\n"
 "	<popup name='EntryPop' action='EntryPopAction'>\n"
 "		<menuitem name='Copy Password' action='CopyAction' />\n"
 "		<menuitem name='Copy Password' action='CopyPWAction' />\n"
 "		<menuitem name='Copy Username' action='CopyUNAction' />\n"
+"		<separator/>\n"
+"		<menuitem name='Edit Password' action='EditPWAction' />\n"
 "	</popup>\n"
 "</ui>\n";
 
@@ -589,6 +2436,26 @@ static GtkActionEntry entries[] =
     "Close the selected file",
     G_CALLBACK (menu_close) },
 
+  { "MergeAction", NULL,
+    "_Merge From...", "<control>M",
+    "Bring entries from another open file into the selected one",
+    G_CALLBACK (menu_merge) },
+
+  { "ExportAction", GTK_STOCK_SAVE_AS,
+    "_Export...", NULL,
+    "Write the entries of the selected file or group to a CSV or JSON file",
+    G_CALLBACK (menu_export) },
+
+  { "AuditAction", NULL,
+    "_Audit Passwords...", NULL,
+    "Look for reused, weak and old passwords in every open file",
+    G_CALLBACK (menu_audit) },
+
+  { "PropertiesAction", GTK_STOCK_PROPERTIES,
+    "_Properties", "<alt>Return",
+    "Show details of the selected file",
+    G_CALLBACK (menu_properties) },
+
   { "QuitAction", GTK_STOCK_QUIT,
     "_Quit", "<control>Q",    
     "Quit",
@@ -604,6 +2471,16 @@ static GtkActionEntry entries[] =
     "Copy username of entry to clipboard",
     G_CALLBACK (menu_copy_un) },
 
+  { "EditPWAction", GTK_STOCK_EDIT,
+    "_Edit Password...", "<control>E",
+    "Set a new password for the entry",
+    G_CALLBACK (menu_edit_pw) },
+
+  { "FindAction", GTK_STOCK_FIND,
+    "_Find", "<control>F",
+    "Search entries in every open file",
+    G_CALLBACK (menu_find) },
+
   { "AboutAction", GTK_STOCK_ABOUT,
     "About", "",
     "About this program",
@@ -612,6 +2489,22 @@ static GtkActionEntry entries[] =
 
 static guint n_entries = G_N_ELEMENTS (entries);
 
+static gboolean shared_password = FALSE;
+static gboolean profile_flag = FALSE;
+static gchar *trace_file = NULL;
+
+static GOptionEntry options[] =
+{
+  { "shared-password", 's', 0, G_OPTION_ARG_NONE, &shared_password,
+    "Ask once for a password used by every FILE", NULL },
+  { "profile", 0, 0, G_OPTION_ARG_NONE, &profile_flag,
+    "Time each load, shown under File > Properties", NULL },
+  { "trace", 0, 0, G_OPTION_ARG_FILENAME, &trace_file,
+    "Also write load timings to TRACE on exit, for chrome://tracing",
+    "TRACE" },
+  { NULL }
+};
+
 void tv_popup_position(GtkMenu *menu, gint *x, gint *y, gboolean *push_in,
 		gpointer data) {
 	GtkWidget *widget = GTK_WIDGET(data);
@@ -681,8 +2574,7 @@ gboolean tv_popup(GtkWidget *tv, GdkEventButton *ev, gpointer menu_manager) {
 	if(type == TYPE_ENTRY) {
 		menu = gtk_ui_manager_get_widget(menu_manager, "/EntryPop");
 	} else if(type == TYPE_GROUP) {
-//		menu = gtk_ui_manager_get_widget(menu_manager, "/GroupPop");
-		return FALSE; // bail out until we have a real menu here
+		menu = gtk_ui_manager_get_widget(menu_manager, "/GroupPop");
 	} else if(type == TYPE_FILE) {
 		menu = gtk_ui_manager_get_widget(menu_manager, "/FilePop");
 	} else return FALSE;
@@ -703,25 +2595,48 @@ gboolean tv_popup_menu_button(GtkWidget *tv, gpointer ud) {
 int main( int argc, char *argv[] ) {
 	GtkTreeStore *ts;
 	GtkWidget *view, *window, *menubar, *window_box, *view_scroller;
+	GtkTreeModel *filter;
 	GtkTreeViewColumn   *col;
 	GtkCellRenderer     *renderer;
-	GtkTreeSortable *sortable;
 	GtkUIManager *menu_manager;
 	GError *error;
 	GtkActionGroup *action_group;
 	GdkPixbuf *icon;
+	PangoLayout *layout;
+	gint width;
 
 
-	gtk_init(&argc, &argv);
+	/* Scripted lookups never need a display */
+	if(cli_wanted(argc, argv))
+		return cli_main(argc, argv);
+	if(agent_wanted(argc, argv))
+		return agent_main(argc, argv);
 
-	/* set up GTK */
-	ts = gtk_tree_store_new (12,
-	G_TYPE_UINT, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_POINTER, G_TYPE_BOOLEAN, G_TYPE_POINTER, G_TYPE_STRING);
-/*	TL_TYPE, TL_TITLE, TL_TITLE_WEIGHT, TL_USERNAME, TL_PASSWORD, TL_URL, TL_MTIME, TL_MTIME_EPOCH, TL_STRUCT, TL_META_INFO, TL_PW_HASH, TL_FILENAME */
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+	g_thread_init(NULL);
+#endif
+	error = NULL;
+	if(!gtk_init_with_args(&argc, &argv, "[FILE...]", options, NULL,
+				&error)) {
+		g_printerr("%s\n", error ? error->message
+				: "cannot open display");
+		exit(1);
+	}
+
+	profile_init(profile_flag, trace_file);
+
+	/* The unlock agent, if there is one, keeps transformed keys too */
+	db_set_key_cache(agent_get, agent_put);
 
-	sortable = GTK_TREE_SORTABLE(ts);
-	gtk_tree_sortable_set_sort_func(sortable, SORTID_GROUPS_ON_TOP, sort_iter_compare_func, GINT_TO_POINTER(SORTID_GROUPS_ON_TOP), NULL);
-	gtk_tree_sortable_set_sort_column_id(sortable, SORTID_GROUPS_ON_TOP, GTK_SORT_ASCENDING);
+	/* Key derivation and decryption happen here, off the main loop */
+	load_pool = g_thread_pool_new(load_worker, NULL, -1, FALSE, NULL);
+	/* One thread, so saves of a file can't overtake each other */
+	save_pool = g_thread_pool_new(save_worker, NULL, 1, FALSE, NULL);
+	export_ui_init();
+	audit_ui_init();
+
+	/* set up GTK */
+	ts = store_new();
 
 
 	view = gtk_tree_view_new();
@@ -730,35 +2645,55 @@ int main( int argc, char *argv[] ) {
 	gtk_tree_view_append_column(GTK_TREE_VIEW(view), col);
 	renderer = gtk_cell_renderer_text_new();
 	gtk_tree_view_column_pack_start(col, renderer, TRUE);
-	gtk_tree_view_column_add_attribute(col, renderer, "text", TL_TITLE);
+	gtk_tree_view_column_set_cell_data_func(col, renderer, render_field,
+			GINT_TO_POINTER(FIELD_TITLE), NULL);
 	gtk_tree_view_column_add_attribute(col, renderer, "weight", TL_TITLE_WEIGHT);
 	gtk_tree_view_set_search_column(GTK_TREE_VIEW(view), TL_TITLE);
-/*	Save this tidbit for when we want RW databases
-	g_object_set(renderer, "editable", TRUE, NULL);
-*/
+	gtk_tree_view_set_search_equal_func(GTK_TREE_VIEW(view), search_title,
+			NULL, NULL);
+	g_object_set_data(G_OBJECT(renderer), "field",
+			GINT_TO_POINTER(FIELD_TITLE));
+	g_signal_connect(renderer, "edited", G_CALLBACK(cell_edited), view);
+	sort_by_column(GTK_TREE_VIEW(view), col, SORTID_GROUPS_ON_TOP);
+	gtk_tree_view_column_set_sort_indicator(col, TRUE);
 
 	col = gtk_tree_view_column_new();
 	gtk_tree_view_column_set_title(col, "Username");
 	gtk_tree_view_append_column(GTK_TREE_VIEW(view), col);
 	renderer = gtk_cell_renderer_text_new();
 	gtk_tree_view_column_pack_start(col, renderer, TRUE);
-	gtk_tree_view_column_add_attribute(col, renderer, "text", TL_USERNAME);
+	gtk_tree_view_column_set_cell_data_func(col, renderer, render_field,
+			GINT_TO_POINTER(FIELD_USERNAME), NULL);
+	g_object_set_data(G_OBJECT(renderer), "field",
+			GINT_TO_POINTER(FIELD_USERNAME));
+	g_signal_connect(renderer, "edited", G_CALLBACK(cell_edited), view);
 
 	col = gtk_tree_view_column_new();
 	gtk_tree_view_column_set_title(col, "URL");
 	gtk_tree_view_append_column(GTK_TREE_VIEW(view), col);
 	renderer = gtk_cell_renderer_text_new();
 	gtk_tree_view_column_pack_start(col, renderer, TRUE);
-	gtk_tree_view_column_add_attribute(col, renderer, "text", TL_URL);
-
-/*
+	gtk_tree_view_column_set_cell_data_func(col, renderer, render_field,
+			GINT_TO_POINTER(FIELD_URL), NULL);
+	g_object_set_data(G_OBJECT(renderer), "field",
+			GINT_TO_POINTER(FIELD_URL));
+	g_signal_connect(renderer, "edited", G_CALLBACK(cell_edited), view);
+
+	/* Every time is as wide as this one, so the column never has to
+	 * measure its rows */
 	col = gtk_tree_view_column_new();
 	gtk_tree_view_column_set_title(col, "Modified");
 	gtk_tree_view_append_column(GTK_TREE_VIEW(view), col);
 	renderer = gtk_cell_renderer_text_new();
 	gtk_tree_view_column_pack_start(col, renderer, TRUE);
-	gtk_tree_view_column_add_attribute(col, renderer, "text", TL_MTIME);
-*/
+	gtk_tree_view_column_set_cell_data_func(col, renderer, render_mtime,
+			NULL, NULL);
+	layout = gtk_widget_create_pango_layout(view, "0000-00-00 00:00");
+	pango_layout_get_pixel_size(layout, &width, NULL);
+	g_object_unref(layout);
+	gtk_tree_view_column_set_sizing(col, GTK_TREE_VIEW_COLUMN_FIXED);
+	gtk_tree_view_column_set_fixed_width(col, width + 12);
+	sort_by_column(GTK_TREE_VIEW(view), col, SORTID_MTIME);
 /*	
 	col = gtk_tree_view_column_new();
 	gtk_tree_view_column_set_title(col, "Is group");
@@ -768,8 +2703,16 @@ int main( int argc, char *argv[] ) {
 	gtk_tree_view_column_add_attribute(col, renderer, "text", TL_ISGROUP);
 */
 
-	gtk_tree_view_set_model(GTK_TREE_VIEW(view), GTK_TREE_MODEL(ts));
-	g_object_unref(ts);
+	/* The view keeps its own hold on the store so the search filter in
+	 * between can come and go */
+	filter = new_filter(GTK_TREE_MODEL(ts));
+	gtk_tree_view_set_model(GTK_TREE_VIEW(view), filter);
+	g_object_unref(filter);
+	g_object_set_data_full(G_OBJECT(view), "store", ts, g_object_unref);
+
+	search_entry = gtk_entry_new();
+	g_signal_connect(search_entry, "changed", G_CALLBACK(search_changed),
+		view);
 
 	gtk_tree_selection_set_mode(
 			gtk_tree_view_get_selection(GTK_TREE_VIEW(view)),
@@ -809,6 +2752,8 @@ int main( int argc, char *argv[] ) {
 		menu_manager);
 	g_signal_connect(view, "popup-menu", (GCallback) tv_popup_menu_button,
 		menu_manager);
+	g_signal_connect(view, "test-expand-row", G_CALLBACK(expand_row),
+		NULL);
 
 	gtk_window_add_accel_group (GTK_WINDOW (window), 
 		gtk_ui_manager_get_accel_group (menu_manager));
@@ -819,10 +2764,13 @@ int main( int argc, char *argv[] ) {
 	gtk_container_add (GTK_CONTAINER (window), window_box);
 
 	gtk_box_pack_start (GTK_BOX (window_box), menubar, FALSE, TRUE, 0);
+	gtk_box_pack_start (GTK_BOX (window_box), search_entry, FALSE, TRUE, 0);
         gtk_box_pack_end (GTK_BOX (window_box), view_scroller, TRUE, TRUE, 0);
 
 	gtk_widget_show_all(window);
 
+	open_files(GTK_TREE_VIEW(view), argc - 1, argv + 1, shared_password);
+
 	gtk_main();
 
 	return 0;
@@ -0,0 +1,187 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "input.h"
+
+/* First guess at the size of something we can't stat the size of */
+#define READ_CHUNK (64 * 1024)
+
+/* libkpass takes lengths as int */
+#define INPUT_MAX INT_MAX
+
+static int is_stdin(const char *filename) {
+	return !strcmp(filename, "-");
+}
+
+/* Ask for the whole file to be read ahead in one go, rather than a page at
+ * a time as it's touched */
+static void read_ahead(int fd) {
+#ifdef HAVE_POSIX_FADVISE
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+}
+
+static int map_input(struct input *in, size_t len) {
+	int flags = MAP_SHARED;
+	void *data;
+
+#ifdef MAP_POPULATE
+	flags |= MAP_POPULATE;
+#endif
+	data = mmap(NULL, len, PROT_READ, flags, in->fd, 0);
+	if(data == MAP_FAILED)
+		return -1;
+
+	in->data = data;
+	in->len = len;
+	in->mapped = 1;
+	return 0;
+}
+
+/* Read until end of file into a buffer of our own.  size is how much to
+ * expect, which only has to be a guess. */
+static int read_input(struct input *in, size_t size) {
+	uint8_t *buf, *bigger;
+	size_t len = 0;
+	ssize_t got;
+
+	buf = malloc(size + 1);
+	if(!buf)
+		return -1;
+
+	for(;;) {
+		/* Always room for one more byte, so end of file is seen
+		 * without growing the buffer when size was right */
+		if(len == size + 1) {
+			if(size >= INPUT_MAX) {
+				free(buf);
+				errno = EFBIG;
+				return -1;
+			}
+			size = size > INPUT_MAX / 2 ? INPUT_MAX : size * 2;
+			bigger = realloc(buf, size + 1);
+			if(!bigger) {
+				free(buf);
+				return -1;
+			}
+			buf = bigger;
+		}
+
+		got = read(in->fd, buf + len, size + 1 - len);
+		if(got == -1 && errno == EINTR)
+			continue;
+		if(got == -1) {
+			free(buf);
+			return -1;
+		}
+		if(!got)
+			break;
+		len += got;
+	}
+
+	if(len > INPUT_MAX) {
+		free(buf);
+		errno = EFBIG;
+		return -1;
+	}
+
+	in->data = buf;
+	in->len = len;
+	in->mapped = 0;
+	return 0;
+}
+
+int input_open(struct input *in, const char *filename) {
+	struct stat sb;
+	int err;
+
+	memset(in, 0, sizeof(*in));
+
+	/* A copy, so it can be closed like any other */
+	if(is_stdin(filename))
+		in->fd = dup(STDIN_FILENO);
+	else
+		in->fd = open(filename, O_RDONLY);
+	if(in->fd == -1)
+		return -1;
+
+	if(fstat(in->fd, &sb) == -1) {
+		err = errno;
+		close(in->fd);
+		errno = err;
+		return -2;
+	}
+
+	in->rereadable = S_ISREG(sb.st_mode) && !is_stdin(filename);
+
+	if(S_ISREG(sb.st_mode)) {
+		if(sb.st_size > INPUT_MAX) {
+			close(in->fd);
+			errno = EFBIG;
+			return -3;
+		}
+
+		read_ahead(in->fd);
+
+		/* Some FUSE filesystems can't map, and nothing maps an
+		 * empty file */
+		if(sb.st_size && !map_input(in, sb.st_size))
+			return 0;
+	}
+
+	if(read_input(in, S_ISREG(sb.st_mode) && sb.st_size ?
+				sb.st_size : READ_CHUNK)) {
+		err = errno;
+		close(in->fd);
+		errno = err;
+		return -3;
+	}
+
+	close(in->fd);
+	in->fd = -1;
+	return 0;
+}
+
+void input_close(struct input *in) {
+	if(in->mapped) {
+		munmap((void*)in->data, in->len);
+		close(in->fd);
+	} else {
+		free((void*)in->data);
+	}
+	memset(in, 0, sizeof(*in));
+	in->fd = -1;
+}
+
+int input_rereadable(const char *filename) {
+	struct stat sb;
+
+	return !is_stdin(filename) && !stat(filename, &sb) &&
+		S_ISREG(sb.st_mode);
+}
@@ -0,0 +1,53 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GTKPASS_INPUT_H
+#define GTKPASS_INPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The whole contents of a database file, however they were got */
+struct input {
+	const uint8_t *data;
+	size_t len;
+	/* Held open while mapped, -1 once a read is done with it */
+	int fd;
+	int mapped;
+	/* Whether opening the same name again gets the same file, which
+	 * pipes and stdin don't */
+	int rereadable;
+};
+
+/* Get all of filename, "-" being stdin.  Regular files are mapped and
+ * paged in up front; pipes, sockets and anything that won't map are read
+ * once into a private buffer.  Either way in->data stays valid until
+ * input_close().
+ *
+ * -1: open failed
+ * -2: fstat failed
+ * -3: mapping and reading both failed
+ * with errno set
+ */
+int input_open(struct input *in, const char *filename);
+void input_close(struct input *in);
+
+/* Non-zero if filename could be read again after input_open() */
+int input_rereadable(const char *filename);
+
+#endif
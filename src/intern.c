@@ -0,0 +1,140 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "config.h"
+#include "intern.h"
+
+struct atom {
+	/* Sets referring to this one */
+	guint refs;
+	gsize len;
+	gchar str[1];
+};
+
+struct intern_set {
+	/* Atoms this set refers to, each once, with how many times the set
+	 * has added it and not released it */
+	GHashTable *atoms;
+	gsize added;
+	gsize stored;
+};
+
+/* Every atom, by its string.  The lock covers this, the refs of each atom
+ * and usage. */
+static GHashTable *atoms;
+static struct intern_usage usage;
+G_LOCK_DEFINE_STATIC(atoms);
+
+intern_set *intern_set_new(void) {
+	intern_set *set;
+
+	set = g_new0(intern_set, 1);
+	set->atoms = g_hash_table_new(g_direct_hash, g_direct_equal);
+	return set;
+}
+
+static void unref_atom(gpointer key, gpointer value, gpointer data) {
+	struct atom *atom = key;
+
+	/* The caller holds the lock */
+	if(--atom->refs)
+		return;
+	g_hash_table_remove(atoms, atom->str);
+	usage.strings--;
+	usage.bytes -= atom->len + 1;
+	g_free(atom);
+}
+
+void intern_set_free(intern_set *set) {
+	G_LOCK(atoms);
+	g_hash_table_foreach(set->atoms, unref_atom, NULL);
+	G_UNLOCK(atoms);
+
+	g_hash_table_destroy(set->atoms);
+	g_free(set);
+}
+
+const gchar *intern_add(intern_set *set, const gchar *s) {
+	struct atom *atom;
+	gsize len = strlen(s);
+	guint count;
+
+	G_LOCK(atoms);
+	if(!atoms)
+		atoms = g_hash_table_new(g_str_hash, g_str_equal);
+
+	atom = g_hash_table_lookup(atoms, s);
+	if(!atom) {
+		atom = g_malloc(offsetof(struct atom, str) + len + 1);
+		atom->refs = 0;
+		atom->len = len;
+		memcpy(atom->str, s, len + 1);
+		g_hash_table_insert(atoms, atom->str, atom);
+		usage.strings++;
+		usage.bytes += len + 1;
+	}
+
+	count = GPOINTER_TO_UINT(g_hash_table_lookup(set->atoms, atom));
+	if(!count) {
+		atom->refs++;
+		set->stored += len + 1;
+	}
+	g_hash_table_insert(set->atoms, atom, GUINT_TO_POINTER(count + 1));
+	G_UNLOCK(atoms);
+
+	set->added += len + 1;
+	return atom->str;
+}
+
+void intern_release(intern_set *set, const gchar *s) {
+	struct atom *atom;
+	guint count;
+
+	atom = (struct atom*)(s - offsetof(struct atom, str));
+	count = GPOINTER_TO_UINT(g_hash_table_lookup(set->atoms, atom));
+	if(!count)
+		return;
+
+	set->added -= atom->len + 1;
+	if(--count) {
+		g_hash_table_insert(set->atoms, atom, GUINT_TO_POINTER(count));
+		return;
+	}
+
+	g_hash_table_remove(set->atoms, atom);
+	set->stored -= atom->len + 1;
+
+	G_LOCK(atoms);
+	unref_atom(atom, NULL, NULL);
+	G_UNLOCK(atoms);
+}
+
+void intern_set_size(intern_set *set, gsize *added, gsize *stored) {
+	*added = set->added;
+	*stored = set->stored;
+}
+
+void intern_get_usage(struct intern_usage *out) {
+	G_LOCK(atoms);
+	*out = usage;
+	G_UNLOCK(atoms);
+}
@@ -0,0 +1,58 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GTKPASS_INTERN_H
+#define GTKPASS_INTERN_H
+
+#include <glib.h>
+
+/* Strings shared between every open file.  Each distinct string is kept
+ * once, for as long as any set refers to it, so a username or title that
+ * appears thousands of times in one vault, or in several vaults, costs one
+ * copy.  Sets can be filled and freed from any thread, but each one should
+ * only be used by one thread at a time. */
+typedef struct intern_set intern_set;
+
+/* Bytes of string data held, summed over every distinct string */
+struct intern_usage {
+	guint strings;
+	gsize bytes;
+};
+
+intern_set *intern_set_new(void);
+
+/* Drop set's references, freeing strings nothing else refers to */
+void intern_set_free(intern_set *set);
+
+/* The shared copy of s, which stays valid until set is freed or has
+ * released it as many times as it was added */
+const gchar *intern_add(intern_set *set, const gchar *s);
+
+/* Give back one intern_add() to set of s, which must be the string it
+ * returned.  Sets count their adds, so a string only goes once every row
+ * holding it has let go. */
+void intern_release(intern_set *set, const gchar *s);
+
+/* Bytes the strings added to set and not released would have taken
+ * copied each time, and what the distinct ones among them take, both
+ * counting the NULs */
+void intern_set_size(intern_set *set, gsize *added, gsize *stored);
+
+void intern_get_usage(struct intern_usage *usage);
+
+#endif
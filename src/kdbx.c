@@ -0,0 +1,959 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+#include <kpass.h>
+#include <zlib.h>
+
+#include "config.h"
+#include "aes.h"
+#include "db.h"
+#include "kdbx.h"
+
+#define KDBX_SIG1 0x9AA2D903
+#define KDBX_SIG2 0xB54BFB67
+
+/* KDBX 4 changed the key derivation and the framing, we only read 3.1 and
+ * older */
+#define KDBX_MAX_MAJOR 3
+
+/* Outer header field ids */
+enum {
+	KDBX_END = 0,
+	KDBX_CIPHER = 2,
+	KDBX_COMPRESSION,
+	KDBX_MASTER_SEED,
+	KDBX_TRANSFORM_SEED,
+	KDBX_ROUNDS,
+	KDBX_IV,
+	KDBX_STREAM_KEY,
+	KDBX_START_BYTES,
+	KDBX_STREAM_ID,
+};
+
+/* Inner random streams protecting values in the XML */
+#define KDBX_STREAM_NONE 0
+#define KDBX_STREAM_SALSA20 2
+
+/* Ciphertext decrypted at a time, and the most gunzipped at a time */
+#define KDBX_CHUNK 65536
+
+/* Groups and entries handed to the batch function at a time */
+#define KDBX_BATCH 256
+
+static const uint8_t aes_cipher[16] = {
+	0x31, 0xc1, 0xf2, 0xe6, 0xbf, 0x71, 0x43, 0x50,
+	0xbe, 0x58, 0x05, 0x21, 0x6a, 0xfc, 0x5a, 0xff,
+};
+
+static const uint8_t salsa20_nonce[8] = {
+	0xe8, 0x30, 0x09, 0x4b, 0x97, 0x20, 0x5d, 0x2a,
+};
+
+/* The parts of the outer header we use.  The pointers are into the file. */
+struct kdbx_header {
+	const uint8_t *cipher;
+	uint32_t compression;
+	const uint8_t *master_seed;
+	uint32_t master_seed_len;
+	const uint8_t *transform_seed;
+	uint64_t rounds;
+	const uint8_t *iv;
+	const uint8_t *stream_key;
+	uint32_t stream_key_len;
+	const uint8_t *start_bytes;
+	uint32_t stream_id;
+	uint32_t version;
+	size_t len;
+};
+
+struct salsa20 {
+	uint32_t state[16];
+	uint8_t block[64];
+	int used;
+};
+
+/* A group that has been started but maybe not handed over yet */
+struct open_group {
+	kpass_group *group;
+	gboolean emitted;
+};
+
+/* Everything between the ciphertext and the parsed groups and entries */
+struct kdbx_reader {
+	kpass_db *db;
+	kdbx_batch_func batch;
+	void *data;
+	kpass_retval error;
+
+	/* Plaintext waiting for the rest of its hashed block */
+	GByteArray *blocks;
+	uint32_t block_index;
+	gboolean blocks_done;
+
+	gboolean gzip;
+	z_stream z;
+	gboolean z_done;
+	uint8_t *inflated;
+
+	GMarkupParseContext *xml;
+	struct salsa20 salsa;
+	gboolean salsa20;
+	GArray *open_groups;
+	kpass_entry *entry;
+	int history;
+	char *key;
+	GString *text;
+	gboolean collect;
+	gboolean protected;
+	uint32_t next_id;
+
+	/* Parsed and not handed over yet */
+	GPtrArray *groups;
+	GPtrArray *entries;
+};
+
+static uint32_t get_u32(const uint8_t *p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void sha256(const uint8_t *a, size_t a_len, const uint8_t *b,
+		size_t b_len, uint8_t out[32]) {
+	GChecksum *sum;
+	gsize len = 32;
+
+	sum = g_checksum_new(G_CHECKSUM_SHA256);
+	g_checksum_update(sum, a, a_len);
+	if(b)
+		g_checksum_update(sum, b, b_len);
+	g_checksum_get_digest(sum, out, &len);
+	g_checksum_free(sum);
+}
+
+#define ROTL(v, n) ((v) << (n) | (v) >> (32 - (n)))
+#define QUARTER(a, b, c, d) do { \
+	x[b] ^= ROTL(x[a] + x[d], 7); \
+	x[c] ^= ROTL(x[b] + x[a], 9); \
+	x[d] ^= ROTL(x[c] + x[b], 13); \
+	x[a] ^= ROTL(x[d] + x[c], 18); \
+} while(0)
+
+static void salsa20_init(struct salsa20 *s, const uint8_t key[32],
+		const uint8_t nonce[8]) {
+	static const uint8_t sigma[16] = "expand 32-byte k";
+	int i;
+
+	for(i = 0; i < 4; i++) {
+		s->state[i * 5] = get_u32(sigma + i * 4);
+		s->state[1 + i] = get_u32(key + i * 4);
+		s->state[11 + i] = get_u32(key + 16 + i * 4);
+	}
+	s->state[6] = get_u32(nonce);
+	s->state[7] = get_u32(nonce + 4);
+	s->state[8] = 0;
+	s->state[9] = 0;
+	s->used = sizeof(s->block);
+}
+
+static void salsa20_block(struct salsa20 *s) {
+	uint32_t x[16];
+	int i;
+
+	memcpy(x, s->state, sizeof(x));
+	for(i = 0; i < 10; i++) {
+		QUARTER(0, 4, 8, 12);
+		QUARTER(5, 9, 13, 1);
+		QUARTER(10, 14, 2, 6);
+		QUARTER(15, 3, 7, 11);
+		QUARTER(0, 1, 2, 3);
+		QUARTER(5, 6, 7, 4);
+		QUARTER(10, 11, 8, 9);
+		QUARTER(15, 12, 13, 14);
+	}
+	for(i = 0; i < 16; i++)
+		put_u32(s->block + i * 4, x[i] + s->state[i]);
+
+	if(!++s->state[8])
+		s->state[9]++;
+	s->used = 0;
+	memset(x, 0, sizeof(x));
+}
+
+/* XOR the next len bytes of keystream into data */
+static void salsa20_xor(struct salsa20 *s, uint8_t *data, size_t len) {
+	size_t i;
+
+	for(i = 0; i < len; i++) {
+		if(s->used == sizeof(s->block))
+			salsa20_block(s);
+		data[i] ^= s->block[s->used++];
+	}
+}
+
+int kdbx_is(const uint8_t *file, size_t len) {
+	return len >= 12 && get_u32(file) == KDBX_SIG1 &&
+		get_u32(file + 4) == KDBX_SIG2;
+}
+
+static kpass_retval parse_header(const uint8_t *file, size_t len,
+		struct kdbx_header *h) {
+	const uint8_t *p = file + 12, *end = file + len;
+	uint16_t size;
+	uint8_t id;
+
+	memset(h, 0, sizeof(*h));
+	h->version = get_u32(file + 8);
+	if(h->version >> 16 > KDBX_MAX_MAJOR)
+		return kpass_unsupported_flag;
+
+	for(;;) {
+		if(end - p < 3)
+			return kpass_init_db_fail;
+		id = p[0];
+		size = p[1] | p[2] << 8;
+		p += 3;
+		if(end - p < size)
+			return kpass_init_db_fail;
+
+		switch(id) {
+			case KDBX_END:
+				h->len = p + size - file;
+				goto parse_header_done;
+			case KDBX_CIPHER:
+				if(size != 16)
+					return kpass_init_db_fail;
+				h->cipher = p;
+				break;
+			case KDBX_COMPRESSION:
+				if(size != 4)
+					return kpass_init_db_fail;
+				h->compression = get_u32(p);
+				break;
+			case KDBX_MASTER_SEED:
+				h->master_seed = p;
+				h->master_seed_len = size;
+				break;
+			case KDBX_TRANSFORM_SEED:
+				if(size != 32)
+					return kpass_init_db_fail;
+				h->transform_seed = p;
+				break;
+			case KDBX_ROUNDS:
+				if(size != 8)
+					return kpass_init_db_fail;
+				h->rounds = get_u32(p) |
+					(uint64_t)get_u32(p + 4) << 32;
+				break;
+			case KDBX_IV:
+				if(size != 16)
+					return kpass_init_db_fail;
+				h->iv = p;
+				break;
+			case KDBX_STREAM_KEY:
+				h->stream_key = p;
+				h->stream_key_len = size;
+				break;
+			case KDBX_START_BYTES:
+				if(size != 32)
+					return kpass_init_db_fail;
+				h->start_bytes = p;
+				break;
+			case KDBX_STREAM_ID:
+				if(size != 4)
+					return kpass_init_db_fail;
+				h->stream_id = get_u32(p);
+				break;
+			default:
+				break;
+		}
+		p += size;
+	}
+
+parse_header_done:
+	if(!h->cipher || !h->master_seed || !h->transform_seed || !h->iv ||
+			!h->start_bytes)
+		return kpass_init_db_fail;
+	if(memcmp(h->cipher, aes_cipher, 16) || h->compression > 1)
+		return kpass_unsupported_flag;
+	if(h->stream_id == KDBX_STREAM_SALSA20 ? !h->stream_key :
+			h->stream_id != KDBX_STREAM_NONE)
+		return kpass_unsupported_flag;
+	return kpass_success;
+}
+
+/* The KDBX key: the password hash is hashed again as the only part of the
+ * composite key, then transformed like a KDB key.  The transform is skipped
+ * if tk already holds it, and left there if not. */
+static void master_key(const struct kdbx_header *h, const uint8_t *pw_hash,
+		struct transformed_key *tk, uint8_t key[32]) {
+	aes_backend backend;
+	uint64_t rounds;
+	uint32_t step;
+
+	if(tk && tk->valid) {
+		memcpy(key, tk->key, 32);
+	} else {
+		backend = aes_have_aesni() ? AES_AESNI : AES_PORTABLE;
+
+		sha256(pw_hash, PW_HASH_LEN, NULL, 0, key);
+		for(rounds = h->rounds; rounds; rounds -= step) {
+			step = MIN(rounds, G_MAXUINT32);
+			aes_transform(backend, h->transform_seed, key, step);
+		}
+		sha256(key, 32, NULL, 0, key);
+		if(tk) {
+			memcpy(tk->key, key, 32);
+			tk->valid = 1;
+		}
+	}
+	sha256(h->master_seed, h->master_seed_len, key, 32, key);
+}
+
+/* Hand over what has been parsed so far, if there's a taker */
+static void flush(struct kdbx_reader *r, gboolean all) {
+	if(!r->batch || (!all && r->groups->len + r->entries->len <
+				KDBX_BATCH))
+		return;
+	if(!r->groups->len && !r->entries->len)
+		return;
+
+	r->batch((kpass_group**)r->groups->pdata, r->groups->len,
+			(kpass_entry**)r->entries->pdata, r->entries->len,
+			r->data);
+	g_ptr_array_set_size(r->groups, 0);
+	g_ptr_array_set_size(r->entries, 0);
+}
+
+static struct open_group *top_group(struct kdbx_reader *r) {
+	if(!r->open_groups->len)
+		return NULL;
+	return &g_array_index(r->open_groups, struct open_group,
+			r->open_groups->len - 1);
+}
+
+/* A group goes out once its own fields are in, which is when the first
+ * thing inside it starts or when it ends.  It isn't touched after that. */
+static gboolean emit_group(struct kdbx_reader *r, struct open_group *og) {
+	if(og->emitted)
+		return TRUE;
+	if(!og->group->name)
+		og->group->name = strdup("");
+	if(!og->group->name)
+		return FALSE;
+	og->group->id = ++r->next_id;
+	og->emitted = TRUE;
+	g_ptr_array_add(r->groups, og->group);
+	flush(r, FALSE);
+	return TRUE;
+}
+
+/* Running out of memory fails the parse the same way bad XML does */
+static void no_memory(GError **error) {
+	g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT,
+			"Out of memory");
+}
+
+static const char *parent_element(GMarkupParseContext *ctx) {
+	const GSList *stack;
+
+	stack = g_markup_parse_context_get_element_stack(ctx);
+	if(!stack || !stack->next)
+		return "";
+	return stack->next->data;
+}
+
+static gboolean is_time(const char *name) {
+	return !strcmp(name, "CreationTime") ||
+		!strcmp(name, "LastModificationTime") ||
+		!strcmp(name, "LastAccessTime") ||
+		!strcmp(name, "ExpiryTime");
+}
+
+/* Elements whose text we keep.  Anything else is skipped, short of
+ * protected values which still have to use up their keystream. */
+static gboolean wanted_text(const char *name, const char *parent) {
+	if(!strcmp(parent, "String"))
+		return !strcmp(name, "Key") || !strcmp(name, "Value");
+	if(!strcmp(parent, "Entry"))
+		return !strcmp(name, "UUID") || !strcmp(name, "IconID");
+	if(!strcmp(parent, "Group"))
+		return !strcmp(name, "Name") || !strcmp(name, "IconID");
+	if(!strcmp(parent, "Times"))
+		return is_time(name);
+	return FALSE;
+}
+
+static void start_element(GMarkupParseContext *ctx, const gchar *name,
+		const gchar **attr_names, const gchar **attr_values,
+		gpointer data, GError **error) {
+	struct kdbx_reader *r = data;
+	struct open_group og, *top;
+	int i;
+
+	if(!strcmp(name, "Group")) {
+		top = top_group(r);
+		og.group = NULL;
+		if(!top || emit_group(r, top))
+			og.group = calloc(1, sizeof(kpass_group));
+		if(!og.group) {
+			no_memory(error);
+			return;
+		}
+		og.group->level = r->open_groups->len;
+		og.emitted = FALSE;
+		g_array_append_val(r->open_groups, og);
+		return;
+	}
+
+	if(!strcmp(name, "History")) {
+		r->history++;
+		return;
+	}
+
+	if(!strcmp(name, "Entry")) {
+		top = top_group(r);
+		if(r->history || !top)
+			return;
+		if(!emit_group(r, top) ||
+				!(r->entry = calloc(1, sizeof(kpass_entry)))) {
+			no_memory(error);
+			return;
+		}
+		r->entry->group_id = top->group->id;
+		return;
+	}
+
+	r->protected = FALSE;
+	for(i = 0; attr_names[i]; i++)
+		if(!strcmp(attr_names[i], "Protected") &&
+				!strcmp(attr_values[i], "True"))
+			r->protected = TRUE;
+
+	r->collect = r->protected || wanted_text(name, parent_element(ctx));
+	g_string_truncate(r->text, 0);
+}
+
+static void text(GMarkupParseContext *ctx, const gchar *text, gsize len,
+		gpointer data, GError **error) {
+	struct kdbx_reader *r = data;
+
+	if(r->collect)
+		g_string_append_len(r->text, text, len);
+}
+
+/* The text of a protected value: base64 of the plaintext XORed with the
+ * inner stream, which runs on through every protected value in order */
+static char *unprotect(struct kdbx_reader *r) {
+	guchar *raw;
+	gsize len;
+	char *value;
+
+	raw = g_base64_decode(r->text->str, &len);
+	if(r->salsa20)
+		salsa20_xor(&r->salsa, raw, len);
+
+	value = malloc(len + 1);
+	if(value) {
+		memcpy(value, raw, len);
+		value[len] = '\0';
+	}
+	memset(raw, 0, len);
+	g_free(raw);
+	return value;
+}
+
+static gboolean set_string(struct kdbx_reader *r, char *value) {
+	kpass_entry *e = r->entry;
+	char **field = NULL;
+
+	if(!r->key)
+		return TRUE;
+	if(!strcmp(r->key, "Title"))
+		field = &e->title;
+	else if(!strcmp(r->key, "UserName"))
+		field = &e->username;
+	else if(!strcmp(r->key, "Password"))
+		field = &e->password;
+	else if(!strcmp(r->key, "URL"))
+		field = &e->url;
+	else if(!strcmp(r->key, "Notes"))
+		field = &e->notes;
+	if(!field)
+		return TRUE;
+
+	if(*field) {
+		memset(*field, 0, strlen(*field));
+		free(*field);
+	}
+	*field = strdup(value);
+	return *field != NULL;
+}
+
+static void set_time(const char *name, const char *iso, uint8_t ctime[5],
+		uint8_t mtime[5], uint8_t atime[5], uint8_t etime[5]) {
+	GTimeVal tv;
+	struct tm tms;
+	time_t t;
+
+	if(!g_time_val_from_iso8601(iso, &tv))
+		return;
+	t = tv.tv_sec;
+	localtime_r(&t, &tms);
+
+	if(!strcmp(name, "CreationTime"))
+		kpass_pack_time(&tms, ctime);
+	else if(!strcmp(name, "LastModificationTime"))
+		kpass_pack_time(&tms, mtime);
+	else if(!strcmp(name, "LastAccessTime"))
+		kpass_pack_time(&tms, atime);
+	else
+		kpass_pack_time(&tms, etime);
+}
+
+/* Use the text of a wanted element.  Entries in History only ever get
+ * here to use up their protected values.  FALSE when out of memory. */
+static gboolean use_text(struct kdbx_reader *r, const char *name,
+		const char *parent) {
+	struct open_group *top;
+	kpass_entry *e = NULL;
+	kpass_group *g = NULL;
+	gboolean ok = TRUE;
+	guchar *uuid;
+	char *value;
+	gsize len;
+
+	value = r->protected ? unprotect(r) : strdup(r->text->str);
+	if(!value)
+		return FALSE;
+	if(r->history)
+		goto use_text_out;
+
+	/* Whatever is open innermost gets the field */
+	top = top_group(r);
+	if(r->entry)
+		e = r->entry;
+	else if(top && !top->emitted)
+		g = top->group;
+
+	if(!strcmp(parent, "String")) {
+		if(!e)
+			goto use_text_out;
+		if(!strcmp(name, "Key")) {
+			free(r->key);
+			r->key = value;
+			return TRUE;
+		}
+		ok = set_string(r, value);
+	} else if(!strcmp(name, "UUID")) {
+		uuid = g_base64_decode(value, &len);
+		if(e && len == sizeof(e->uuid))
+			memcpy(e->uuid, uuid, len);
+		g_free(uuid);
+	} else if(!strcmp(name, "IconID")) {
+		if(e)
+			e->image_id = atoi(value);
+		else if(g)
+			g->image_id = atoi(value);
+	} else if(!strcmp(name, "Name")) {
+		if(!g || g->name)
+			goto use_text_out;
+		g->name = value;
+		return TRUE;
+	} else if(is_time(name)) {
+		if(e)
+			set_time(name, value, e->ctime, e->mtime, e->atime,
+					e->etime);
+		else if(g)
+			set_time(name, value, g->ctime, g->mtime, g->atime,
+					g->etime);
+	}
+
+use_text_out:
+	memset(value, 0, strlen(value));
+	free(value);
+	return ok;
+}
+
+/* KDB entries never have missing strings */
+static gboolean fill_entry(kpass_entry *e) {
+	char **fields[] = { &e->title, &e->url, &e->username, &e->password,
+		&e->notes };
+	int i;
+
+	for(i = 0; i < G_N_ELEMENTS(fields); i++) {
+		if(!*fields[i])
+			*fields[i] = strdup("");
+		if(!*fields[i])
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void end_element(GMarkupParseContext *ctx, const gchar *name,
+		gpointer data, GError **error) {
+	struct kdbx_reader *r = data;
+	struct open_group *top;
+
+	if(r->collect) {
+		if(!use_text(r, name, parent_element(ctx)))
+			no_memory(error);
+		memset(r->text->str, 0, r->text->len);
+		r->collect = FALSE;
+		return;
+	}
+
+	if(!strcmp(name, "History")) {
+		r->history--;
+	} else if(!strcmp(name, "Entry")) {
+		if(r->history || !r->entry)
+			return;
+		if(!fill_entry(r->entry)) {
+			no_memory(error);
+			return;
+		}
+		g_ptr_array_add(r->entries, r->entry);
+		r->entry = NULL;
+		flush(r, FALSE);
+	} else if(!strcmp(name, "Group")) {
+		top = top_group(r);
+		if(!emit_group(r, top)) {
+			no_memory(error);
+			return;
+		}
+		g_array_set_size(r->open_groups, r->open_groups->len - 1);
+	} else if(!strcmp(name, "String")) {
+		free(r->key);
+		r->key = NULL;
+	}
+}
+
+static const GMarkupParser kdbx_parser = {
+	start_element,
+	end_element,
+	text,
+	NULL,
+	NULL,
+};
+
+static void parse_xml(struct kdbx_reader *r, const uint8_t *data,
+		size_t len) {
+	GError *err = NULL;
+
+	if(!g_markup_parse_context_parse(r->xml, (const gchar*)data, len,
+				&err)) {
+		r->error = kpass_load_decrypted_data_entry_fail;
+		g_error_free(err);
+	}
+}
+
+static void inflate_data(struct kdbx_reader *r, const uint8_t *data,
+		size_t len) {
+	size_t out;
+	int ret;
+
+	if(!r->gzip) {
+		parse_xml(r, data, len);
+		return;
+	}
+
+	r->z.next_in = (Bytef*)data;
+	r->z.avail_in = len;
+	/* A full buffer may mean zlib has more to give even with no input
+	 * left, so go round until it comes up short */
+	do {
+		if(r->z_done || r->error)
+			return;
+		r->z.next_out = r->inflated;
+		r->z.avail_out = KDBX_CHUNK;
+		ret = inflate(&r->z, Z_NO_FLUSH);
+		if(ret == Z_STREAM_END) {
+			r->z_done = TRUE;
+		} else if(ret == Z_BUF_ERROR) {
+			/* Nothing more until the next block */
+			return;
+		} else if(ret != Z_OK) {
+			r->error = kpass_decrypt_db_fail;
+			return;
+		}
+		out = KDBX_CHUNK - r->z.avail_out;
+		parse_xml(r, r->inflated, out);
+	} while(r->z.avail_in || !r->z.avail_out);
+}
+
+/* The payload is a run of blocks, each with its index, the SHA-256 of its
+ * data and its length in front.  An empty block with a zero hash ends it.
+ * The key has been checked by the time anything gets here, so failures
+ * mean a damaged file rather than a wrong password. */
+static void read_blocks(struct kdbx_reader *r, const uint8_t *data,
+		size_t len) {
+	uint8_t hash[32];
+	uint32_t size;
+	const uint8_t *b;
+
+	g_byte_array_append(r->blocks, data, len);
+
+	while(!r->blocks_done && !r->error && r->blocks->len >= 40) {
+		b = r->blocks->data;
+		size = get_u32(b + 36);
+		if(get_u32(b) != r->block_index) {
+			r->error = kpass_decrypt_db_fail;
+			return;
+		}
+		if(!size) {
+			memset(hash, 0, sizeof(hash));
+			if(memcmp(hash, b + 4, 32))
+				r->error = kpass_decrypt_db_fail;
+			r->blocks_done = TRUE;
+			return;
+		}
+		if(r->blocks->len - 40 < size)
+			return;
+
+		sha256(b + 40, size, NULL, 0, hash);
+		if(memcmp(hash, b + 4, 32)) {
+			r->error = kpass_decrypt_db_fail;
+			return;
+		}
+		inflate_data(r, b + 40, size);
+		r->block_index++;
+
+		g_byte_array_remove_range(r->blocks, 0, 40 + size);
+		memset(r->blocks->data + r->blocks->len, 0, 40 + size);
+	}
+}
+
+/* Decrypt the payload a chunk at a time and feed it down the line */
+static kpass_retval decrypt_payload(struct kdbx_reader *r,
+		const struct kdbx_header *h, const uint8_t *p, size_t len,
+		const uint8_t key[32]) {
+	uint8_t iv[16], *buf;
+	size_t n, out;
+	gboolean first = TRUE;
+	int pad;
+
+	if(!len || len % 16)
+		return kpass_decrypt_db_fail;
+
+	buf = malloc(KDBX_CHUNK);
+	if(!buf)
+		return kpass_decrypt_db_fail;
+	memcpy(iv, h->iv, 16);
+
+	while(len && !r->error) {
+		n = MIN(len, KDBX_CHUNK);
+		memcpy(buf, p, n);
+		aes_cbc_decrypt(key, iv, buf, n);
+		p += n;
+		len -= n;
+		out = n;
+
+		/* A wrong key shows up here, before anything is parsed */
+		if(first && (n < 32 || memcmp(buf, h->start_bytes, 32))) {
+			r->error = kpass_decrypt_data_fail;
+			break;
+		}
+
+		/* The key is right by now, so bad padding means damage */
+		if(!len) {
+			pad = buf[n - 1];
+			if(pad < 1 || pad > 16 || (size_t)pad > n) {
+				r->error = kpass_decrypt_db_fail;
+				break;
+			}
+			out -= pad;
+		}
+
+		if(first) {
+			if(out < 32) {
+				r->error = kpass_decrypt_db_fail;
+				break;
+			}
+			read_blocks(r, buf + 32, out - 32);
+			first = FALSE;
+		} else {
+			read_blocks(r, buf, out);
+		}
+	}
+
+	memset(buf, 0, KDBX_CHUNK);
+	free(buf);
+
+	/* The blocks ending before the gzip stream does means some of it
+	 * is missing */
+	if(!r->error && (!r->blocks_done || (r->gzip && !r->z_done)))
+		r->error = kpass_decrypt_db_fail;
+	return r->error;
+}
+
+static void free_parsed(GPtrArray *groups, GPtrArray *entries) {
+	int i;
+
+	for(i = 0; i < groups->len; i++)
+		db_group_free(groups->pdata[i]);
+	for(i = 0; i < entries->len; i++)
+		db_entry_free(entries->pdata[i]);
+	g_ptr_array_set_size(groups, 0);
+	g_ptr_array_set_size(entries, 0);
+}
+
+/* With nobody taking batches, the whole lot goes into db */
+static kpass_retval fill_db(struct kdbx_reader *r) {
+	kpass_db *db = r->db;
+
+	db->groups = malloc(MAX(r->groups->len, 1) * sizeof(kpass_group*));
+	db->entries = malloc(MAX(r->entries->len, 1) * sizeof(kpass_entry*));
+	if(!db->groups || !db->entries) {
+		free(db->groups);
+		free(db->entries);
+		db->groups = NULL;
+		db->entries = NULL;
+		return kpass_load_decrypted_data_entry_fail;
+	}
+
+	memcpy(db->groups, r->groups->pdata,
+			r->groups->len * sizeof(kpass_group*));
+	memcpy(db->entries, r->entries->pdata,
+			r->entries->len * sizeof(kpass_entry*));
+	db->groups_len = r->groups->len;
+	db->entries_len = r->entries->len;
+	g_ptr_array_set_size(r->groups, 0);
+	g_ptr_array_set_size(r->entries, 0);
+	return kpass_success;
+}
+
+int kdbx_key_params(const uint8_t *file, size_t len, const uint8_t **seed,
+		uint64_t *rounds) {
+	struct kdbx_header h;
+
+	if(!kdbx_is(file, len) || parse_header(file, len, &h))
+		return -1;
+	*seed = h.transform_seed;
+	*rounds = h.rounds;
+	return 0;
+}
+
+kpass_retval kdbx_load(const uint8_t *file, size_t len,
+		const uint8_t *pw_hash, struct transformed_key *tk,
+		kpass_db *db, kdbx_batch_func batch, void *data) {
+	struct kdbx_header h;
+	struct kdbx_reader r;
+	uint8_t key[32];
+	kpass_retval retval;
+	int i;
+
+	if(!kdbx_is(file, len))
+		return kpass_init_db_fail;
+	retval = parse_header(file, len, &h);
+	if(retval)
+		return retval;
+
+	memset(&r, 0, sizeof(r));
+	r.db = db;
+	r.batch = batch;
+	r.data = data;
+	r.blocks = g_byte_array_new();
+	r.open_groups = g_array_new(FALSE, FALSE, sizeof(struct open_group));
+	r.text = g_string_new(NULL);
+	r.groups = g_ptr_array_new();
+	r.entries = g_ptr_array_new();
+	r.xml = g_markup_parse_context_new(&kdbx_parser, 0, &r, NULL);
+
+	r.gzip = h.compression == 1;
+	if(r.gzip) {
+		r.inflated = malloc(KDBX_CHUNK);
+		/* 16 for a gzip wrapper around the deflate stream */
+		if(!r.inflated || inflateInit2(&r.z, 16 + MAX_WBITS) != Z_OK) {
+			free(r.inflated);
+			r.inflated = NULL;
+			r.gzip = FALSE;
+			r.error = kpass_decrypt_db_fail;
+		}
+	}
+
+	if(h.stream_id == KDBX_STREAM_SALSA20) {
+		sha256(h.stream_key, h.stream_key_len, NULL, 0, key);
+		salsa20_init(&r.salsa, key, salsa20_nonce);
+		r.salsa20 = TRUE;
+	}
+
+	if(!r.error) {
+		master_key(&h, pw_hash, tk, key);
+		retval = decrypt_payload(&r, &h, file + h.len, len - h.len,
+				key);
+	} else {
+		retval = r.error;
+	}
+
+	if(!retval && !g_markup_parse_context_end_parse(r.xml, NULL))
+		retval = kpass_load_decrypted_data_entry_fail;
+	if(!retval && (r.open_groups->len || r.entry))
+		retval = kpass_load_decrypted_data_group_fail;
+
+	if(!retval) {
+		flush(&r, TRUE);
+		retval = fill_db(&r);
+	}
+
+	if(!retval) {
+		db->flags = DB_FLAG_KDBX;
+		db->version = h.version;
+		memcpy(db->encryption_init_vector, h.iv,
+				sizeof(db->encryption_init_vector));
+		db->key_rounds = MIN(h.rounds, G_MAXUINT32);
+	}
+
+	/* Whatever was left half built on failure */
+	free_parsed(r.groups, r.entries);
+	for(i = 0; i < r.open_groups->len; i++)
+		if(!g_array_index(r.open_groups, struct open_group, i).emitted)
+			db_group_free(g_array_index(r.open_groups,
+					struct open_group, i).group);
+	if(r.entry)
+		db_entry_free(r.entry);
+
+	if(r.gzip) {
+		inflateEnd(&r.z);
+		memset(r.inflated, 0, KDBX_CHUNK);
+		free(r.inflated);
+	}
+	g_markup_parse_context_free(r.xml);
+	memset(r.blocks->data, 0, r.blocks->len);
+	g_byte_array_free(r.blocks, TRUE);
+	g_array_free(r.open_groups, TRUE);
+	memset(r.text->str, 0, r.text->len);
+	g_string_free(r.text, TRUE);
+	g_ptr_array_free(r.groups, TRUE);
+	g_ptr_array_free(r.entries, TRUE);
+	free(r.key);
+	memset(&r.salsa, 0, sizeof(r.salsa));
+	memset(key, 0, sizeof(key));
+
+	return retval;
+}
@@ -0,0 +1,60 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GTKPASS_KDBX_H
+#define GTKPASS_KDBX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kpass.h>
+
+#include "aes.h"
+
+/* Takes over groups and entries as they are parsed, in document order.
+ * Every group comes before anything inside it, group ids count up from 1
+ * and each entry's group has been handed over already.  The arrays are
+ * only borrowed, the structs in them now belong to the callee. */
+typedef void (*kdbx_batch_func)(kpass_group **groups, int groups_len,
+		kpass_entry **entries, int entries_len, void *data);
+
+/* Non-zero if the len bytes at file start like a KeePass 2 database */
+int kdbx_is(const uint8_t *file, size_t len);
+
+/* Point seed at the 32 byte transform seed in file's header and set rounds,
+ * which are what the transformed key depends on besides the password.
+ * Returns -1 if the header can't be read. */
+int kdbx_key_params(const uint8_t *file, size_t len, const uint8_t **seed,
+		uint64_t *rounds);
+
+/* Decrypt and parse a KDBX 3.1 database into db, which must be zeroed.  The
+ * ciphertext goes through AES, the block hashes, gunzip and the XML parser
+ * a piece at a time, so nothing is held whole but the parsed data.
+ *
+ * If batch is NULL every group and entry ends up in db, otherwise they are
+ * handed to batch as they come and db only gets the header.  Either way db
+ * is marked with DB_FLAG_KDBX and can't be saved back.  On failure db holds
+ * nothing, but batch may have been called already.
+ *
+ * If tk is given and valid its key is used in place of transforming the
+ * password hash, otherwise it's filled in with the transformed key. */
+kpass_retval kdbx_load(const uint8_t *file, size_t len,
+		const uint8_t *pw_hash, struct transformed_key *tk,
+		kpass_db *db, kdbx_batch_func batch, void *data);
+
+#endif
@@ -0,0 +1,376 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <kpass.h>
+
+#include "config.h"
+#include "db.h"
+#include "merge.h"
+
+static char *content_key(const kpass_entry *e) {
+	return g_strjoin("\n", e->title ? e->title : "",
+			e->username ? e->username : "",
+			e->url ? e->url : "", NULL);
+}
+
+static char **group_paths(kpass_db *db) {
+	char **paths;
+	const char *name;
+	int *parents;
+	int i;
+
+	parents = group_parents(db);
+	if(!parents)
+		return NULL;
+	paths = g_new0(char*, db->groups_len + 1);
+
+	/* Parents always come first */
+	for(i = 0; i < db->groups_len; i++) {
+		name = db->groups[i]->name ? db->groups[i]->name : "";
+		if(parents[i] < 0)
+			paths[i] = g_strdup(name);
+		else
+			paths[i] = g_strconcat(paths[parents[i]], "/", name,
+					NULL);
+	}
+
+	free(parents);
+	return paths;
+}
+
+struct merge_plan *merge_plan_new(kpass_db *into, kpass_db *from) {
+	GHashTable *by_uuid, *by_content, *added;
+	struct merge_plan *plan;
+	struct merge_change change;
+	kpass_entry *e;
+	char *claimed, *key, **from_paths;
+	int i, j;
+
+	from_paths = group_paths(from);
+	if(!from_paths)
+		return NULL;
+
+	plan = g_new0(struct merge_plan, 1);
+	plan->into = into;
+	plan->from = from;
+	plan->changes = g_array_new(FALSE, FALSE, sizeof(struct merge_change));
+	plan->from_paths = from_paths;
+
+	by_uuid = g_hash_table_new(uuid_hash, uuid_equal);
+	by_content = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			NULL);
+	added = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	for(j = 0; j < into->entries_len; j++) {
+		e = into->entries[j];
+		if(is_meta_stream(e))
+			continue;
+		g_hash_table_insert(by_uuid, e->uuid, GINT_TO_POINTER(j + 1));
+		key = content_key(e);
+		if(g_hash_table_lookup(by_content, key))
+			g_free(key);
+		else
+			g_hash_table_insert(by_content, key,
+					GINT_TO_POINTER(j + 1));
+	}
+
+	/* Each entry of into is matched at most once */
+	claimed = calloc(into->entries_len + 1, 1);
+
+	for(i = 0; i < from->entries_len; i++) {
+		e = from->entries[i];
+		if(is_meta_stream(e))
+			continue;
+
+		key = content_key(e);
+		j = GPOINTER_TO_INT(g_hash_table_lookup(by_uuid, e->uuid)) - 1;
+		if(j < 0)
+			j = GPOINTER_TO_INT(g_hash_table_lookup(by_content,
+						key)) - 1;
+
+		if(j < 0) {
+			/* Duplicates within from only get added once */
+			if(g_hash_table_lookup(added, key)) {
+				g_free(key);
+				plan->same++;
+				continue;
+			}
+			g_hash_table_insert(added, key, GINT_TO_POINTER(1));
+			change.action = MERGE_ADD;
+			change.from = i;
+			change.into = -1;
+			g_array_append_val(plan->changes, change);
+			continue;
+		}
+		g_free(key);
+
+		if(claimed[j] || same_fields(into->entries[j], e)) {
+			claimed[j] = 1;
+			plan->same++;
+			continue;
+		}
+		claimed[j] = 1;
+
+		/* Packed times put the year in the first bits, so they
+		 * compare like plain bytes */
+		if(memcmp(e->mtime, into->entries[j]->mtime,
+					sizeof(e->mtime)) > 0) {
+			change.action = MERGE_UPDATE;
+			change.from = i;
+			change.into = j;
+			g_array_append_val(plan->changes, change);
+		} else {
+			plan->older++;
+		}
+	}
+
+	free(claimed);
+	g_hash_table_destroy(added);
+	g_hash_table_destroy(by_content);
+	g_hash_table_destroy(by_uuid);
+	return plan;
+}
+
+void merge_plan_free(struct merge_plan *plan) {
+	g_array_free(plan->changes, TRUE);
+	g_strfreev(plan->from_paths);
+	g_free(plan);
+}
+
+/* Groups merge_apply() is adding to db */
+struct new_groups {
+	kpass_db *from;
+	int *from_parents;
+	char **from_paths;
+	/* Path -> group in db, old or new */
+	GHashTable *by_path;
+	/* Group in db, or NULL for the top level -> GPtrArray of new
+	 * groups under it */
+	GHashTable *children;
+	guint32 next_id;
+	int count;
+};
+
+/* The group in db with the same path as group i of from, made if it isn't
+ * there yet along with any missing groups above it */
+static kpass_group *find_group(struct new_groups *ng, int i) {
+	kpass_group *group, *parent = NULL;
+	GPtrArray *siblings;
+
+	group = g_hash_table_lookup(ng->by_path, ng->from_paths[i]);
+	if(group)
+		return group;
+
+	if(ng->from_parents[i] >= 0) {
+		parent = find_group(ng, ng->from_parents[i]);
+		if(!parent)
+			return NULL;
+	}
+
+	group = malloc(sizeof(kpass_group));
+	if(!group)
+		return NULL;
+	*group = *ng->from->groups[i];
+	group->name = NULL;
+	if(ng->from->groups[i]->name &&
+			!(group->name = strdup(ng->from->groups[i]->name))) {
+		free(group);
+		return NULL;
+	}
+	group->id = ng->next_id++;
+	group->level = parent ? parent->level + 1 : 0;
+
+	siblings = g_hash_table_lookup(ng->children, parent);
+	if(!siblings) {
+		siblings = g_ptr_array_new();
+		g_hash_table_insert(ng->children, parent, siblings);
+	}
+	g_ptr_array_add(siblings, group);
+	g_hash_table_insert(ng->by_path, ng->from_paths[i], group);
+	ng->count++;
+
+	return group;
+}
+
+/* Put the new groups under parent after everything already under it */
+static void place_new_groups(struct new_groups *ng, kpass_group *parent,
+		kpass_group **groups, int *len) {
+	GPtrArray *siblings;
+	guint i;
+
+	siblings = g_hash_table_lookup(ng->children, parent);
+	for(i = 0; siblings && i < siblings->len; i++) {
+		groups[(*len)++] = g_ptr_array_index(siblings, i);
+		place_new_groups(ng, g_ptr_array_index(siblings, i), groups,
+				len);
+	}
+}
+
+static void free_siblings(gpointer data) {
+	g_ptr_array_free(data, TRUE);
+}
+
+static void free_new_groups(gpointer key, gpointer value, gpointer data) {
+	GPtrArray *siblings = value;
+	kpass_group *group;
+	guint i;
+
+	for(i = 0; i < siblings->len; i++) {
+		group = g_ptr_array_index(siblings, i);
+		free(group->name);
+		free(group);
+	}
+}
+
+int merge_apply(struct merge_plan *plan, kpass_db *db) {
+	struct new_groups ng;
+	struct merge_change *c;
+	GHashTable *from_groups;
+	GPtrArray *added;
+	kpass_group **groups, *group;
+	kpass_entry *e, **entries;
+	char **into_paths;
+	int *stack;
+	int i, j, len, depth, ret = 0;
+
+	memset(&ng, 0, sizeof(ng));
+	ng.from = plan->from;
+	ng.from_parents = group_parents(plan->from);
+	into_paths = group_paths(db);
+	if(!ng.from_parents || !into_paths) {
+		free(ng.from_parents);
+		g_strfreev(into_paths);
+		return -1;
+	}
+	ng.from_paths = plan->from_paths;
+	ng.by_path = g_hash_table_new(g_str_hash, g_str_equal);
+	ng.children = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, free_siblings);
+
+	/* The first match wins if db has groups with the same path */
+	for(i = db->groups_len - 1; i >= 0; i--) {
+		g_hash_table_insert(ng.by_path, into_paths[i], db->groups[i]);
+		if(db->groups[i]->id >= ng.next_id)
+			ng.next_id = db->groups[i]->id + 1;
+	}
+
+	from_groups = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for(i = 0; i < plan->from->groups_len; i++)
+		g_hash_table_insert(from_groups,
+				GUINT_TO_POINTER(plan->from->groups[i]->id),
+				GINT_TO_POINTER(i + 1));
+
+	added = g_ptr_array_new();
+
+	for(i = 0; i < plan->changes->len; i++) {
+		c = &g_array_index(plan->changes, struct merge_change, i);
+		e = db_entry_copy(plan->from->entries[c->from]);
+		if(!e) {
+			ret = -1;
+			break;
+		}
+
+		if(c->action == MERGE_UPDATE) {
+			/* Stays where it is, under the UUID it has there */
+			e->group_id = db->entries[c->into]->group_id;
+			memcpy(e->uuid, db->entries[c->into]->uuid,
+					sizeof(e->uuid));
+			db_entry_free(db->entries[c->into]);
+			db->entries[c->into] = e;
+			continue;
+		}
+
+		j = GPOINTER_TO_INT(g_hash_table_lookup(from_groups,
+				GUINT_TO_POINTER(e->group_id))) - 1;
+		group = j >= 0 ? find_group(&ng, j) : NULL;
+		if(!group) {
+			db_entry_free(e);
+			ret = -1;
+			break;
+		}
+		e->group_id = group->id;
+		g_ptr_array_add(added, e);
+	}
+
+	if(!ret && added->len) {
+		entries = realloc(db->entries, sizeof(kpass_entry*) *
+				(db->entries_len + added->len + 1));
+		if(entries) {
+			db->entries = entries;
+			memcpy(entries + db->entries_len, added->pdata,
+					sizeof(kpass_entry*) * added->len);
+			db->entries_len += added->len;
+			entries[db->entries_len] = NULL;
+			g_ptr_array_set_size(added, 0);
+		} else {
+			ret = -1;
+		}
+	}
+
+	/* New groups go at the end of their parent's subtree, so the level
+	 * of each group still says where it belongs */
+	if(!ret && ng.count) {
+		groups = malloc(sizeof(kpass_group*) *
+				(db->groups_len + ng.count + 1));
+		stack = malloc(sizeof(int) * (db->groups_len + 1));
+		if(groups && stack) {
+			len = depth = 0;
+			for(i = 0; i < db->groups_len; i++) {
+				while(depth > 0 && db->groups[stack[depth - 1]]
+						->level >= db->groups[i]->level)
+					place_new_groups(&ng, db->groups[
+							stack[--depth]],
+							groups, &len);
+				groups[len++] = db->groups[i];
+				stack[depth++] = i;
+			}
+			while(depth > 0)
+				place_new_groups(&ng, db->groups[
+						stack[--depth]], groups, &len);
+			place_new_groups(&ng, NULL, groups, &len);
+			groups[len] = NULL;
+
+			free(db->groups);
+			db->groups = groups;
+			db->groups_len = len;
+			g_hash_table_remove_all(ng.children);
+		} else {
+			free(groups);
+			ret = -1;
+		}
+		free(stack);
+	}
+
+	/* Whatever didn't make it in */
+	for(i = 0; i < added->len; i++)
+		db_entry_free(g_ptr_array_index(added, i));
+	g_hash_table_foreach(ng.children, free_new_groups, NULL);
+
+	g_ptr_array_free(added, TRUE);
+	g_hash_table_destroy(from_groups);
+	g_strfreev(into_paths);
+	g_hash_table_destroy(ng.children);
+	g_hash_table_destroy(ng.by_path);
+	free(ng.from_parents);
+	return ret;
+}
@@ -0,0 +1,65 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GTKPASS_MERGE_H
+#define GTKPASS_MERGE_H
+
+#include <glib.h>
+
+#include <kpass.h>
+
+/* What merging one database into another does with an entry of the
+ * source */
+enum {
+	MERGE_ADD,	/* Not in the target, copied into it */
+	MERGE_UPDATE,	/* Newer in the source, replaces the target's copy */
+};
+
+/* Entries are referred to by their position in each database's entries,
+ * so a plan made against a database can be applied to a db_copy() of it */
+struct merge_change {
+	int action;
+	int from;
+	int into;	/* -1 for MERGE_ADD */
+};
+
+struct merge_plan {
+	kpass_db *into;
+	kpass_db *from;
+	GArray *changes;
+	/* Path of every group of from, "Parent/Child" */
+	char **from_paths;
+	int same;	/* Identical, or duplicates, in both */
+	int older;	/* Newer in the target, left alone */
+};
+
+/* Work out how to bring every entry of from into into.  Entries match by
+ * UUID, then by title, username and URL, so copies made by hand aren't
+ * duplicated.  Conflicts go to whichever copy was modified last.  Added
+ * entries keep their group's path, creating groups that are missing.
+ * Linear in the size of both databases, and doesn't touch GTK.  NULL if out
+ * of memory. */
+struct merge_plan *merge_plan_new(kpass_db *into, kpass_db *from);
+void merge_plan_free(struct merge_plan *plan);
+
+/* Make the changes in plan to db, which is plan->into or a db_copy() of
+ * it.  Returns -1 if memory ran out part way, leaving db half merged, so
+ * better make it a copy. */
+int merge_apply(struct merge_plan *plan, kpass_db *db);
+
+#endif
@@ -0,0 +1,304 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtk/gtk.h>
+
+#include <kpass.h>
+
+#include "config.h"
+#include "db.h"
+#include "store.h"
+#include "merge.h"
+#include "merge_ui.h"
+#include "ui.h"
+
+/* Rows of the merge preview */
+enum {
+	ML_ACTION,
+	ML_TITLE,
+	ML_GROUP,
+};
+
+/* The merge dialog, merging into one file from whichever other file is
+ * picked.  Files are kept as row references, since a reload while the
+ * dialog is up replaces their databases. */
+struct merge_dialog {
+	GtkTreeView *tv;
+	GtkTreeRowReference *into;
+	GPtrArray *files;
+	GtkListStore *list;
+	GtkWidget *summary;
+};
+
+/* The database of a file row, or NULL if it's gone or busy loading */
+static kpass_db *row_db(GtkTreeView *tv, GtkTreeRowReference *row,
+		GtkTreeIter *iter) {
+	GtkTreeModel *ts = tv_store(tv);
+	GtkTreePath *path;
+	struct db_file *file;
+	gpointer job;
+
+	path = gtk_tree_row_reference_get_path(row);
+	if(!path)
+		return NULL;
+	gtk_tree_model_get_iter(ts, iter, path);
+	gtk_tree_path_free(path);
+
+	gtk_tree_model_get(ts, iter,
+			TL_DB_FILE, &file,
+			TL_JOB, &job,
+			-1);
+	return file && !job ? file->db : NULL;
+}
+
+/* Work out a plan for merging the picked file into the dialog's file */
+static struct merge_plan *merge_dialog_plan(struct merge_dialog *md,
+		GtkComboBox *combo) {
+	GtkTreeIter iter;
+	kpass_db *into, *from;
+	int active;
+
+	active = gtk_combo_box_get_active(combo);
+	if(active < 0)
+		return NULL;
+
+	into = row_db(md->tv, md->into, &iter);
+	from = row_db(md->tv, g_ptr_array_index(md->files, active), &iter);
+	if(!into || !from)
+		return NULL;
+
+	return merge_plan_new(into, from);
+}
+
+/* Show what merging the picked file would do */
+static void merge_preview(GtkComboBox *combo, gpointer data) {
+	struct merge_dialog *md = data;
+	struct merge_plan *plan;
+	struct merge_change *c;
+	GHashTable *groups;
+	GtkTreeIter iter;
+	kpass_entry *e;
+	char *summary;
+	int added = 0, i, j;
+
+	gtk_list_store_clear(md->list);
+
+	plan = merge_dialog_plan(md, combo);
+	if(!plan) {
+		gtk_label_set_text(GTK_LABEL(md->summary),
+				"Both files have to be unlocked.");
+		return;
+	}
+
+	groups = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for(j = 0; j < plan->from->groups_len; j++)
+		g_hash_table_insert(groups,
+				GUINT_TO_POINTER(plan->from->groups[j]->id),
+				GINT_TO_POINTER(j + 1));
+
+	for(i = 0; i < plan->changes->len; i++) {
+		c = &g_array_index(plan->changes, struct merge_change, i);
+		e = plan->from->entries[c->from];
+		j = GPOINTER_TO_INT(g_hash_table_lookup(groups,
+				GUINT_TO_POINTER(e->group_id))) - 1;
+		if(c->action == MERGE_ADD)
+			added++;
+
+		gtk_list_store_insert_with_values(md->list, &iter, -1,
+				ML_ACTION, c->action == MERGE_ADD ?
+					"Add" : "Update",
+				ML_TITLE, e->title,
+				ML_GROUP, j >= 0 ? plan->from_paths[j] : NULL,
+				-1);
+	}
+
+	summary = g_strdup_printf("%d to add, %d to update, %d already "
+			"there, %d newer here", added,
+			(int)plan->changes->len - added, plan->same,
+			plan->older);
+	gtk_label_set_text(GTK_LABEL(md->summary), summary);
+	g_free(summary);
+
+	g_hash_table_destroy(groups);
+	merge_plan_free(plan);
+}
+
+/* Apply a merge to a copy of the database of the TYPE_FILE row at iter,
+ * then update the rows the same way a reload does */
+static gboolean merge_into(GtkTreeView *tv, GtkTreeIter *iter,
+		struct merge_plan *plan) {
+	GtkTreeModel *ts = tv_store(tv);
+	intern_set *keys;
+	struct db_file *file;
+	kpass_db *db;
+
+	gtk_tree_model_get(ts, iter,
+			TL_DB_FILE, &file,
+			TL_KEYS, &keys,
+			-1);
+
+	/* An export is reading the database we'd replace */
+	if(file->exports)
+		return FALSE;
+
+	db = db_copy(file->db);
+	if(!db)
+		return FALSE;
+	if(merge_apply(plan, db)) {
+		db_copy_free(db);
+		return FALSE;
+	}
+
+	/* Merges only add groups, so existing ones never move and this
+	 * can't fail on that account */
+	if(!reload_rows(GTK_TREE_STORE(ts), iter, file->db, db, keys)) {
+		db_copy_free(db);
+		return FALSE;
+	}
+
+	db_file_replace(file, db);
+	gtk_tree_store_set(GTK_TREE_STORE(ts), iter,
+			TL_STRUCT, db,
+			-1);
+
+	drop_search_index(tv, iter);
+	log_usage("merge");
+	schedule_save(tv, iter);
+	return TRUE;
+}
+
+void menu_merge(GtkWidget *widget, gpointer callback_data) {
+	GtkTreeView *tv = GTK_TREE_VIEW(callback_data);
+	GtkTreeModel *ts = tv_store(tv);
+	GtkWidget *dialog, *combo, *view, *scroller, *box;
+	GtkTreeViewColumn *col;
+	GtkTreePath *path, *into_path;
+	GtkTreeIter iter, other;
+	struct merge_dialog md;
+	struct merge_plan *plan;
+	struct db_file *file;
+	kpass_db *db;
+	char *title;
+	gboolean valid, merged = FALSE;
+	guint i;
+
+	if(!cursor_iter(tv, &iter, TRUE)) return;
+
+	into_path = gtk_tree_model_get_path(ts, &iter);
+	md.tv = tv;
+	md.into = gtk_tree_row_reference_new(ts, into_path);
+	md.files = g_ptr_array_new();
+	db = row_db(tv, md.into, &iter);
+	if(!db) {
+		gtk_tree_path_free(into_path);
+		goto menu_merge_out;
+	}
+
+	/* KDBX files and pipes can only be merged from */
+	if(db_read_only(db)) {
+		gtk_tree_path_free(into_path);
+		show_message(tv, GTK_MESSAGE_INFO, "That file is read-only, "
+				"select a KDB file to merge into.");
+		goto menu_merge_out;
+	}
+
+	dialog = gtk_dialog_new_with_buttons("Merge",
+			GTK_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(tv))),
+			GTK_DIALOG_DESTROY_WITH_PARENT,
+			GTK_STOCK_CANCEL, GTK_RESPONSE_REJECT,
+			"_Merge", GTK_RESPONSE_ACCEPT, NULL);
+	gtk_window_set_default_size(GTK_WINDOW(dialog), 500, 400);
+
+	/* Every other file that's open can be merged from */
+	combo = gtk_combo_box_new_text();
+	valid = gtk_tree_model_get_iter_first(ts, &other);
+	while(valid) {
+		path = gtk_tree_model_get_path(ts, &other);
+		gtk_tree_model_get(ts, &other,
+				TL_DB_FILE, &file,
+				TL_TITLE, &title,
+				-1);
+		if(file && gtk_tree_path_compare(path, into_path)) {
+			g_ptr_array_add(md.files,
+				gtk_tree_row_reference_new(ts, path));
+			gtk_combo_box_append_text(GTK_COMBO_BOX(combo), title);
+		}
+		g_free(title);
+		gtk_tree_path_free(path);
+		valid = gtk_tree_model_iter_next(ts, &other);
+	}
+	gtk_tree_path_free(into_path);
+
+	if(!md.files->len) {
+		gtk_widget_destroy(dialog);
+		show_message(tv, GTK_MESSAGE_INFO,
+				"Open another database to merge from.");
+		goto menu_merge_out;
+	}
+
+	md.list = gtk_list_store_new(3, G_TYPE_STRING, G_TYPE_STRING,
+			G_TYPE_STRING);
+	view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(md.list));
+	g_object_unref(md.list);
+	col = gtk_tree_view_column_new_with_attributes("Change",
+			gtk_cell_renderer_text_new(), "text", ML_ACTION, NULL);
+	gtk_tree_view_append_column(GTK_TREE_VIEW(view), col);
+	col = gtk_tree_view_column_new_with_attributes("Title",
+			gtk_cell_renderer_text_new(), "text", ML_TITLE, NULL);
+	gtk_tree_view_append_column(GTK_TREE_VIEW(view), col);
+	col = gtk_tree_view_column_new_with_attributes("Group",
+			gtk_cell_renderer_text_new(), "text", ML_GROUP, NULL);
+	gtk_tree_view_append_column(GTK_TREE_VIEW(view), col);
+
+	scroller = gtk_scrolled_window_new(NULL, NULL);
+	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scroller),
+			GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+	gtk_container_add(GTK_CONTAINER(scroller), view);
+
+	md.summary = gtk_label_new(NULL);
+	gtk_misc_set_alignment(GTK_MISC(md.summary), 0, 0.5);
+
+	box = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+	gtk_box_pack_start(GTK_BOX(box), combo, FALSE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(box), md.summary, FALSE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(box), scroller, TRUE, TRUE, 0);
+
+	g_signal_connect(combo, "changed", G_CALLBACK(merge_preview), &md);
+	gtk_combo_box_set_active(GTK_COMBO_BOX(combo), 0);
+
+	gtk_widget_show_all(dialog);
+	if(gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+		/* Planned again in case either file was reloaded meanwhile */
+		plan = merge_dialog_plan(&md, GTK_COMBO_BOX(combo));
+		if(plan) {
+			row_db(tv, md.into, &iter);
+			merged = merge_into(tv, &iter, plan);
+			merge_plan_free(plan);
+		}
+		if(!merged)
+			show_message(tv, GTK_MESSAGE_ERROR,
+					"Error merging databases");
+	}
+	gtk_widget_destroy(dialog);
+
+menu_merge_out:
+	for(i = 0; i < md.files->len; i++)
+		gtk_tree_row_reference_free(g_ptr_array_index(md.files, i));
+	g_ptr_array_free(md.files, TRUE);
+	gtk_tree_row_reference_free(md.into);
+}
@@ -0,0 +1,106 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <errno.h>
+#include <glib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "profile.h"
+
+gboolean profile_enabled = FALSE;
+guint profile_compares = 0;
+
+static GTimer *epoch;
+static char *trace_path;
+static GString *trace;
+G_LOCK_DEFINE_STATIC(trace);
+
+void profile_init(gboolean enable, const char *trace_file) {
+	const char *env;
+
+	env = g_getenv("GTKPASS_PROFILE");
+	if(env && *env)
+		enable = TRUE;
+	if(!trace_file)
+		trace_file = g_getenv("GTKPASS_TRACE");
+	if(trace_file && *trace_file) {
+		trace_path = g_strdup(trace_file);
+		trace = g_string_new(NULL);
+		enable = TRUE;
+	}
+
+	profile_enabled = enable;
+	epoch = g_timer_new();
+}
+
+double profile_now(void) {
+	return epoch ? g_timer_elapsed(epoch, NULL) : 0;
+}
+
+/* Append s as a JSON string */
+static void append_json_string(GString *out, const char *s) {
+	g_string_append_c(out, '"');
+	for(; *s; s++) {
+		if(*s == '"' || *s == '\\')
+			g_string_append_printf(out, "\\%c", *s);
+		else if((unsigned char)*s < 0x20)
+			g_string_append_printf(out, "\\u%04x", *s);
+		else
+			g_string_append_c(out, *s);
+	}
+	g_string_append_c(out, '"');
+}
+
+void profile_event(const char *name, const char *file, double start,
+		double duration) {
+	if(!trace)
+		return;
+
+	G_LOCK(trace);
+	if(trace->len)
+		g_string_append(trace, ",\n");
+	g_string_append_printf(trace, "{\"name\":\"%s\",\"cat\":\"load\","
+			"\"ph\":\"X\",\"ts\":%.0f,\"dur\":%.0f,\"pid\":%d,"
+			"\"tid\":%lu,\"args\":{\"file\":", name, start * 1e6,
+			duration * 1e6, (int)getpid(),
+			(unsigned long)GPOINTER_TO_SIZE(g_thread_self()));
+	append_json_string(trace, file);
+	g_string_append(trace, "}}");
+	G_UNLOCK(trace);
+}
+
+void profile_write_trace(void) {
+	FILE *out;
+
+	if(!trace)
+		return;
+
+	out = fopen(trace_path, "w");
+	if(!out) {
+		g_message("%s: %s", trace_path, g_strerror(errno));
+		return;
+	}
+
+	G_LOCK(trace);
+	fprintf(out, "{\"traceEvents\":[\n%s\n]}\n", trace->str);
+	G_UNLOCK(trace);
+	fclose(out);
+}
@@ -0,0 +1,61 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GTKPASS_PROFILE_H
+#define GTKPASS_PROFILE_H
+
+#include <glib.h>
+
+#include "db.h"
+
+/* Set by --profile or GTKPASS_PROFILE; nothing is recorded without it */
+extern gboolean profile_enabled;
+
+/* Calls to sort_iter_compare_func(), main loop only */
+extern guint profile_compares;
+
+/* What the last load of a file cost, kept on its TYPE_FILE row */
+struct load_profile {
+	struct load_timing timing;
+	double index;
+	double build;
+	double sort;
+	double total;
+	guint compares;
+	guint loads;
+	gboolean incremental;
+};
+
+/* Turn profiling on if asked to by the flags or the environment.  With a
+ * trace file, every timed stage is also kept as a trace event and written
+ * out by profile_write_trace(). */
+void profile_init(gboolean enable, const char *trace_file);
+
+/* Seconds since profile_init() */
+double profile_now(void);
+
+/* Record a stage of loading file that took duration seconds from start.
+ * Safe to call from the load workers. */
+void profile_event(const char *name, const char *file, double start,
+		double duration);
+
+/* Write the events recorded so far as a Chrome trace, readable by
+ * chrome://tracing and Perfetto */
+void profile_write_trace(void);
+
+#endif
@@ -0,0 +1,228 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <kpass.h>
+
+#include "config.h"
+#include "db.h"
+#include "intern.h"
+#include "search.h"
+
+/* Fields of each entry that are searched */
+#define FIELDS 4
+
+struct search_index {
+	kpass_db *db;
+	/* The folded fields of entry i are fields[i * FIELDS] on, NULL where
+	 * the entry has none.  Usernames and URLs repeat a lot, so they're
+	 * interned. */
+	intern_set *strings;
+	const gchar **fields;
+	/* Packed byte trigram -> GArray of entry positions, ascending */
+	GHashTable *trigrams;
+	/* Group id -> position + 1, and each group's parent position */
+	GHashTable *groups;
+	int *parents;
+};
+
+#define TRIGRAM(p) (((guint32)(guchar)(p)[0] << 16) | \
+		((guint32)(guchar)(p)[1] << 8) | (guint32)(guchar)(p)[2])
+
+static gchar *fold(const char *str) {
+	if(g_utf8_validate(str, -1, NULL))
+		return g_utf8_casefold(str, -1);
+	return g_ascii_strdown(str, -1);
+}
+
+static const gchar *add_field(intern_set *strings, const char *field) {
+	const gchar *ret;
+	gchar *folded;
+
+	if(!field)
+		return NULL;
+
+	folded = fold(field);
+	ret = intern_add(strings, folded);
+	g_free(folded);
+	return ret;
+}
+
+/* Non-zero if any field of entry i holds folded */
+static gboolean entry_matches(search_index *index, guint32 i,
+		const gchar *folded) {
+	const gchar **field = index->fields + i * FIELDS;
+	int f;
+
+	for(f = 0; f < FIELDS; f++)
+		if(field[f] && strstr(field[f], folded))
+			return TRUE;
+	return FALSE;
+}
+
+static void free_posting(gpointer data) {
+	g_array_free(data, TRUE);
+}
+
+search_index *search_index_new(kpass_db *db) {
+	search_index *index;
+	kpass_entry *entry;
+	GArray *posting;
+	const char *p, *end;
+	const gchar **field;
+	guint32 i, key;
+	int *parents, f;
+
+	parents = group_parents(db);
+	if(!parents)
+		return NULL;
+
+	index = g_new0(search_index, 1);
+	index->db = db;
+	index->strings = intern_set_new();
+	index->fields = g_new0(const gchar*, db->entries_len * FIELDS + 1);
+	index->trigrams = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, free_posting);
+	index->groups = g_hash_table_new(g_direct_hash, g_direct_equal);
+	index->parents = parents;
+
+	for(i = 0; i < db->groups_len; i++)
+		g_hash_table_insert(index->groups,
+				GUINT_TO_POINTER(db->groups[i]->id),
+				GINT_TO_POINTER(i + 1));
+
+	for(i = 0; i < db->entries_len; i++) {
+		entry = db->entries[i];
+		field = index->fields + i * FIELDS;
+
+		field[0] = add_field(index->strings, entry->title);
+		field[1] = add_field(index->strings, entry->username);
+		field[2] = add_field(index->strings, entry->url);
+		field[3] = add_field(index->strings, entry->notes);
+
+		for(f = 0; f < FIELDS; f++) {
+			if(!field[f])
+				continue;
+			end = field[f] + strlen(field[f]);
+			for(p = field[f]; p + 3 <= end; p++) {
+				key = TRIGRAM(p);
+				posting = g_hash_table_lookup(index->trigrams,
+						GUINT_TO_POINTER(key));
+				if(!posting) {
+					posting = g_array_new(FALSE, FALSE,
+							sizeof(guint32));
+					g_hash_table_insert(index->trigrams,
+							GUINT_TO_POINTER(key),
+							posting);
+				}
+				/* Each entry only needs to be listed once */
+				if(posting->len == 0 || g_array_index(posting,
+						guint32, posting->len - 1) != i)
+					g_array_append_val(posting, i);
+			}
+		}
+	}
+
+	return index;
+}
+
+void search_index_free(search_index *index) {
+	intern_set_free(index->strings);
+	g_free(index->fields);
+	g_hash_table_destroy(index->trigrams);
+	g_hash_table_destroy(index->groups);
+	free(index->parents);
+	g_free(index);
+}
+
+/* Add entry i and the groups leading to it */
+static gboolean add_match(search_index *index, guint32 i,
+		GHashTable *matches) {
+	kpass_db *db = index->db;
+	kpass_entry *entry = db->entries[i];
+	int g;
+
+	/* Entries in groups that don't exist aren't shown anyway */
+	g = GPOINTER_TO_INT(g_hash_table_lookup(index->groups,
+				GUINT_TO_POINTER(entry->group_id))) - 1;
+	if(g < 0)
+		return FALSE;
+
+	g_hash_table_insert(matches, entry, entry);
+	while(g >= 0 && !g_hash_table_lookup(matches, db->groups[g])) {
+		g_hash_table_insert(matches, db->groups[g], db->groups[g]);
+		g = index->parents[g];
+	}
+	g_hash_table_insert(matches, db, db);
+
+	return TRUE;
+}
+
+int search_index_query(search_index *index, const char *query,
+		GHashTable *matches) {
+	GArray *posting, *best = NULL;
+	gchar *folded;
+	gsize len, p;
+	guint32 i, k;
+	int found = 0;
+
+	folded = fold(query);
+	len = strlen(folded);
+
+	if(len == 0)
+		goto search_index_query_out;
+
+	/* Too short to use the trigrams, just look at everything */
+	if(len < 3) {
+		for(i = 0; i < index->db->entries_len; i++)
+			if(entry_matches(index, i, folded) &&
+					add_match(index, i, matches))
+				found++;
+		goto search_index_query_out;
+	}
+
+	/* Every trigram of the query has to appear in a match, so only the
+	 * entries under the rarest one need checking */
+	for(p = 0; p + 3 <= len; p++) {
+		posting = g_hash_table_lookup(index->trigrams,
+				GUINT_TO_POINTER(TRIGRAM(folded + p)));
+		if(!posting)
+			goto search_index_query_out;
+		if(!best || posting->len < best->len)
+			best = posting;
+	}
+
+	for(k = 0; k < best->len; k++) {
+		i = g_array_index(best, guint32, k);
+		if(entry_matches(index, i, folded) &&
+				add_match(index, i, matches))
+			found++;
+	}
+
+search_index_query_out:
+	g_free(folded);
+	return found;
+}
+
+intern_set *search_index_strings(search_index *index) {
+	return index->strings;
+}
@@ -0,0 +1,47 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GTKPASS_SEARCH_H
+#define GTKPASS_SEARCH_H
+
+#include <glib.h>
+
+#include <kpass.h>
+
+#include "intern.h"
+
+/* Case-insensitive substring index over the title, username, URL and notes
+ * of every entry in a database.  Entries are referred to by their position
+ * in db->entries, so the index stays valid when a reload swaps unchanged
+ * structs between databases.  Building one doesn't touch GTK, and gives
+ * NULL if out of memory. */
+typedef struct search_index search_index;
+
+search_index *search_index_new(kpass_db *db);
+void search_index_free(search_index *index);
+
+/* Add every entry matching query to matches, along with the groups above
+ * it and the database itself, so a tree filter can show the path to each
+ * match.  Returns the number of matching entries. */
+int search_index_query(search_index *index, const char *query,
+		GHashTable *matches);
+
+/* The folded fields the index holds */
+intern_set *search_index_strings(search_index *index);
+
+#endif
@@ -0,0 +1,447 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <gtk/gtk.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+
+#include <kpass.h>
+
+#include "config.h"
+#include "db.h"
+#include "profile.h"
+#include "store.h"
+
+/* The sort function to use and which way round, as one pointer for
+ * sort_iter_compare_func() */
+#define SORT_DATA(id, order) \
+	GINT_TO_POINTER((id) << 1 | ((order) == GTK_SORT_DESCENDING))
+#define SORT_ID(data) (GPOINTER_TO_INT(data) >> 1)
+#define SORT_DESCENDING(data) (GPOINTER_TO_INT(data) & 1)
+
+/* Sort keys start with the weight, as four hex digits */
+#define SORT_KEY_WEIGHT_LEN 4
+
+/* Order two rows by their sort keys and times.  The weight at the front
+ * of the keys always goes the same way, so groups stay above entries and
+ * the placeholder's empty key above both; only the times and titles after
+ * it are reversed for a descending sort. */
+static gint compare_rows(gpointer data, const gchar *key1, guint64 mtime1,
+		const gchar *key2, guint64 mtime2) {
+	gint ret;
+
+	if(!key1 || !key2) {
+		if(!key1 && !key2)
+			return 0;
+		return (key1)? -1 : 1;
+	}
+
+	ret = strncmp(key1, key2, SORT_KEY_WEIGHT_LEN);
+	if(ret || !*key1)
+		return ret;
+
+	if(SORT_ID(data) == SORTID_MTIME && mtime1 != mtime2)
+		ret = mtime1 < mtime2 ? -1 : 1;
+	else
+		ret = strcmp(key1 + SORT_KEY_WEIGHT_LEN,
+				key2 + SORT_KEY_WEIGHT_LEN);
+
+	return SORT_DESCENDING(data) ? -ret : ret;
+}
+
+GtkTreeStore *store_new(void) {
+	GtkTreeStore *ts;
+	GtkTreeSortable *sortable;
+
+	ts = gtk_tree_store_new (14,
+	G_TYPE_UINT, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT64, G_TYPE_POINTER, G_TYPE_BOOLEAN, G_TYPE_POINTER, G_TYPE_POINTER, G_TYPE_POINTER, G_TYPE_POINTER, G_TYPE_OBJECT, G_TYPE_POINTER, G_TYPE_POINTER, G_TYPE_POINTER);
+/*	TL_TYPE, TL_TITLE, TL_TITLE_WEIGHT, TL_MTIME, TL_STRUCT, TL_META_INFO, TL_DB_FILE, TL_JOB, TL_SORT_KEY, TL_KEYS, TL_MONITOR, TL_SEARCH, TL_PROFILE, TL_SAVE */
+
+	sortable = GTK_TREE_SORTABLE(ts);
+	gtk_tree_sortable_set_sort_func(sortable, SORTID_MTIME, sort_iter_compare_func, SORT_DATA(SORTID_MTIME, GTK_SORT_ASCENDING), NULL);
+	store_set_sort(ts, SORTID_GROUPS_ON_TOP, GTK_SORT_ASCENDING);
+
+	return ts;
+}
+
+void store_set_sort(GtkTreeStore *ts, gint id, GtkSortType order) {
+	GtkTreeSortable *sortable = GTK_TREE_SORTABLE(ts);
+
+	g_object_set_data(G_OBJECT(ts), "sort-id", GINT_TO_POINTER(id));
+	g_object_set_data(G_OBJECT(ts), "sort-order", GINT_TO_POINTER(order));
+
+	/* Resorts if id is the one in use */
+	gtk_tree_sortable_set_sort_func(sortable, id, sort_iter_compare_func,
+			SORT_DATA(id, order), NULL);
+	gtk_tree_sortable_set_sort_column_id(sortable, id, GTK_SORT_ASCENDING);
+}
+
+void store_get_sort(GtkTreeStore *ts, gint *id, GtkSortType *order) {
+	*id = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(ts), "sort-id"));
+	*order = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(ts),
+				"sort-order"));
+}
+
+/* Build the key sort_iter_compare_func() orders rows by: the weight first so
+ * heavier rows sort on top, then the collation key of the title, with rows
+ * missing a title last.  Keys are held by the set of the file they belong
+ * to, so rows with the same title share one, and are compared with a plain
+ * strcmp(). */
+const gchar *make_sort_key(intern_set *keys, const char *title, guint weight) {
+	const gchar *ret;
+	gchar *collate, *key;
+
+	if(title) {
+		collate = g_utf8_collate_key(title, -1);
+		key = g_strdup_printf("%04x1%s", 0xffff - weight, collate);
+		g_free(collate);
+	} else {
+		key = g_strdup_printf("%04x2", 0xffff - weight);
+	}
+
+	ret = intern_add(keys, key);
+	g_free(key);
+	return ret;
+}
+
+/* A packed KDB time as one number for TL_MTIME.  The year is in the top
+ * bits and the seconds at the bottom, so these order the same way the
+ * times do without unpacking them. */
+static guint64 mtime_number(const uint8_t mtime[5]) {
+	return (guint64)mtime[0] << 32 | (guint64)mtime[1] << 24 |
+		mtime[2] << 16 | mtime[3] << 8 | mtime[4];
+}
+
+/* Sorts ahead of every real row, so children appended after it in order
+ * never have to be moved.  It isn't in any key set. */
+static gchar placeholder_key[] = "";
+
+/* Hand the sort key of the row at iter back to keys */
+static void release_key(GtkTreeStore *ts, GtkTreeIter *iter,
+		intern_set *keys) {
+	gchar *key;
+
+	gtk_tree_model_get(GTK_TREE_MODEL(ts), iter, TL_SORT_KEY, &key, -1);
+	if(key && key != placeholder_key)
+		intern_release(keys, key);
+}
+
+/* Fill in an entry row whose sort key has already been made */
+static void put_entry_row(GtkTreeStore *ts, GtkTreeIter *iter, struct kpass_entry *entry, const gchar *key) {
+	gtk_tree_store_set(ts, iter,
+			TL_TYPE, TYPE_ENTRY,
+			TL_TITLE_WEIGHT, PANGO_WEIGHT_NORMAL,
+			TL_STRUCT, entry,
+			TL_MTIME, mtime_number(entry->mtime),
+			TL_SORT_KEY, key,
+			-1);
+}
+
+static void put_group_row(GtkTreeStore *ts, GtkTreeIter *iter, struct kpass_group *group, const gchar *key) {
+	gtk_tree_store_set(ts, iter,
+			TL_TYPE, TYPE_GROUP,
+			TL_TITLE_WEIGHT, PANGO_WEIGHT_BOLD,
+			TL_STRUCT, group,
+			TL_MTIME, mtime_number(group->mtime),
+			TL_SORT_KEY, key,
+			-1);
+}
+
+/* The new key is made before the old one goes, so a title that didn't
+ * change keeps its string */
+void set_entry_row(GtkTreeStore *ts, GtkTreeIter *iter, struct kpass_entry *entry, intern_set *keys) {
+	const gchar *key;
+
+	key = make_sort_key(keys, entry->title, PANGO_WEIGHT_NORMAL);
+	release_key(ts, iter, keys);
+	put_entry_row(ts, iter, entry, key);
+}
+
+void set_group_row(GtkTreeStore *ts, GtkTreeIter *iter, struct kpass_group *group, intern_set *keys) {
+	const gchar *key;
+
+	key = make_sort_key(keys, group->name, PANGO_WEIGHT_BOLD);
+	release_key(ts, iter, keys);
+	put_group_row(ts, iter, group, key);
+}
+
+gboolean store_remove_row(GtkTreeStore *ts, GtkTreeIter *iter, intern_set *keys) {
+	GtkTreeModel *model = GTK_TREE_MODEL(ts);
+	GtkTreeIter row, next, up;
+	gint depth;
+
+	/* Walk the rows under iter in order, without recursing */
+	depth = gtk_tree_store_iter_depth(ts, iter);
+	release_key(ts, iter, keys);
+	if(!gtk_tree_model_iter_children(model, &row, iter))
+		return gtk_tree_store_remove(ts, iter);
+
+	for(;;) {
+		release_key(ts, &row, keys);
+		if(gtk_tree_model_iter_children(model, &next, &row)) {
+			row = next;
+			continue;
+		}
+		for(;;) {
+			next = row;
+			if(gtk_tree_model_iter_next(model, &next))
+				break;
+			gtk_tree_model_iter_parent(model, &up, &row);
+			if(gtk_tree_store_iter_depth(ts, &up) == depth)
+				return gtk_tree_store_remove(ts, iter);
+			row = up;
+		}
+		row = next;
+	}
+}
+
+void set_row_mtime(GtkTreeStore *ts, GtkTreeIter *iter, const uint8_t mtime[5]) {
+	gtk_tree_store_set(ts, iter,
+			TL_MTIME, mtime_number(mtime),
+			-1);
+}
+
+/* A row about to be added by add_children_to_store() */
+struct child_row {
+	const gchar *key;
+	guint64 mtime;
+	struct kpass_group *group;
+	struct kpass_entry *entry;
+};
+
+static gint compare_child_rows(gconstpointer a, gconstpointer b,
+		gpointer data) {
+	const struct child_row *row1 = a, *row2 = b;
+
+	return compare_rows(data, row1->key, row1->mtime, row2->key,
+			row2->mtime);
+}
+
+void add_placeholder(GtkTreeStore *ts, GtkTreeIter *parent) {
+	GtkTreeIter placeholder;
+
+	gtk_tree_store_append(ts, &placeholder, parent);
+	gtk_tree_store_set(ts, &placeholder,
+			TL_TYPE, TYPE_PLACEHOLDER,
+			TL_SORT_KEY, placeholder_key,
+			-1);
+}
+
+void add_children_to_store(struct db_file *file, int group, intern_set *keys, GtkTreeStore *ts, GtkTreeIter *parent) {
+	struct db_tree *tree = db_file_tree(file);
+	kpass_db *db = file->db;
+	GArray *children;
+	GtkTreeIter iter;
+	struct child_row child;
+	GtkSortType order;
+	gint sort_id;
+	int slot = group + 1;
+	int i, j;
+
+	if(!tree)
+		return;
+
+	children = g_array_sized_new(FALSE, FALSE, sizeof(struct child_row),
+			tree->group_first[slot + 1] - tree->group_first[slot] +
+			tree->entry_first[slot + 1] - tree->entry_first[slot]);
+
+	for(i = tree->group_first[slot]; i < tree->group_first[slot + 1]; i++) {
+		j = tree->group_kids[i];
+		child.key = make_sort_key(keys, db->groups[j]->name,
+				PANGO_WEIGHT_BOLD);
+		child.mtime = mtime_number(db->groups[j]->mtime);
+		child.group = db->groups[j];
+		child.entry = NULL;
+		g_array_append_val(children, child);
+	}
+
+	for(i = tree->entry_first[slot]; i < tree->entry_first[slot + 1]; i++) {
+		j = tree->entry_kids[i];
+		child.key = make_sort_key(keys, db->entries[j]->title,
+				PANGO_WEIGHT_NORMAL);
+		child.mtime = mtime_number(db->entries[j]->mtime);
+		child.group = NULL;
+		child.entry = db->entries[j];
+		g_array_append_val(children, child);
+	}
+
+	/* Appending in the order the store sorts in keeps it from moving
+	 * rows */
+	store_get_sort(ts, &sort_id, &order);
+	g_qsort_with_data(children->data, children->len,
+			sizeof(struct child_row), compare_child_rows,
+			SORT_DATA(sort_id, order));
+
+	for(i = 0; i < children->len; i++) {
+		child = g_array_index(children, struct child_row, i);
+		gtk_tree_store_append(ts, &iter, parent);
+		if(child.entry) {
+			put_entry_row(ts, &iter, child.entry, child.key);
+			continue;
+		}
+
+		put_group_row(ts, &iter, child.group, child.key);
+		if(db_tree_has_children(tree,
+					db_tree_group_index(tree, child.group)))
+			add_placeholder(ts, &iter);
+	}
+
+	g_array_free(children, TRUE);
+}
+
+void file_row(GtkTreeModel *ts, GtkTreeIter *iter, GtkTreeIter *file) {
+	GtkTreeIter up;
+
+	*file = *iter;
+	while(gtk_tree_model_iter_parent(ts, &up, file))
+		*file = up;
+}
+
+gboolean group_filled(GtkTreeStore *ts, GtkTreeIter *iter) {
+	GtkTreeIter child;
+	guint type;
+
+	if(!gtk_tree_model_iter_children(GTK_TREE_MODEL(ts), &child, iter))
+		return TRUE;
+	gtk_tree_model_get(GTK_TREE_MODEL(ts), &child, TL_TYPE, &type, -1);
+	return type != TYPE_PLACEHOLDER;
+}
+
+gboolean fill_group(GtkTreeStore *ts, GtkTreeIter *iter) {
+	GtkTreeModel *model = GTK_TREE_MODEL(ts);
+	GtkTreeIter placeholder, file;
+	intern_set *keys;
+	struct kpass_group *group;
+	struct db_file *db_file;
+	struct db_tree *tree;
+	int i;
+
+	if(group_filled(ts, iter))
+		return FALSE;
+	gtk_tree_model_iter_children(model, &placeholder, iter);
+
+	/* The file row at the top has the database and the key set */
+	file_row(model, iter, &file);
+
+	gtk_tree_model_get(model, iter, TL_STRUCT, &group, -1);
+	gtk_tree_model_get(model, &file,
+			TL_DB_FILE, &db_file,
+			TL_KEYS, &keys,
+			-1);
+
+	/* Still streaming in, finish_stream() gets to it */
+	if(!db_file)
+		return FALSE;
+
+	/* Out of memory, the next expand tries again */
+	tree = db_file_tree(db_file);
+	if(!tree)
+		return FALSE;
+
+	i = db_tree_group_index(tree, group);
+	if(i >= 0)
+		add_children_to_store(db_file, i, keys, ts, iter);
+
+	/* Only now, so the group never looks empty to the view */
+	gtk_tree_store_remove(ts, &placeholder);
+	return TRUE;
+}
+
+void add_file_to_store(char* filename, GtkTreeStore *ts, GtkTreeIter *iter) {
+	intern_set *keys;
+	char* local_name;
+	char* name;
+
+	local_name = strdup(filename);
+	name = strdup(basename(local_name));
+	free(local_name);
+
+	keys = intern_set_new();
+
+	gtk_tree_store_append(ts, iter, NULL);
+	gtk_tree_store_set(ts, iter,
+			TL_TYPE, TYPE_FILE,
+			TL_TITLE, name,
+			TL_TITLE_WEIGHT, PANGO_WEIGHT_NORMAL+1,
+			TL_SORT_KEY, make_sort_key(keys, name,
+				PANGO_WEIGHT_NORMAL+1),
+			TL_KEYS, keys,
+			-1);
+	free(name);
+}
+
+intern_set *renew_keys(GtkTreeStore *ts, GtkTreeIter *iter) {
+	intern_set *keys, *old_keys;
+	char *name;
+
+	gtk_tree_model_get(GTK_TREE_MODEL(ts), iter,
+			TL_TITLE, &name,
+			TL_KEYS, &old_keys,
+			-1);
+
+	keys = intern_set_new();
+	gtk_tree_store_set(ts, iter,
+			TL_SORT_KEY, make_sort_key(keys, name,
+				PANGO_WEIGHT_NORMAL+1),
+			TL_KEYS, keys,
+			-1);
+	g_free(name);
+
+	return old_keys;
+}
+
+void add_groups_to_store(struct db_file *file, GtkTreeStore *ts, GtkTreeIter *iter) {
+	intern_set *keys;
+
+	gtk_tree_model_get(GTK_TREE_MODEL(ts), iter,
+			TL_KEYS, &keys,
+			-1);
+
+	gtk_tree_store_set(ts, iter,
+			TL_STRUCT, file->db,
+			TL_DB_FILE, file,
+			TL_JOB, NULL,
+			-1);
+
+	add_children_to_store(file, -1, keys, ts, iter);
+}
+
+gint sort_iter_compare_func (GtkTreeModel *model,
+		GtkTreeIter  *a,
+		GtkTreeIter  *b,
+		gpointer      userdata) {
+
+	const gchar *key1, *key2;
+	guint64 mtime1 = 0, mtime2 = 0;
+
+	profile_compares++;
+
+	/* Keys are owned by the store's key sets, so there's nothing to
+	 * free */
+	gtk_tree_model_get(model, a, TL_SORT_KEY, &key1, -1);
+	gtk_tree_model_get(model, b, TL_SORT_KEY, &key2, -1);
+	if(SORT_ID(userdata) == SORTID_MTIME) {
+		gtk_tree_model_get(model, a, TL_MTIME, &mtime1, -1);
+		gtk_tree_model_get(model, b, TL_MTIME, &mtime2, -1);
+	}
+
+	return compare_rows(userdata, key1, mtime1, key2, mtime2);
+}
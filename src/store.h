@@ -0,0 +1,121 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GTKPASS_STORE_H
+#define GTKPASS_STORE_H
+
+#include <gtk/gtk.h>
+
+#include <kpass.h>
+
+#include "db.h"
+#include "intern.h"
+
+/* Columns of the tree store */
+enum {
+	TL_TYPE,
+	TL_TITLE,
+	TL_TITLE_WEIGHT,
+	TL_MTIME,
+	TL_STRUCT,
+	TL_META_INFO,
+	TL_DB_FILE,
+	TL_JOB,
+	TL_SORT_KEY,
+	TL_KEYS,
+	TL_MONITOR,
+	TL_SEARCH,
+	TL_PROFILE,
+	TL_SAVE,
+};
+
+/* What a row is, in TL_TYPE */
+enum {
+	TYPE_FILE,
+	TYPE_GROUP,
+	TYPE_ENTRY,
+	TYPE_PENDING,
+	TYPE_PLACEHOLDER,
+};
+
+/* Sort functions set up by store_new() */
+enum {
+	SORTID_GROUPS_ON_TOP,
+	SORTID_MTIME,
+};
+
+/* Make an empty store with the columns above, sorted groups on top */
+GtkTreeStore *store_new(void);
+
+/* Sort ts with sort function id.  The store itself always sorts ascending
+ * and order is applied inside the sort function, to titles and times only,
+ * so groups stay on top whichever way the rows go. */
+void store_set_sort(GtkTreeStore *ts, gint id, GtkSortType order);
+
+/* The sort last given to store_set_sort(), even while sorting is off */
+void store_get_sort(GtkTreeStore *ts, gint *id, GtkSortType *order);
+
+/* Append a TYPE_FILE row for filename, to be filled in once it's loaded */
+void add_file_to_store(char* filename, GtkTreeStore *ts, GtkTreeIter *iter);
+
+/* Give a TYPE_FILE row a fresh key set, returning the old one so it can
+ * be freed once the rows using it are gone */
+intern_set *renew_keys(GtkTreeStore *ts, GtkTreeIter *iter);
+
+/* Hang the top level groups of file's database under the TYPE_FILE row at
+ * iter, the rest come as they're expanded.  The row takes over file. */
+void add_groups_to_store(struct db_file *file, GtkTreeStore *ts, GtkTreeIter *iter);
+
+/* Give the group row at parent a TYPE_PLACEHOLDER child, so it can be
+ * expanded before its children have rows */
+void add_placeholder(GtkTreeStore *ts, GtkTreeIter *parent);
+
+/* Add the rows directly under group (an index into file->db->groups, or -1
+ * for the top level) below parent.  Subgroups get a TYPE_PLACEHOLDER child
+ * in place of their own children until fill_group() is called on them.
+ * This only looks at those rows, using the file's db_tree, and adds nothing
+ * if there's no memory to build that. */
+void add_children_to_store(struct db_file *file, int group, intern_set *keys, GtkTreeStore *ts, GtkTreeIter *parent);
+
+/* Find the TYPE_FILE row at the top of the tree holding iter */
+void file_row(GtkTreeModel *ts, GtkTreeIter *iter, GtkTreeIter *file);
+
+/* FALSE if the group row at iter is still waiting on fill_group() */
+gboolean group_filled(GtkTreeStore *ts, GtkTreeIter *iter);
+
+/* Swap the placeholder under a group row for its real children.  Returns
+ * FALSE if there was nothing to do, the file is still streaming in or
+ * memory ran out. */
+gboolean fill_group(GtkTreeStore *ts, GtkTreeIter *iter);
+
+const gchar *make_sort_key(intern_set *keys, const char *title, guint weight);
+void set_entry_row(GtkTreeStore *ts, GtkTreeIter *iter, struct kpass_entry *entry, intern_set *keys);
+void set_group_row(GtkTreeStore *ts, GtkTreeIter *iter, struct kpass_group *group, intern_set *keys);
+
+/* gtk_tree_store_remove() for rows keyed from keys, handing back the sort
+ * keys of the row at iter and everything under it */
+gboolean store_remove_row(GtkTreeStore *ts, GtkTreeIter *iter, intern_set *keys);
+
+/* Keep TL_MTIME in step after the group or entry at iter was modified */
+void set_row_mtime(GtkTreeStore *ts, GtkTreeIter *iter, const uint8_t mtime[5]);
+gint sort_iter_compare_func (GtkTreeModel *model,
+		GtkTreeIter  *a,
+		GtkTreeIter  *b,
+		gpointer      userdata);
+
+#endif
@@ -0,0 +1,81 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtk/gtk.h>
+#include <stdarg.h>
+
+#include "config.h"
+#include "ui.h"
+
+GtkTreeModel *tv_store(GtkTreeView *tv) {
+	return g_object_get_data(G_OBJECT(tv), "store");
+}
+
+GtkTreePath *view_path(GtkTreeView *tv, GtkTreePath *path) {
+	GtkTreeModel *filter = gtk_tree_view_get_model(tv);
+
+	if(!filter)
+		return NULL;
+	return gtk_tree_model_filter_convert_child_path_to_path(
+			GTK_TREE_MODEL_FILTER(filter), path);
+}
+
+gboolean cursor_iter(GtkTreeView *tv, GtkTreeIter *iter, gboolean file) {
+	GtkTreeModel *filter = gtk_tree_view_get_model(tv);
+	GtkTreePath *path;
+	GtkTreeIter filter_iter;
+	gboolean ret;
+
+	if(!filter) return FALSE;
+
+	gtk_tree_view_get_cursor(tv, &path, NULL);
+
+	if(!path) return FALSE;
+
+	if(file)
+		while(gtk_tree_path_get_depth(path) > 1) gtk_tree_path_up(path);
+
+	ret = gtk_tree_model_get_iter(filter, &filter_iter, path);
+	if(ret)
+		gtk_tree_model_filter_convert_iter_to_child_iter(
+				GTK_TREE_MODEL_FILTER(filter), iter,
+				&filter_iter);
+
+	gtk_tree_path_free(path);
+	return ret;
+}
+
+void show_message(GtkTreeView *tv, GtkMessageType type,
+		const char *format, ...) {
+	GtkWidget *mdialog;
+	va_list args;
+	char *text;
+
+	va_start(args, format);
+	text = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	mdialog = gtk_message_dialog_new(GTK_WINDOW(
+		gtk_widget_get_toplevel(GTK_WIDGET(tv))),
+		GTK_DIALOG_DESTROY_WITH_PARENT,
+		type, GTK_BUTTONS_CLOSE,
+		"%s", text);
+	gtk_dialog_run (GTK_DIALOG (mdialog));
+	gtk_widget_destroy (mdialog);
+	g_free(text);
+}
@@ -0,0 +1,63 @@
+/*
+    gtkpass, a GTK password manager using libkpass
+    Copyright (C) 2010 Brian De Wolf
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GTKPASS_UI_H
+#define GTKPASS_UI_H
+
+#include <gtk/gtk.h>
+
+#include <kpass.h>
+
+#include "intern.h"
+
+/* Pieces of the main window that dialogs kept in files of their own
+ * share with gtkpass.c */
+
+/* The store behind the view, even while detach_model() has it */
+GtkTreeModel *tv_store(GtkTreeView *tv);
+
+/* Convert a path in the store to one in the view, NULL if it's hidden */
+GtkTreePath *view_path(GtkTreeView *tv, GtkTreePath *path);
+
+/* Find the store row under the cursor, or the TYPE_FILE row above it */
+gboolean cursor_iter(GtkTreeView *tv, GtkTreeIter *iter, gboolean file);
+
+/* Tell the user something in a dialog over the window holding tv, and
+ * wait for them to close it */
+void show_message(GtkTreeView *tv, GtkMessageType type,
+		const char *format, ...) G_GNUC_PRINTF(3, 4);
+
+/* The rest are in gtkpass.c */
+
+/* Bring the rows under a reloaded file up to date with new_db, touching
+ * only groups and entries that changed.  Returns FALSE without touching
+ * anything if the caller has to rebuild the file's rows instead. */
+gboolean reload_rows(GtkTreeStore *ts, GtkTreeIter *file, kpass_db *old_db,
+		kpass_db *new_db, intern_set *keys);
+
+/* The TYPE_FILE row at iter changed, its search index is rebuilt when
+ * it's next needed */
+void drop_search_index(GtkTreeView *tv, GtkTreeIter *iter);
+
+/* Save the TYPE_FILE row at iter once edits to it stop for a while */
+void schedule_save(GtkTreeView *tv, GtkTreeIter *iter);
+
+/* Log what the open files cost, with what just happened */
+void log_usage(const char *what);
+
+#endif